@@ -1,22 +1,137 @@
 // Copyright (c) 2020 Leedehai. All rights reserved.
 // Use of this source code is governed under the LICENSE.txt file.
 // -----
-// sblz::itanium::Demangle() just implements part of the demangling routine:
-// argument types are not extracted.
+// By default, sblz::itanium::Demangle() just implements part of the
+// demangling routine: argument types are not extracted. With the option
+// --parameter-types, they are, like c++filt. With the option --scratch, the
+// demangler runs with a scratch memory as its stack, as in a signal handler
+// on a small alternate signal stack. With the option --first-word, only the
+// first word of the argument is demangled, in place, like a symbol in a line
+// of text. With the option --components, the components of the demangled
+// name are printed after it, each as its kind and its text, e.g.
+// "Foo::Bar() | class Foo | function Bar | parameters ()". With the option
+// --compact, the types are printed compactly, to fit the buffer, and with
+// --width N and --template-depth N, to fit N characters and with N levels
+// of template arguments. With the option --buffer-size N, the buffer has N
+// bytes, and the size it needs is printed after the name, e.g.
+// "_ZN3Foo3BarEv | size 11" with N = 10. With the option --sink, the name
+// is written to the standard output by a sink, without a buffer.
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 #include "sblz/sblz.h"
 
+// Writes the chunk to the stream, which is a std::ostream.
+static void WriteToStream(const char* data, size_t size, void* stream) {
+  static_cast<std::ostream*>(stream)->write(data, size);
+}
+
+// Names of sblz::itanium::DemangleComponentKind.
+static const char* const kComponentKindNames[] = {
+    "namespace", "class",     "scope",         "name",       "function",
+    "operator",  "ctor-dtor", "template-args", "parameters", "return-type",
+};
+
 int main(int argc, char* argv[]) {
+  int flags = sblz::itanium::kDemangleNamesOnly;
+  bool use_scratch = false;
+  bool first_word = false;
+  bool components = false;
+  int width = -1;
+  int template_depth = sblz::itanium::kDemangleCompactTemplateDepth;
+  int buffer_size = -1;
+  bool use_sink = false;
+  while (argc > 2) {
+    if (!std::strcmp(argv[1], "--parameter-types")) {
+      flags |= sblz::itanium::kDemangleParameterTypes;
+    } else if (!std::strcmp(argv[1], "--scratch")) {
+      use_scratch = true;
+    } else if (!std::strcmp(argv[1], "--first-word")) {
+      first_word = true;
+    } else if (!std::strcmp(argv[1], "--components")) {
+      components = true;
+    } else if (!std::strcmp(argv[1], "--sink")) {
+      use_sink = true;
+    } else if (!std::strcmp(argv[1], "--compact")) {
+      flags |= sblz::itanium::kDemangleCompact;
+    } else if (!std::strcmp(argv[1], "--width") && argc > 3) {
+      width = std::atoi(argv[2]);
+      --argc;
+      ++argv;
+    } else if (!std::strcmp(argv[1], "--template-depth") && argc > 3) {
+      template_depth = std::atoi(argv[2]);
+      --argc;
+      ++argv;
+    } else if (!std::strcmp(argv[1], "--buffer-size") && argc > 3) {
+      buffer_size = std::atoi(argv[2]);
+      --argc;
+      ++argv;
+    } else {
+      break;
+    }
+    --argc;
+    ++argv;
+  }
   if (argc != 2) {
-    std::cerr << "[Error] expect 1 argument: the mangled symbol." << std::endl;
+    std::cerr << "[Error] expect 1 argument: the mangled symbol, optionally "
+                 "preceded by --parameter-types, --scratch, --first-word, "
+                 "--components, --compact, --width N, --template-depth N, "
+                 "--buffer-size N or --sink."
+              << std::endl;
     return 1;
   }
   const char* mangled_symbol = argv[1];
   char buffer[512] = {0};
-  const bool ok =
-      sblz::itanium::Demangle(mangled_symbol, buffer, sizeof(buffer));
-  std::cout << (ok ? buffer : mangled_symbol) << std::endl;
+  static char scratch[sblz::itanium::kDemangleScratchSize];
+  sblz::itanium::DemangleComponent component_list[32];
+  int num_components = 0;
+  size_t required_size = 0;
+  bool ok;
+  if (use_sink) {
+    if (!sblz::itanium::Demangle(mangled_symbol, WriteToStream, &std::cout,
+                                 flags)) {
+      std::cout << mangled_symbol;
+    }
+    std::cout << std::endl;
+    return 0;
+  }
+  if (buffer_size >= 0) {
+    ok = sblz::itanium::Demangle(
+        mangled_symbol, buffer,
+        std::min<size_t>(buffer_size, sizeof(buffer)), &required_size, flags);
+  } else if (width >= 0) {
+    ok = sblz::itanium::DemangleCompact(mangled_symbol, buffer,
+                                        sizeof(buffer), template_depth, width);
+  } else if (components) {
+    ok = sblz::itanium::DemangleComponents(
+        mangled_symbol, buffer, sizeof(buffer), component_list,
+        /*max_components=*/32, &num_components, flags);
+  } else if (first_word) {
+    const size_t length = std::strcspn(mangled_symbol, " ");
+    ok = sblz::itanium::Demangle(mangled_symbol, length, buffer,
+                                 sizeof(buffer), flags);
+  } else if (use_scratch) {
+    ok = sblz::itanium::DemangleWithScratch(mangled_symbol, buffer,
+                                            sizeof(buffer), scratch,
+                                            sizeof(scratch), flags);
+  } else {
+    ok = sblz::itanium::Demangle(mangled_symbol, buffer, sizeof(buffer),
+                                 flags);
+  }
+  std::cout << (ok ? buffer : mangled_symbol);
+  const int max_components =
+      sizeof(component_list) / sizeof(component_list[0]);
+  for (int i = 0; i < num_components && i < max_components; ++i) {
+    const sblz::itanium::DemangleComponent& component = component_list[i];
+    std::cout << " | " << kComponentKindNames[component.kind] << " ";
+    std::cout.write(buffer + component.begin, component.end - component.begin);
+  }
+  if (buffer_size >= 0) {
+    std::cout << " | size " << required_size;
+  }
+  std::cout << std::endl;
   return 0;  // Like c++filt, exit with 0 no matter what.
 }
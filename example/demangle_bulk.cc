@@ -0,0 +1,165 @@
+// Copyright (c) 2020 Leedehai. All rights reserved.
+// Use of this source code is governed under the LICENSE.txt file.
+// -----
+// Demangles all the symbols of the symbol table of an ELF file with
+// sblz::itanium::DemangleBulk(), and prints each symbol and its demangled
+// name, separated by a tab, in the order of the symbol table. Without a
+// file, the symbols are read from stdin, one per line.
+// With the option --threads N, N threads are used instead of one per
+// hardware thread. With the option --parameter-types, the parameter types
+// are demangled too.
+
+#include <elf.h>  // Elf64_Ehdr, Elf64_Shdr, Elf64_Sym
+#include <fcntl.h>  // open()
+#include <sys/mman.h>  // mmap()
+#include <sys/stat.h>  // fstat()
+#include <unistd.h>  // close()
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sblz/sblz.h"
+
+// Finds the names of the symbols of the 64-bit ELF file: the string table
+// and the offsets of the names in it. Returns false if it has no symbol
+// table.
+static bool FindSymbolNames(const char* file,
+                            size_t file_size,
+                            const char** strtab,
+                            size_t* strtab_size,
+                            std::vector<uint32_t>* name_offsets) {
+  if (file_size < sizeof(Elf64_Ehdr) || std::memcmp(file, ELFMAG, SELFMAG) ||
+      file[EI_CLASS] != ELFCLASS64) {
+    return false;
+  }
+  const Elf64_Ehdr* header = reinterpret_cast<const Elf64_Ehdr*>(file);
+  if (header->e_shoff > file_size ||
+      (file_size - header->e_shoff) / sizeof(Elf64_Shdr) < header->e_shnum) {
+    return false;
+  }
+  const Elf64_Shdr* sections =
+      reinterpret_cast<const Elf64_Shdr*>(file + header->e_shoff);
+  for (int i = 0; i < header->e_shnum; ++i) {
+    const Elf64_Shdr& symtab = sections[i];
+    if (symtab.sh_type != SHT_SYMTAB || symtab.sh_link >= header->e_shnum) {
+      continue;
+    }
+    const Elf64_Shdr& strtab_section = sections[symtab.sh_link];
+    if (symtab.sh_offset > file_size ||
+        file_size - symtab.sh_offset < symtab.sh_size ||
+        strtab_section.sh_offset > file_size ||
+        file_size - strtab_section.sh_offset < strtab_section.sh_size) {
+      return false;
+    }
+    const Elf64_Sym* symbols =
+        reinterpret_cast<const Elf64_Sym*>(file + symtab.sh_offset);
+    const size_t num_symbols = symtab.sh_size / sizeof(Elf64_Sym);
+    for (size_t j = 0; j < num_symbols; ++j) {
+      name_offsets->push_back(symbols[j].st_name);
+    }
+    *strtab = file + strtab_section.sh_offset;
+    *strtab_size = strtab_section.sh_size;
+    return true;
+  }
+  return false;
+}
+
+int main(int argc, char* argv[]) {
+  int flags = sblz::itanium::kDemangleNamesOnly;
+  int num_threads = 0;
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] == '-') {
+    if (!std::strcmp(argv[1], "--parameter-types")) {
+      flags |= sblz::itanium::kDemangleParameterTypes;
+    } else if (!std::strcmp(argv[1], "--threads") && argc > 2) {
+      num_threads = std::atoi(argv[2]);
+      --argc;
+      ++argv;
+    } else {
+      break;
+    }
+    --argc;
+    ++argv;
+  }
+  if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+    std::cerr << "[Error] expect at most 1 argument: the ELF file, "
+                 "optionally preceded by --parameter-types or --threads N."
+              << std::endl;
+    return 1;
+  }
+
+  // The symbols: either those read from stdin, or those in the string table
+  // of the ELF file.
+  std::vector<std::string> lines;
+  std::vector<const char*> symbols;
+  const char* strtab = NULL;
+  size_t strtab_size = 0;
+  std::vector<uint32_t> name_offsets;
+  size_t num_symbols;
+  if (argc == 1) {
+    for (std::string line; std::getline(std::cin, line);) {
+      lines.push_back(line);
+    }
+    for (const std::string& line : lines) {
+      symbols.push_back(line.c_str());
+    }
+    num_symbols = symbols.size();
+  } else {
+    const int fd = open(argv[1], O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0) {
+      std::cerr << "[Error] cannot open " << argv[1] << std::endl;
+      return 1;
+    }
+    const size_t file_size = file_stat.st_size;
+    void* file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED ||
+        !FindSymbolNames(static_cast<const char*>(file), file_size, &strtab,
+                         &strtab_size, &name_offsets)) {
+      std::cerr << "[Error] no symbol table in " << argv[1] << std::endl;
+      return 1;
+    }
+    num_symbols = name_offsets.size();
+  }
+
+  // Guess the size of the arena, and retry with the size needed if it is too
+  // small.
+  std::vector<char> arena((strtab_size + num_symbols) * 2);
+  std::vector<size_t> offsets(num_symbols);
+  size_t arena_used = 0;
+  while (true) {
+    const bool ok =
+        strtab == NULL
+            ? sblz::itanium::DemangleBulk(symbols.data(), num_symbols,
+                                          arena.data(), arena.size(),
+                                          offsets.data(), &arena_used,
+                                          num_threads, flags)
+            : sblz::itanium::DemangleBulk(strtab, strtab_size,
+                                          name_offsets.data(), num_symbols,
+                                          arena.data(), arena.size(),
+                                          offsets.data(), &arena_used,
+                                          num_threads, flags);
+    if (ok) {
+      break;
+    }
+    arena.resize(arena_used);
+  }
+
+  std::string output;
+  for (size_t i = 0; i < num_symbols; ++i) {
+    if (strtab == NULL) {
+      output += symbols[i];
+    } else if (name_offsets[i] < strtab_size) {
+      output += strtab + name_offsets[i];
+    }
+    output += '\t';
+    output += arena.data() + offsets[i];
+    output += '\n';
+  }
+  std::cout << output;
+  return 0;
+}
@@ -0,0 +1,32 @@
+// Copyright (c) 2020 Leedehai. All rights reserved.
+// Use of this source code is governed under the LICENSE.txt file.
+// -----
+// A c++filt-like filter: reads text from stdin, and writes it to stdout with
+// the mangled symbols in it demangled by sblz::itanium::DemangleStream().
+// With the option --parameter-types, the parameter types are demangled too.
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "sblz/sblz.h"
+
+int main(int argc, char* argv[]) {
+  int flags = sblz::itanium::kDemangleNamesOnly;
+  if (argc == 2 && !std::strcmp(argv[1], "--parameter-types")) {
+    flags |= sblz::itanium::kDemangleParameterTypes;
+  } else if (argc != 1) {
+    std::cerr << "[Error] expect no argument, or --parameter-types; the "
+                 "text is read from stdin."
+              << std::endl;
+    return 1;
+  }
+  if (!sblz::itanium::DemangleStream(STDIN_FILENO, STDOUT_FILENO, flags)) {
+    std::cerr << "[Error] failed to read stdin or write stdout: "
+              << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -29,7 +29,13 @@
 // [00] 0x0000000000400d8a _start
 
 #include <execinfo.h>  // backtrace()
-#include <string.h>  // memcpy()
+#include <fcntl.h>  // open()
+#include <setjmp.h>  // sigjmp_buf, sigsetjmp(), siglongjmp()
+#include <signal.h>  // sigaction()
+#include <stdlib.h>  // exit()
+#include <string.h>  // memcpy(), memset(), strcmp(), strcpy(), strlen(),
+                    // strncpy()
+#include <unistd.h>  // write()
 
 #include <cstddef>
 #include <iomanip>
@@ -47,9 +53,26 @@ bool itoa_r(intptr_t value,
             size_t min_width_of_digits,
             char padding_char);
 
+// In example/symbolize_no_frame_pointer.cc, built without frame pointers.
+void CallWithoutFramePointer(void (*function)());
+
+static bool g_use_frame_pointers = false;
+static bool g_use_cfi = false;
+
 class StackTrace {
  public:
-  StackTrace() { count_ = backtrace(stack_trace_, kMaxStackTrace); }
+  // Unwinds from the caller, or from the signal context if it is not NULL.
+  explicit StackTrace(const void* context = NULL) {
+    if (g_use_frame_pointers) {
+      count_ = sblz::posix::UnwindWithFramePointers(context, stack_trace_,
+                                                    kMaxStackTrace);
+    } else if (g_use_cfi) {
+      count_ = sblz::posix::UnwindWithCfi(context, stack_trace_,
+                                          kMaxStackTrace);
+    } else {
+      count_ = backtrace(stack_trace_, kMaxStackTrace);
+    }
+  }
   void** GetTrace() { return stack_trace_; }
   int GetCount() const { return count_; }
 
@@ -59,15 +82,138 @@ class StackTrace {
   int count_;
 };
 
+static bool g_use_batch = false;
+static bool g_use_cache = false;
+static bool g_demangle = false;
+static bool g_use_required_size = false;
+static bool g_use_sink = false;
+static int g_raw_trace_fd = -1;
+
+// Appends the chunk to the buffer, which is a std::string.
+static void AppendToString(const char* data, size_t size, void* buffer) {
+  static_cast<std::string*>(buffer)->append(data, size);
+}
+static sblz::posix::SymbolCache g_symbol_cache;
+
+// With --signal, f7() faults by writing to this address, and the SIGSEGV
+// handler unwinds from its context, i.e. from the faulting instruction.
+static bool g_use_signal = false;
+static volatile int* volatile g_fault_address = NULL;
+static StackTrace* g_signal_stack_trace = NULL;
+static sigjmp_buf g_fault_return;
+
+static void HandleFault(int, siginfo_t*, void* context) {
+  *g_signal_stack_trace = StackTrace(context);
+  siglongjmp(g_fault_return, 1);
+}
+
 NO_INLINE void f7() {
   StackTrace stack_trace;
+  if (g_use_signal) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = HandleFault;
+    action.sa_flags = SA_SIGINFO | SA_RESETHAND;
+    sigaction(SIGSEGV, &action, NULL);
+    g_signal_stack_trace = &stack_trace;
+    if (sigsetjmp(g_fault_return, 1) == 0) {
+      *g_fault_address = 0;
+    }
+  }
   int trace_count = stack_trace.GetCount();
   void** trace = stack_trace.GetTrace();
+  if (g_raw_trace_fd >= 0) {
+    // Append the raw trace to the file with one write(), to be symbolized
+    // offline, instead of printing the trace.
+    char raw_trace[sblz::posix::kRawTraceHeaderSize +
+                   32 * sblz::posix::kRawTraceMaxFrameSize];
+    const size_t size = sblz::posix::RecordRawTrace(trace, trace_count,
+                                                    raw_trace,
+                                                    sizeof(raw_trace));
+    if (size == 0 || write(g_raw_trace_fd, raw_trace, size) !=
+                         static_cast<ssize_t>(size)) {
+      std::cerr << "[Error] cannot record the raw trace" << std::endl;
+      exit(1);
+    }
+    return;
+  }
+  static const int kSymbolBufferSize = 128;
+  char batch_buffers[32 * kSymbolBufferSize] = {0};
+  if (g_use_batch) {
+    sblz::posix::SymbolizeBatch(trace, trace_count, batch_buffers,
+                                kSymbolBufferSize);
+  } else if (g_use_cache) {
+    // Warm up the cache, so that the lookups below hit it.
+    for (int i = 0; i < trace_count; ++i) {
+      sblz::posix::SymbolizeCached(&g_symbol_cache, trace[i], batch_buffers,
+                                   kSymbolBufferSize);
+    }
+  }
   for (int i = 0; i < trace_count; ++i) {
-    char symbol_buffer[128] = {0};
-    if (!sblz::posix::Symbolize(trace[i], symbol_buffer,
-                                sizeof(symbol_buffer))) {
-      memcpy(symbol_buffer, "(blank)", sizeof(symbol_buffer));
+    char symbol_buffer[kSymbolBufferSize] = {0};
+    if (g_use_batch) {
+      memcpy(symbol_buffer, batch_buffers + i * kSymbolBufferSize,
+             kSymbolBufferSize);
+    } else if (g_use_sink) {
+      std::string name;
+      const bool ok =
+          g_demangle
+              ? sblz::posix::SymbolizeAndDemangle(trace[i], AppendToString,
+                                                  &name)
+              : sblz::posix::Symbolize(trace[i], AppendToString, &name);
+      if (!ok) {
+        name = "(blank)";
+      }
+      strncpy(symbol_buffer, name.c_str(), sizeof(symbol_buffer) - 1);
+    } else if (g_use_required_size) {
+      // Ask for the size first, then check it against what is written.
+      size_t required_size = 0;
+      const bool ok =
+          g_demangle ? sblz::posix::SymbolizeAndDemangle(trace[i], NULL, 0,
+                                                         &required_size)
+                     : sblz::posix::Symbolize(trace[i], NULL, 0,
+                                              &required_size);
+      if (!ok) {
+        strcpy(symbol_buffer, "(blank)");
+      } else if (required_size <= sizeof(symbol_buffer)) {
+        size_t written_size = 0;
+        if (g_demangle) {
+          sblz::posix::SymbolizeAndDemangle(trace[i], symbol_buffer,
+                                            required_size, &written_size);
+        } else {
+          sblz::posix::Symbolize(trace[i], symbol_buffer, required_size,
+                                 &written_size);
+        }
+        if (written_size != required_size ||
+            strlen(symbol_buffer) + 1 != required_size) {
+          std::cerr << "[Error] size mismatch: " << symbol_buffer << std::endl;
+          exit(1);
+        }
+      }
+    } else if (g_demangle) {
+      if (!sblz::posix::SymbolizeAndDemangle(trace[i], symbol_buffer,
+                                             sizeof(symbol_buffer))) {
+        strcpy(symbol_buffer, "(blank)");
+      }
+    } else if (g_use_cache) {
+      if (!sblz::posix::SymbolizeCached(&g_symbol_cache, trace[i],
+                                        symbol_buffer, sizeof(symbol_buffer))) {
+        strcpy(symbol_buffer, "(blank)");
+      }
+      // A hit with a buffer too small for any symbol fails as a miss does.
+      char small_buffer[4] = {0};
+      for (size_t size = 0; size <= sizeof(small_buffer); ++size) {
+        if (sblz::posix::SymbolizeCached(&g_symbol_cache, trace[i],
+                                         small_buffer, size) !=
+            sblz::posix::Symbolize(trace[i], small_buffer, size)) {
+          std::cerr << "[Error] cache mismatch with a buffer of size " << size
+                    << std::endl;
+          exit(1);
+        }
+      }
+    } else if (!sblz::posix::Symbolize(trace[i], symbol_buffer,
+                                       sizeof(symbol_buffer))) {
+      strcpy(symbol_buffer, "(blank)");
     }
     char address_buffer[17] = {0};
     itoa_r(reinterpret_cast<intptr_t>(trace[i]), address_buffer,
@@ -79,8 +225,16 @@ NO_INLINE void f7() {
   }
 }
 
+// With --omit-frame-pointer, f6() calls f7() through a function without
+// frame pointer, which only the CFI unwinder unwinds through.
+static bool g_omit_frame_pointer = false;
+
 NO_INLINE void f6() {
-  f7();
+  if (g_omit_frame_pointer) {
+    CallWithoutFramePointer(f7);
+  } else {
+    f7();
+  }
 }
 
 NO_INLINE void f5(const std::ostream*) {
@@ -105,7 +259,78 @@ NO_INLINE void f1(int, int) {
   f2(1.0, MyStruct());
 }
 
-int main() {
+// Usage:
+//   example_symbolize [--module-table [--dl-iterate-phdr] [--pre-open]
+//                     [--symbol-index-files DIR] [--symbol-index] [--mmap]]
+//                     [--batch | --cache |
+//                      [--demangle] [--required-size | --sink] |
+//                      --raw-trace FILE]
+//                     [--frame-pointers | --cfi] [--signal]
+//                     [--omit-frame-pointer]
+int main(int argc, char* argv[]) {
+  bool use_module_table = false;
+  bool use_symbol_index = false;
+  bool use_mmap = false;
+  bool use_pre_open = false;
+  const char* symbol_index_directory = NULL;
+  sblz::posix::ModuleDiscovery discovery = sblz::posix::kDiscoverByProcMaps;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--module-table") == 0) {
+      use_module_table = true;
+    } else if (strcmp(argv[i], "--dl-iterate-phdr") == 0) {
+      discovery = sblz::posix::kDiscoverByDlIteratePhdr;
+    } else if (strcmp(argv[i], "--pre-open") == 0) {
+      use_pre_open = true;
+    } else if (strcmp(argv[i], "--symbol-index-files") == 0 && i + 1 < argc) {
+      symbol_index_directory = argv[++i];
+    } else if (strcmp(argv[i], "--symbol-index") == 0) {
+      use_symbol_index = true;
+    } else if (strcmp(argv[i], "--mmap") == 0) {
+      use_mmap = true;
+    } else if (strcmp(argv[i], "--batch") == 0) {
+      g_use_batch = true;
+    } else if (strcmp(argv[i], "--demangle") == 0) {
+      g_demangle = true;
+    } else if (strcmp(argv[i], "--required-size") == 0) {
+      g_use_required_size = true;
+    } else if (strcmp(argv[i], "--sink") == 0) {
+      g_use_sink = true;
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      g_use_cache = true;
+    } else if (strcmp(argv[i], "--frame-pointers") == 0) {
+      g_use_frame_pointers = true;
+    } else if (strcmp(argv[i], "--cfi") == 0) {
+      g_use_cfi = true;
+    } else if (strcmp(argv[i], "--signal") == 0) {
+      g_use_signal = true;
+    } else if (strcmp(argv[i], "--omit-frame-pointer") == 0) {
+      g_omit_frame_pointer = true;
+    } else if (strcmp(argv[i], "--raw-trace") == 0 && i + 1 < argc) {
+      g_raw_trace_fd = open(argv[++i], O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (g_raw_trace_fd < 0) {
+        std::cerr << "[Error] cannot open " << argv[i] << std::endl;
+        return 1;
+      }
+    }
+  }
+  if (use_module_table) {
+    sblz::posix::InitModuleTable(discovery);
+  }
+  if (use_pre_open) {
+    sblz::posix::OpenObjectFiles();
+  }
+  if (symbol_index_directory != NULL &&
+      sblz::posix::LoadSymbolIndexFiles(symbol_index_directory) == 0) {
+    std::cerr << "[Error] no symbol index file in " << symbol_index_directory
+              << std::endl;
+    return 1;
+  }
+  if (use_symbol_index) {
+    sblz::posix::BuildSymbolIndex(/*memory=*/NULL, /*memory_size=*/0);
+  }
+  if (use_mmap) {
+    sblz::posix::MapObjectFiles();
+  }
   f1(0, 1);
 }
 
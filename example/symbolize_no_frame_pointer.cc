@@ -0,0 +1,11 @@
+// Copyright (c) 2020 Leedehai. All rights reserved.
+// Use of this source code is governed under the LICENSE.txt file.
+
+// Built with -fomit-frame-pointer, unlike example/symbolize.cc, so that a
+// trace through it can only be unwound with the call frame information.
+
+#define NO_INLINE __attribute__((noinline))
+
+NO_INLINE void CallWithoutFramePointer(void (*function)()) {
+  function();
+}
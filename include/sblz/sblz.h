@@ -5,11 +5,125 @@
 #define SBLZ_INCLUDE_SBLZ_SBLZ_H_
 
 #include <cstddef>
+#include <cstdint>
 
 namespace sblz {
 
+/// Receives the output of a function in chunks, in order, e.g. to write it
+/// to a file descriptor or a ring buffer without copying it out of a buffer
+/// first. It is called on the thread of the function, and must be
+/// async-signal-safe if the function is called in a signal handler.
+/// @param data The chunk, which is not terminated by '\0'.
+/// @param size Size of the chunk, which is not 0.
+/// @param context The context given to the function along with the sink.
+typedef void (*OutputSink)(const char* data, size_t size, void* context);
+
 namespace posix {
 
+/// How InitModuleTable() discovers the executable mappings.
+enum ModuleDiscovery {
+  /// Parse /proc/self/maps. This sees every executable mapping, including
+  /// those not loaded by the dynamic linker, e.g. the vDSO and JIT code.
+  kDiscoverByProcMaps,
+  /// Walk the program headers of the loaded objects with dl_iterate_phdr(),
+  /// which needs neither /proc nor any file access other than resolving the
+  /// path of the main executable, and sees the objects loaded with dlopen().
+  kDiscoverByDlIteratePhdr,
+};
+
+/// Takes a snapshot of the executable mappings of the running process
+/// (start and end address, module base address and path)
+/// into a preallocated, fixed-capacity module table, so that Symbolize()
+/// finds the mapping of an address by binary search in the table instead
+/// of parsing /proc/self/maps, i.e. without any system call. Returns true
+/// on success.
+/// Call it outside of signal handlers, e.g. at startup, and call it again
+/// after loading shared libraries with dlopen(). It must not be called
+/// concurrently with Symbolize(). Addresses not covered by the snapshot
+/// are still symbolized by parsing /proc/self/maps.
+/// On macOS, this is a no-op.
+/// @param discovery How to discover the executable mappings.
+bool InitModuleTable(ModuleDiscovery discovery = kDiscoverByProcMaps);
+
+/// Builds a symbol index for each module in the module table, i.e. an
+/// array of (start address, size, name offset) sorted by address, so
+/// that Symbolize() finds the symbol of an address by binary search in
+/// O(log n) instead of scanning the whole symbol table. Returns true on
+/// success; the modules that cannot be indexed, e.g. for lack of memory,
+/// are still symbolized by scanning the symbol tables.
+/// Call it after InitModuleTable(), outside of signal handlers. It must
+/// not be called concurrently with Symbolize(). Calling InitModuleTable()
+/// again drops the indices.
+/// On macOS, this is a no-op.
+/// @param memory The memory to hold the indices, which must outlive the
+///     module table; or NULL to let the library mmap() as much as needed.
+/// @param memory_size Size of the memory. Ignored if memory is NULL.
+bool BuildSymbolIndex(void* memory, size_t memory_size);
+
+/// Maps the ELF header, section headers, and regular and dynamic symbol
+/// and string tables of the object file of each module in the module
+/// table read-only into memory, so that Symbolize() reads them from
+/// memory, copying symbol names straight out of the string tables,
+/// instead of opening the object file and reading it with pread().
+/// Returns true on success; the modules that cannot be mapped are still
+/// read with pread().
+/// Call it after InitModuleTable(), outside of signal handlers. It must
+/// not be called concurrently with Symbolize(). Calling InitModuleTable()
+/// again unmaps the object files.
+/// On macOS, this is a no-op.
+bool MapObjectFiles();
+
+/// Writes a symbol index file of the object file, which has the index that
+/// BuildSymbolIndex() builds, with the names, so that the processes
+/// running the object file load it with LoadSymbolIndexFiles() instead of
+/// building the index and reading the object file. The file is named after
+/// the GNU build ID of the object file, "<build ID in hex>.symidx", and is
+/// written to a temporary file and renamed, so it can be replaced while
+/// processes map it. It is for the machine it is written on, as it is in
+/// the native byte order.
+/// It is not async-signal-safe. On macOS, this is a no-op that returns
+/// false.
+/// @param object_file Path of the object file, e.g. an executable or a
+///     shared library.
+/// @param directory The directory to write the file to.
+/// @param demangle Whether to store the demangled name of each symbol too,
+///     as SymbolizeAndDemangle() gives, so that it gives the name without
+///     demangling.
+/// @return False if the object file has no build ID, or if the file cannot
+///     be written.
+bool WriteSymbolIndexFile(const char* object_file,
+                          const char* directory,
+                          bool demangle);
+
+/// Maps the symbol index files written by WriteSymbolIndexFile() in the
+/// directory, for the modules in the module table whose object files have
+/// the same build IDs, so that Symbolize() finds the symbol of an address by
+/// binary search in the file and reads the name from it, without reading
+/// the object file. The files are mapped read-only and shared, so the
+/// processes mapping a file share its pages in the page cache, and the
+/// memory and time it takes per process are close to nothing.
+/// Call it after InitModuleTable(), outside of signal handlers. It must
+/// not be called concurrently with Symbolize(). It replaces the indices
+/// built by BuildSymbolIndex() for the modules whose files are found; call
+/// BuildSymbolIndex() afterwards to index the other modules. Calling it or
+/// InitModuleTable() again unmaps the files.
+/// On macOS, this is a no-op.
+/// @param directory The directory of the symbol index files.
+/// @return The number of files mapped.
+int LoadSymbolIndexFiles(const char* directory);
+
+/// Opens the object file of each module in the module table and keeps the
+/// file descriptors, so that Symbolize() reads the object files through
+/// them instead of calling open() and close() for each lookup. This also
+/// allows symbolizing after open() is forbidden, e.g. by a seccomp policy
+/// installed after this call. Returns true on success; the modules that
+/// cannot be opened are still opened on lookup.
+/// Call it after InitModuleTable(), outside of signal handlers. It must
+/// not be called concurrently with Symbolize(). Calling InitModuleTable()
+/// again closes the file descriptors.
+/// On macOS, this is a no-op.
+bool OpenObjectFiles();
+
 /// Retrieves the mangled symbol from the running process's memory
 /// that corresponds to the function call represented by the input
 /// address (instruction address, in the program counter register)
@@ -23,17 +137,563 @@ namespace posix {
 /// @param buffer_size Buffer size, including the space for '\0'.
 bool Symbolize(void* address, char* buffer, size_t buffer_size);
 
+/// Same as Symbolize(), but writes the demangled name of the symbol, as
+/// sblz::itanium::Demangle() gives, or the symbol itself if it cannot be
+/// demangled, e.g. it is not a mangled name or its demangled name does not
+/// fit. This saves the buffer of the mangled symbol, and the mangled
+/// symbol is not truncated by the buffer: it is demangled straight from
+/// the string table if the object file is mapped (see MapObjectFiles()),
+/// and from an internal buffer of 1024 bytes otherwise.
+/// @param address The memory address got from backtrace().
+/// @param buffer The output buffer.
+/// @param buffer_size Buffer size, including the space for '\0'.
+bool SymbolizeAndDemangle(void* address, char* buffer, size_t buffer_size);
+
+/// Same as Symbolize(), but also gives the size of the buffer that the
+/// result needs, like snprintf(), so that the caller can tell whether it is
+/// truncated, and size the buffer once if so. A symbol that does not fit is
+/// truncated instead of skipped. The buffer may be smaller than 5 bytes, or
+/// NULL if buffer_size is 0.
+/// @param address The memory address got from backtrace().
+/// @param buffer The output buffer.
+/// @param buffer_size Buffer size, including the space for '\0'.
+/// @param required_size [out] Buffer size needed, including the space for
+///     '\0', or 0 if it returns false.
+bool Symbolize(void* address,
+               char* buffer,
+               size_t buffer_size,
+               size_t* required_size);
+
+/// Same as SymbolizeAndDemangle(), but also gives the size of the buffer
+/// that the demangled name needs, as Symbolize() with "required_size" does.
+/// @param address The memory address got from backtrace().
+/// @param buffer The output buffer.
+/// @param buffer_size Buffer size, including the space for '\0'.
+/// @param required_size [out] Buffer size needed, including the space for
+///     '\0', or 0 if it returns false.
+bool SymbolizeAndDemangle(void* address,
+                          char* buffer,
+                          size_t buffer_size,
+                          size_t* required_size);
+
+/// Same as Symbolize(), but gives the symbol to the sink instead of writing
+/// it to a buffer, so that it is not limited in length. If the object file
+/// is mapped (see MapObjectFiles()), the symbol is given straight from the
+/// string table in one chunk; otherwise it is read in chunks of 256 bytes.
+/// Nothing is given to the sink if it returns false.
+/// @param address The memory address got from backtrace().
+/// @param sink The sink that receives the symbol.
+/// @param sink_context The context passed to the sink.
+bool Symbolize(void* address, OutputSink sink, void* sink_context);
+
+/// Same as SymbolizeAndDemangle(), but gives the name to the sink, as
+/// Symbolize() with a sink does. The demangled name is given in one chunk,
+/// and is limited to itanium::kDemangleSinkBufferSize - 1 characters; the
+/// symbol is given instead if it is longer.
+/// @param address The memory address got from backtrace().
+/// @param sink The sink that receives the name.
+/// @param sink_context The context passed to the sink.
+bool SymbolizeAndDemangle(void* address, OutputSink sink, void* sink_context);
+
+/// Symbolizes a whole backtrace in one pass, which is much cheaper than
+/// calling Symbolize() for each address: the addresses are sorted, the
+/// mappings are walked once, and each object file is opened and its
+/// symbol table walked once for all the addresses in it. The result for
+/// each address is the same as what Symbolize() gives, and the buffer of
+/// an address that cannot be symbolized is set to an empty string.
+/// Returns the number of addresses symbolized.
+/// @param addresses The memory addresses got from backtrace().
+/// @param n Number of addresses.
+/// @param buffers [out] The output buffers of n * buffer_size bytes in
+///     total; the symbol of addresses[i] goes to buffers + i * buffer_size.
+/// @param buffer_size Size of each buffer, including the space for '\0'.
+size_t SymbolizeBatch(void* const* addresses,
+                      size_t n,
+                      char* buffers,
+                      size_t buffer_size);
+
+/// Walks the frame pointers to get the return addresses on the stack, like
+/// backtrace(), but is async-signal-safe and much faster. It needs the code
+/// to be built with frame pointers, e.g. -fno-omit-frame-pointer, and stops
+/// at the first function without. Each frame is checked before it is read:
+/// frames must be aligned and go up the stack, the stack memory must be
+/// readable, and, if the module table has been initialized, the return
+/// addresses must be in its modules, so a corrupt stack ends the walk
+/// instead of causing a fault. Returns the number of addresses.
+/// On macOS, this calls backtrace(), and a signal context is not supported.
+/// @param context The ucontext_t given to a SA_SIGINFO signal handler, to
+///     unwind the interrupted code starting from its program counter; or
+///     NULL to unwind from the caller (the caller's own address is first).
+/// @param addresses [out] The output addresses.
+/// @param max_depth Capacity of the addresses, in number of addresses.
+size_t UnwindWithFramePointers(const void* context,
+                               void** addresses,
+                               size_t max_depth);
+
+/// Unwinds the stack like UnwindWithFramePointers(), but with the DWARF call
+/// frame information in the .eh_frame sections, so it also unwinds through
+/// code built without frame pointers, such as most system libraries. The
+/// frame description entry of each frame is found by binary search in the
+/// table of the .eh_frame_hdr section, which is located when the module
+/// table is initialized, and interpreted without allocation, so it is
+/// async-signal-safe. It needs the module table to be initialized, and
+/// stops at a frame without call frame information or with rules it does
+/// not support (DWARF expressions for the CFA or the return address).
+/// Stack reads are checked as in UnwindWithFramePointers(). Returns the
+/// number of addresses.
+/// It supports x86-64 and AArch64. On macOS, this calls backtrace(), and a
+/// signal context is not supported.
+/// @param context The ucontext_t given to a SA_SIGINFO signal handler, to
+///     unwind the interrupted code starting from its program counter; or
+///     NULL to unwind from the caller (the caller's own address is first).
+/// @param addresses [out] The output addresses.
+/// @param max_depth Capacity of the addresses, in number of addresses.
+size_t UnwindWithCfi(const void* context, void** addresses, size_t max_depth);
+
+/// A cache of the results of Symbolize() keyed by address, so that
+/// repeated lookups of the same addresses, e.g. by a sampling profiler or
+/// a rate-limited logger, cost a hash and a copy. It is direct-mapped: an
+/// address evicts the one cached in the same entry. Symbols of
+/// kMaxSymbolSize bytes or more (including '\0') are not cached.
+/// A cache must be used by one thread only, e.g. declared thread_local.
+/// Lookups are safe in signal handlers, including in one that interrupts a
+/// lookup on the same thread, in which case the interrupting lookup
+/// bypasses the cache. A cache must be zero-initialized, e.g. by static or
+/// thread_local storage, or by ClearSymbolCache(). Calling
+/// InitModuleTable() empties the caches.
+struct SymbolCache {
+  static const int kNumEntries = 256;
+  static const int kMaxSymbolSize = 248;
+  struct Entry {
+    void* address;  // NULL if the entry is empty.
+    char symbol[kMaxSymbolSize];
+  };
+  Entry entries[kNumEntries];
+  unsigned generation;  // Of the module table that the entries are from.
+  volatile int busy;  // Non-zero while a lookup is using the cache.
+  size_t hits;  // Number of lookups found in the cache.
+  size_t misses;  // Number of lookups not found in the cache.
+};
+
+/// Empties the cache and resets its counters.
+/// @param cache The cache.
+void ClearSymbolCache(SymbolCache* cache);
+
+/// Same as Symbolize(), but looks up the address in the cache first, and
+/// caches the symbol found if not.
+/// @param cache The cache of the calling thread.
+/// @param address The memory address got from backtrace().
+/// @param buffer The output buffer.
+/// @param buffer_size Buffer size, including the space for '\0'.
+bool SymbolizeCached(SymbolCache* cache,
+                     void* address,
+                     char* buffer,
+                     size_t buffer_size);
+
+/// Maximum size of a GNU build ID, which is usually 20 bytes (SHA-1).
+const size_t kMaxBuildIdSize = 64;
+
+/// Size of the header of a raw trace, see RecordRawTrace().
+const size_t kRawTraceHeaderSize = 16;
+
+/// Maximum number of bytes an address adds to a raw trace: its frame, and
+/// the load bias and the build ID of its module if it is the first address
+/// in the module.
+const size_t kRawTraceMaxFrameSize = 12 + 9 + kMaxBuildIdSize;
+
+/// Records a backtrace in a compact binary form, the raw trace, to be
+/// symbolized offline later against the original object files, e.g. with
+/// the tool sblz_symbolize_trace, so that a crash handler does no symbol
+/// lookup at all. Each address is recorded as its offset from the load bias
+/// of its module, i.e. the address in the object file, and each module in
+/// the trace as its load bias and its GNU build ID, read from its PT_NOTE
+/// segments by InitModuleTable(). An address not in the module table, or in
+/// a mapping, without an object file such as JIT code, is recorded as it
+/// is. It only does binary searches in the module table, so it is
+/// async-signal-safe, and the trace can be written with a single write(),
+/// which keeps concurrent traces appended to one file intact.
+/// It needs the module table to be initialized. Returns the size of the
+/// trace, or 0 if it does not fit; a buffer of kRawTraceHeaderSize +
+/// n * kRawTraceMaxFrameSize bytes is always large enough.
+/// On macOS, this is not supported and returns 0.
+/// @param addresses The memory addresses got from backtrace().
+/// @param n Number of addresses.
+/// @param buffer [out] The output buffer.
+/// @param buffer_size Buffer size.
+size_t RecordRawTrace(void* const* addresses,
+                      size_t n,
+                      void* buffer,
+                      size_t buffer_size);
+
+/// An address decoded from a raw trace, see DecodeRawTrace().
+struct RawTraceFrame {
+  /// Offset of the address from the load bias of its module, or the
+  /// address itself if its module is unknown.
+  uint64_t offset;
+  /// Load bias of the module, or 0 if unknown, so that load_bias + offset
+  /// is always the address recorded.
+  uint64_t load_bias;
+  /// Build ID of the module, pointing into the trace, or NULL if the
+  /// module is unknown or has no build ID.
+  const uint8_t* build_id;
+  size_t build_id_size;
+};
+
+/// Decodes a raw trace written by RecordRawTrace(), possibly on another
+/// machine of the same byte order. Returns the size of the trace, so that
+/// the next one in a file of concatenated traces starts there, or 0 if the
+/// data does not start with a valid trace.
+/// @param data The raw trace.
+/// @param size Size of the data, which may extend beyond the trace.
+/// @param frames [out] The output frames, in the order of the addresses.
+/// @param max_frames Capacity of the frames. The frames beyond are skipped.
+/// @param num_frames [out] Number of addresses in the trace.
+size_t DecodeRawTrace(const void* data,
+                      size_t size,
+                      RawTraceFrame* frames,
+                      size_t max_frames,
+                      size_t* num_frames);
+
+/// Reads the GNU build ID of an object file, to find the object file of a
+/// module of a raw trace. Returns the size of the build ID, or -1 if it is
+/// not an ELF binary or has no build ID. On macOS, this returns -1.
+/// @param object_file Path of the object file.
+/// @param build_id [out] The output build ID of up to kMaxBuildIdSize bytes.
+int GetBuildId(const char* object_file, uint8_t* build_id);
+
+/// Symbolizes addresses in an object file given as offsets from the load
+/// bias, e.g. those in a raw trace, offline. The symbol index of the object
+/// file is built once for all of them, so this is cheap for many offsets.
+/// The result for each offset is what Symbolize() gives for the address
+/// when the object file is loaded, and the buffer of an offset that cannot
+/// be symbolized is set to an empty string. Returns the number of offsets
+/// symbolized. It allocates, so it is not async-signal-safe.
+/// On macOS, this is not supported and returns 0.
+/// @param object_file Path of the object file.
+/// @param offsets The offsets.
+/// @param n Number of offsets.
+/// @param buffers [out] The output buffers of n * buffer_size bytes in
+///     total; the symbol of offsets[i] goes to buffers + i * buffer_size.
+/// @param buffer_size Size of each buffer, including the space for '\0'.
+/// @param demangle Write the demangled names, as SymbolizeAndDemangle()
+///     does.
+size_t SymbolizeOffsets(const char* object_file,
+                        const uint64_t* offsets,
+                        size_t n,
+                        char* buffers,
+                        size_t buffer_size,
+                        bool demangle);
+
 }  // namespace posix
 
 namespace itanium {
 
+/// Flags of Demangle(), which may be or'ed together.
+enum DemangleFlags {
+  /// Print the names only, with the parameter types and template arguments
+  /// left out, e.g. "Foo<>::Bar()".
+  kDemangleNamesOnly = 0,
+  /// Also print the parameter types, template arguments, cv- and
+  /// ref-qualifiers of member functions, and the return types of function
+  /// templates, like c++filt does, e.g. "Foo<int>::Bar(char const*) const".
+  /// Template parameters are printed as the template arguments they refer
+  /// to, for up to 16 arguments.
+  kDemangleParameterTypes = 1 << 0,
+  /// Print the types like kDemangleParameterTypes, but compactly, to fit
+  /// the output buffer: the inline namespaces, and the default template
+  /// arguments of the std containers, strings, streams and unique_ptr, are
+  /// dropped, well-known std types are abbreviated, and the template
+  /// arguments nested in others are printed as "<...>",
+  /// e.g. "std::map<std::string, std::vector<...> >::at(std::string const&)".
+  /// If the name is still too long, the less important parts are dropped
+  /// until it fits: the template arguments level by level, then the return
+  /// type and the parameter types, which are printed as "(...)", then all
+  /// the types; as the last resort, the end is cut and replaced with "...".
+  /// The text that is dropped is skipped by the demangler, not generated.
+  /// See DemangleCompact() for other depths and widths. DemangleComponents()
+  /// and DemangleWithScratch() take it as kDemangleParameterTypes.
+  kDemangleCompact = 1 << 1,
+};
+
+/// Limits on the work of a call of Demangle(), which bound its running time
+/// and stack usage on any input, including crafted ones. Demangle() fails
+/// as soon as a limit is exceeded, so that the caller falls back to the
+/// mangled symbol.
+/// A step is an attempt to parse a component of the grammar, e.g. a type.
+/// With the default limits, a call takes at most about 1 ms on a modern
+/// x86-64 machine, and at most about 28 KB of stack, or 48 KB with
+/// kDemangleParameterTypes. The symbols in real programs need far less,
+/// e.g. those of libstdc++ take at most 82 steps and a depth of 19.
+struct DemangleLimits {
+  static const int kDefaultMaxSteps = 1 << 15;
+  static const int kDefaultMaxDepth = 128;
+  /// Maximum number of steps.
+  int max_steps;
+  /// Maximum nesting depth of the steps, which bounds the stack usage.
+  int max_depth;
+};
+
 /// Demangles a symbol according to the Itanium C++ ABI and writes
 /// the result to the output buffer, then returns true on success.
 /// https://itanium-cxx-abi.github.io/cxx-abi/abi.html#mangling
 /// @param symbol The the mangled symbol as a C-string.
 /// @param buffer [out] The output buffer
 /// @param buffer_size Buffer size, including the space of '\0'.
-bool Demangle(const char* symbol, char* buffer, size_t buffer_size);
+/// @param flags Bitwise or of DemangleFlags.
+/// @param limits The limits on the work, or NULL for the default limits.
+bool Demangle(const char* symbol,
+              char* buffer,
+              size_t buffer_size,
+              int flags = kDemangleNamesOnly,
+              const DemangleLimits* limits = NULL);
+
+/// Same as Demangle(), but the symbol is given by a pointer and a length,
+/// and is not read beyond them, so that a symbol in a larger buffer, e.g. a
+/// string table mapped into memory or a line of text, is demangled in place
+/// without being copied out. The symbol need not be terminated by '\0', and
+/// ends at the first '\0' within the length if there is one.
+/// @param symbol The the mangled symbol.
+/// @param symbol_length Length of the symbol.
+/// @param buffer [out] The output buffer
+/// @param buffer_size Buffer size, including the space of '\0'.
+/// @param flags Bitwise or of DemangleFlags.
+/// @param limits The limits on the work, or NULL for the default limits.
+bool Demangle(const char* symbol,
+              size_t symbol_length,
+              char* buffer,
+              size_t buffer_size,
+              int flags = kDemangleNamesOnly,
+              const DemangleLimits* limits = NULL);
+
+/// Same as Demangle(), but tells the size of the buffer the demangled name
+/// needs, like snprintf(): if the buffer is too small, the rest of the name
+/// is parsed without being written, so that the size is known after one
+/// call, and the caller can tell if the name was cut, or retry once with a
+/// buffer of the size. Returns true only if the name fits, as Demangle().
+/// @param symbol The the mangled symbol as a C-string.
+/// @param buffer [out] The output buffer, which may be NULL if buffer_size
+///     is 0.
+/// @param buffer_size Buffer size, including the space of '\0'.
+/// @param required_size [out] The size of the buffer needed, including the
+///     space of '\0', or 0 if the symbol cannot be demangled. With
+///     kDemangleCompact, the name is made to fit, so it is at most
+///     buffer_size.
+/// @param flags Bitwise or of DemangleFlags.
+/// @param limits The limits on the work, or NULL for the default limits.
+bool Demangle(const char* symbol,
+              char* buffer,
+              size_t buffer_size,
+              size_t* required_size,
+              int flags = kDemangleNamesOnly,
+              const DemangleLimits* limits = NULL);
+
+/// Size of the buffer on the stack that Demangle() with a sink demangles the
+/// symbol into, including the space of '\0'.
+const size_t kDemangleSinkBufferSize = 4096;
+
+/// Same as Demangle(), but gives the demangled name to the sink in one chunk
+/// instead of writing it to a buffer of the caller. The name is demangled
+/// into a buffer of kDemangleSinkBufferSize bytes on the stack first, since
+/// the demangler refers back to what it has written, so it fails on a longer
+/// name unless kDemangleCompact is given. Nothing is given to the sink if it
+/// returns false.
+/// @param symbol The the mangled symbol as a C-string.
+/// @param sink The sink that receives the demangled name.
+/// @param sink_context The context passed to the sink.
+/// @param flags Bitwise or of DemangleFlags.
+/// @param limits The limits on the work, or NULL for the default limits.
+bool Demangle(const char* symbol,
+              OutputSink sink,
+              void* sink_context,
+              int flags = kDemangleNamesOnly,
+              const DemangleLimits* limits = NULL);
+
+/// The number of levels of template arguments printed by Demangle() with
+/// kDemangleCompact, unless the name is too long.
+const int kDemangleCompactTemplateDepth = 1;
+
+/// Same as Demangle() with kDemangleCompact, but with the given number of
+/// levels of template arguments and width.
+/// @param symbol The the mangled symbol as a C-string.
+/// @param buffer [out] The output buffer
+/// @param buffer_size Buffer size, including the space of '\0'.
+/// @param max_template_depth Number of levels of template arguments printed;
+///     those nested deeper are printed as "<...>". With 0, all of them are.
+/// @param max_width Maximum length of the name, excluding '\0', which is
+///     at most buffer_size - 1.
+/// @param limits The limits on the work of each pass, or NULL for the
+///     default limits. A name that is too long takes a pass per part
+///     dropped.
+bool DemangleCompact(const char* symbol,
+                     char* buffer,
+                     size_t buffer_size,
+                     int max_template_depth,
+                     size_t max_width,
+                     const DemangleLimits* limits = NULL);
+
+/// Kinds of the components of a demangled name.
+enum DemangleComponentKind {
+  /// A namespace enclosing the name, e.g. "std" or "(anonymous namespace)".
+  kComponentNamespace,
+  /// A class enclosing the name, if it is known to be a class, i.e. it has
+  /// template arguments, or the name is its constructor or destructor.
+  kComponentClass,
+  /// A namespace or a class enclosing the name: the mangled name does not
+  /// tell which.
+  kComponentScope,
+  /// The name of a variable, or of an entity that is not a function.
+  kComponentName,
+  /// The name of a function, e.g. "Bar".
+  kComponentFunction,
+  /// The name of an operator, e.g. "operator<<" or "operator int".
+  kComponentOperator,
+  /// The name of a constructor or a destructor, e.g. "Foo" or "~Foo".
+  kComponentCtorDtor,
+  /// The template arguments of the preceding component, e.g. "<int>", or
+  /// "<>" if they are not printed.
+  kComponentTemplateArgs,
+  /// The parameters of a function, e.g. "(char const*)", or "()" if they
+  /// are not printed.
+  kComponentParameters,
+  /// The return type of a function template, if it is printed.
+  kComponentReturnType,
+};
+
+/// A component of a demangled name, as a span of the output buffer. The
+/// spans do not include the separators "::" between them.
+struct DemangleComponent {
+  DemangleComponentKind kind;
+  /// Offset of the beginning of the span in the output buffer.
+  int begin;
+  /// Offset of the end of the span in the output buffer.
+  int end;
+};
+
+/// Same as Demangle(), but also records the components of the demangled
+/// name, e.g. for "Foo::Bar<>()" a class "Foo", a function "Bar", template
+/// arguments "<>" and parameters "()", so that a caller can format the name
+/// in other ways without demangling it again, e.g. print the bare function
+/// name or the enclosing class. The components are in the order they are
+/// parsed, which is the order in the output except for the return type.
+/// The components of a local entity, e.g. "f()::x", are those of the
+/// enclosing function followed by its own. Names in types, e.g. in the
+/// parameters or in the special name of a vtable, are not broken down into
+/// components.
+/// @param symbol The the mangled symbol as a C-string.
+/// @param buffer [out] The output buffer
+/// @param buffer_size Buffer size, including the space of '\0'.
+/// @param components [out] The components, in an array given by the caller.
+/// @param max_components Size of the array of the components.
+/// @param num_components [out] Number of the components, up to 255. If it
+///     exceeds max_components, only the first max_components are recorded,
+///     and their kinds may be inexact, as the kind of a component may depend
+///     on those after it.
+/// @param flags Bitwise or of DemangleFlags.
+/// @param limits The limits on the work, or NULL for the default limits.
+bool DemangleComponents(const char* symbol,
+                        char* buffer,
+                        size_t buffer_size,
+                        DemangleComponent* components,
+                        int max_components,
+                        int* num_components,
+                        int flags = kDemangleNamesOnly,
+                        const DemangleLimits* limits = NULL);
+
+/// Size of the scratch memory of DemangleWithScratch() that is enough for
+/// the default limits.
+const size_t kDemangleScratchSize = 64 * 1024;
+
+/// Same as Demangle(), but the demangler runs with the scratch memory as its
+/// stack, and uses less than 256 bytes of the stack of the caller however
+/// deeply nested the symbol is, so that it can run on a small alternate
+/// signal stack. The demangler fails without using memory beyond the
+/// scratch memory if it runs out of it.
+/// It supports x86-64 and AArch64 on Linux. Elsewhere, the demangler runs on
+/// the stack of the caller, using no more of it than the scratch memory.
+/// @param symbol The the mangled symbol as a C-string.
+/// @param buffer [out] The output buffer
+/// @param buffer_size Buffer size, including the space of '\0'.
+/// @param scratch The scratch memory, which is used by one call at a time.
+/// @param scratch_size Size of the scratch memory, e.g.
+///     kDemangleScratchSize.
+/// @param flags Bitwise or of DemangleFlags.
+/// @param limits The limits on the work, or NULL for the default limits.
+bool DemangleWithScratch(const char* symbol,
+                         char* buffer,
+                         size_t buffer_size,
+                         void* scratch,
+                         size_t scratch_size,
+                         int flags = kDemangleNamesOnly,
+                         const DemangleLimits* limits = NULL);
+
+/// Copies text from a file descriptor to another, replacing the mangled
+/// symbols in it with their demangled names, like c++filt does. A symbol is
+/// a word of the characters [A-Za-z0-9_.$] that begins with "_Z"; a symbol
+/// that cannot be demangled is copied as it is. The text is read and written
+/// in large blocks through fixed buffers, so it can be arbitrarily long.
+/// It is not async-signal-safe.
+/// @param in_fd The file descriptor to read the text from until its end.
+/// @param out_fd The file descriptor to write the text to.
+/// @param flags Bitwise or of DemangleFlags.
+/// @return False on read or write error, or if the buffers cannot be
+///     allocated.
+bool DemangleStream(int in_fd, int out_fd, int flags = kDemangleNamesOnly);
+
+/// Demangles many symbols, e.g. those of a whole symbol table, with multiple
+/// threads, and writes the names to the arena one after another, each ended
+/// by '\0', in no particular order. The i-th name is at arena + offsets[i].
+/// A symbol that cannot be demangled is copied as it is.
+/// It is not async-signal-safe.
+/// @param symbols The mangled symbols as C-strings.
+/// @param num_symbols Number of the symbols.
+/// @param arena [out] The output arena.
+/// @param arena_size Size of the arena.
+/// @param offsets [out] The offsets of the names in the arena, of
+///     num_symbols elements. They are valid only on success.
+/// @param arena_used [out] Number of bytes of the arena used on success, or
+///     needed if the arena is too small.
+/// @param num_threads Number of threads including the calling one, or 0 for
+///     the number of hardware threads.
+/// @param flags Bitwise or of DemangleFlags.
+/// @return False if the arena is too small.
+bool DemangleBulk(const char* const* symbols,
+                  size_t num_symbols,
+                  char* arena,
+                  size_t arena_size,
+                  size_t* offsets,
+                  size_t* arena_used,
+                  int num_threads = 0,
+                  int flags = kDemangleNamesOnly);
+
+/// Same as DemangleBulk() above, but the symbols are in a string table, e.g.
+/// the section .strtab of an ELF file mapped into memory, given by their
+/// offsets in it like the field st_name of ELF symbols. The names are not
+/// read beyond the string table.
+/// @param strtab The string table.
+/// @param strtab_size Size of the string table.
+/// @param name_offsets The offsets of the symbols in the string table. An
+///     offset beyond the string table stands for an empty name.
+/// @param num_symbols Number of the symbols.
+/// @param arena [out] The output arena.
+/// @param arena_size Size of the arena.
+/// @param offsets [out] The offsets of the names in the arena, of
+///     num_symbols elements. They are valid only on success.
+/// @param arena_used [out] Number of bytes of the arena used on success, or
+///     needed if the arena is too small.
+/// @param num_threads Number of threads including the calling one, or 0 for
+///     the number of hardware threads.
+/// @param flags Bitwise or of DemangleFlags.
+/// @return False if the arena is too small.
+bool DemangleBulk(const char* strtab,
+                  size_t strtab_size,
+                  const uint32_t* name_offsets,
+                  size_t num_symbols,
+                  char* arena,
+                  size_t arena_size,
+                  size_t* offsets,
+                  size_t* arena_used,
+                  int num_threads = 0,
+                  int flags = kDemangleNamesOnly);
 
 }  // namespace itanium
 
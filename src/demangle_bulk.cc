@@ -0,0 +1,303 @@
+// Copyright (c) 2020 Leedehai. All rights reserved.
+// Use of this source code is governed under the LICENSE.txt file.
+// -----
+// A driver that demangles a whole symbol table with multiple threads.
+
+#include <stdint.h>  // uint32_t, uint64_t
+#include <string.h>  // memchr(), memcpy(), strlen()
+
+#include <atomic>  // std::atomic<>
+#include <thread>  // std::thread
+#include <vector>  // std::vector<>
+
+#include "common.h"
+#include "sblz/sblz.h"
+
+namespace sblz {
+namespace itanium {
+
+// Number of symbols in a chunk, the unit of work that is taken or stolen by
+// a worker.
+static const size_t kChunkSize = 64;
+
+// Maximum size of a demangled name, including '\0'. A symbol whose demangled
+// name does not fit is copied as it is.
+static const size_t kMaxDemangledSize = 1 << 15;
+
+// Size of the staging buffer of a worker, where the names of a chunk are
+// collected before they are copied to the arena together.
+static const size_t kStagingSize = 1 << 16;
+
+// The symbols to demangle: either an array of C-strings, or names in a
+// string table given by their offsets.
+struct BulkInput {
+  const char* const* symbols;
+  const char* strtab;
+  size_t strtab_size;
+  const uint32_t* name_offsets;
+  size_t num_symbols;
+};
+
+// Finds the i-th symbol. A name in a string table does not extend beyond
+// the table even if it is not terminated by '\0'.
+static void GetSymbol(const BulkInput& input,
+                      size_t i,
+                      const char** symbol,
+                      size_t* length) {
+  if (input.symbols != NULL) {
+    *symbol = input.symbols[i];
+    *length = strlen(*symbol);
+    return;
+  }
+  const size_t offset = input.name_offsets[i];
+  if (offset >= input.strtab_size) {
+    *symbol = "";
+    *length = 0;
+    return;
+  }
+  *symbol = input.strtab + offset;
+  const void* nul = memchr(*symbol, '\0', input.strtab_size - offset);
+  *length = nul != NULL ? static_cast<const char*>(nul) - *symbol
+                        : input.strtab_size - offset;
+}
+
+// A range of chunks [begin, end) owned by a worker, with "begin" in the high
+// half and "end" in the low half, so that it is updated by one
+// compare-and-swap. The owner takes chunks from the front and thieves steal
+// the back half. No value recurs once it is replaced, since a chunk is in one
+// range at a time and is taken once, so there is no ABA problem.
+struct alignas(64) WorkRange {
+  std::atomic<uint64_t> range;
+};
+
+static uint64_t PackRange(uint32_t begin, uint32_t end) {
+  return static_cast<uint64_t>(begin) << 32 | end;
+}
+
+// Takes the first chunk from the range. Returns false if it is empty.
+static bool TakeChunk(WorkRange* work, uint32_t* chunk) {
+  uint64_t range = work->range.load(std::memory_order_relaxed);
+  while (true) {
+    const uint32_t begin = range >> 32, end = range & 0xffffffff;
+    if (begin >= end) {
+      return false;
+    }
+    if (work->range.compare_exchange_weak(range, PackRange(begin + 1, end),
+                                          std::memory_order_relaxed)) {
+      *chunk = begin;
+      return true;
+    }
+  }
+}
+
+// Steals the back half of the range of the victim, rounded up. Returns false
+// if it is empty.
+static bool StealChunks(WorkRange* victim, uint32_t* begin, uint32_t* end) {
+  uint64_t range = victim->range.load(std::memory_order_relaxed);
+  while (true) {
+    const uint32_t victim_begin = range >> 32, victim_end = range & 0xffffffff;
+    if (victim_begin >= victim_end) {
+      return false;
+    }
+    const uint32_t middle = victim_begin + (victim_end - victim_begin) / 2;
+    if (victim->range.compare_exchange_weak(
+            range, PackRange(victim_begin, middle),
+            std::memory_order_relaxed)) {
+      *begin = middle;
+      *end = victim_end;
+      return true;
+    }
+  }
+}
+
+// State shared by the workers.
+struct BulkContext {
+  BulkInput input;
+  int flags;
+  char* arena;
+  size_t arena_size;
+  size_t* offsets;
+  // Number of bytes reserved in the arena, which may exceed its size.
+  std::atomic<size_t> arena_used;
+  WorkRange* work;
+  int num_workers;
+};
+
+// Reserves space in the arena and copies the data there, followed by '\0'.
+// Returns the offset of the space, or -1 if the arena is full; the space is
+// counted in either case so that the total size needed is known at the end.
+static size_t CopyToArena(BulkContext* context,
+                          const char* data,
+                          size_t length) {
+  const size_t offset =
+      context->arena_used.fetch_add(length + 1, std::memory_order_relaxed);
+  if (offset > context->arena_size || context->arena_size - offset <= length) {
+    return static_cast<size_t>(-1);
+  }
+  memcpy(context->arena + offset, data, length);
+  context->arena[offset + length] = '\0';
+  return offset;
+}
+
+// Demangles the symbols of a chunk. The names are collected in the staging
+// buffer, with their offsets in it, and then copied to the arena together,
+// which moves the offsets by the same amount. A name too large for the
+// staging buffer is copied to the arena by itself.
+static void DemangleChunk(BulkContext* context,
+                          uint32_t chunk,
+                          char* staging,
+                          char* buffer) {
+  const size_t first = static_cast<size_t>(chunk) * kChunkSize;
+  size_t last = first + kChunkSize;
+  if (last > context->input.num_symbols) {
+    last = context->input.num_symbols;
+  }
+  size_t staged = 0;  // Number of bytes in the staging buffer.
+  size_t staged_first = first;  // The first symbol in the staging buffer.
+  for (size_t i = first; i < last; ++i) {
+    const char* symbol;
+    size_t length;
+    GetSymbol(context->input, i, &symbol, &length);
+    const char* name = symbol;
+    size_t size = length + 1;
+    if (Demangle(symbol, length, buffer, kMaxDemangledSize, context->flags)) {
+      name = buffer;
+      size = strlen(buffer) + 1;
+    }
+    if (kStagingSize - staged < size && staged > 0) {
+      const size_t base = CopyToArena(context, staging, staged - 1);
+      for (size_t j = staged_first; j < i; ++j) {
+        context->offsets[j] += base;
+      }
+      staged = 0;
+      staged_first = i;
+    }
+    if (size > kStagingSize) {
+      // Only the symbol itself can be so long.
+      context->offsets[i] = CopyToArena(context, name, size - 1);
+      staged_first = i + 1;
+      continue;
+    }
+    memcpy(staging + staged, name, size - 1);
+    staging[staged + size - 1] = '\0';
+    context->offsets[i] = staged;
+    staged += size;
+  }
+  if (staged > 0) {
+    const size_t base = CopyToArena(context, staging, staged - 1);
+    for (size_t j = staged_first; j < last; ++j) {
+      context->offsets[j] += base;
+    }
+  }
+}
+
+// Demangles the chunks of its own range, then those stolen from the other
+// workers, until there are none left.
+static void RunWorker(BulkContext* context, int id) {
+  char staging[kStagingSize];
+  char buffer[kMaxDemangledSize];
+  WorkRange* const own = &context->work[id];
+  while (true) {
+    uint32_t chunk;
+    while (TakeChunk(own, &chunk)) {
+      DemangleChunk(context, chunk, staging, buffer);
+    }
+    bool stolen = false;
+    for (int k = 1; k < context->num_workers && !stolen; ++k) {
+      WorkRange* const victim =
+          &context->work[(id + k) % context->num_workers];
+      uint32_t begin, end;
+      if (StealChunks(victim, &begin, &end)) {
+        // The range is empty, so no one steals from it until this store.
+        own->range.store(PackRange(begin, end), std::memory_order_relaxed);
+        stolen = true;
+      }
+    }
+    if (!stolen) {
+      return;
+    }
+  }
+}
+
+static bool RunBulk(const BulkInput& input,
+                    char* arena,
+                    size_t arena_size,
+                    size_t* offsets,
+                    size_t* arena_used,
+                    int num_threads,
+                    int flags) {
+  const size_t num_chunks = (input.num_symbols + kChunkSize - 1) / kChunkSize;
+  if (num_chunks > 0xffffffff) {
+    *arena_used = 0;
+    return false;
+  }
+  if (num_threads <= 0) {
+    num_threads = std::thread::hardware_concurrency();
+  }
+  if (static_cast<size_t>(num_threads) > num_chunks) {
+    num_threads = num_chunks;
+  }
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+
+  std::vector<WorkRange> work(num_threads);
+  for (int id = 0; id < num_threads; ++id) {
+    work[id].range.store(PackRange(num_chunks * id / num_threads,
+                                   num_chunks * (id + 1) / num_threads),
+                         std::memory_order_relaxed);
+  }
+  BulkContext context;
+  context.input = input;
+  context.flags = flags;
+  context.arena = arena;
+  context.arena_size = arena_size;
+  context.offsets = offsets;
+  context.arena_used.store(0, std::memory_order_relaxed);
+  context.work = work.data();
+  context.num_workers = num_threads;
+
+  // The calling thread is one of the workers.
+  std::vector<std::thread> threads;
+  for (int id = 1; id < num_threads; ++id) {
+    threads.emplace_back(RunWorker, &context, id);
+  }
+  RunWorker(&context, 0);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  *arena_used = context.arena_used.load(std::memory_order_relaxed);
+  return *arena_used <= arena_size;
+}
+
+EXPORT bool DemangleBulk(const char* const* symbols,
+                         size_t num_symbols,
+                         char* arena,
+                         size_t arena_size,
+                         size_t* offsets,
+                         size_t* arena_used,
+                         int num_threads,
+                         int flags) {
+  BulkInput input = {symbols, NULL, 0, NULL, num_symbols};
+  return RunBulk(input, arena, arena_size, offsets, arena_used, num_threads,
+                 flags);
+}
+
+EXPORT bool DemangleBulk(const char* strtab,
+                         size_t strtab_size,
+                         const uint32_t* name_offsets,
+                         size_t num_symbols,
+                         char* arena,
+                         size_t arena_size,
+                         size_t* offsets,
+                         size_t* arena_used,
+                         int num_threads,
+                         int flags) {
+  BulkInput input = {NULL, strtab, strtab_size, name_offsets, num_symbols};
+  return RunBulk(input, arena, arena_size, offsets, arena_used, num_threads,
+                 flags);
+}
+
+}  // namespace itanium
+}  // namespace sblz
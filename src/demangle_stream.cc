@@ -0,0 +1,268 @@
+// Copyright (c) 2020 Leedehai. All rights reserved.
+// Use of this source code is governed under the LICENSE.txt file.
+// -----
+// A filter that demangles the mangled symbols in a stream of text, like
+// c++filt does.
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "common.h"
+#include "sblz/sblz.h"
+
+namespace sblz {
+namespace itanium {
+
+// Sizes of the buffers of the input and the output, which are mapped once
+// per stream.
+static const size_t kInputBufferSize = 1 << 20;
+static const size_t kOutputBufferSize = 1 << 20;
+
+// Maximum size of a demangled name, including '\0'. A symbol whose demangled
+// name does not fit is copied as it is.
+static const size_t kMaxDemangledSize = 1 << 15;
+
+// Text not longer than this is copied to the output buffer; longer text is
+// written straight from the input buffer, after flushing the output buffer.
+static const size_t kMaxCopySize = 1 << 16;
+
+// Characters of symbols, like c++filt: a symbol is a maximal run of them.
+static bool IsSymbolChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == '.' || c == '$';
+}
+
+// Returns the first occurrence of "_Z" in [begin, end), or end if not found.
+static const char* FindUnderscoreZ(const char* begin, const char* end) {
+  const char* p = begin;
+#if defined(__SSE2__)
+  const __m128i underscore = _mm_set1_epi8('_');
+  const __m128i z = _mm_set1_epi8('Z');
+  // Compare 16 bytes with '_' and the 16 bytes after each with 'Z'.
+  while (end - p >= 17) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+    const int mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, underscore), _mm_cmpeq_epi8(b, z)));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t underscore = vdupq_n_u8('_');
+  const uint8x16_t z = vdupq_n_u8('Z');
+  while (end - p >= 17) {
+    const uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    const uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t*>(p + 1));
+    const uint8x16_t match =
+        vandq_u8(vceqq_u8(a, underscore), vceqq_u8(b, z));
+    if (vmaxvq_u8(match) != 0) {
+      // Narrow each byte of the match to 4 bits of a 64-bit mask.
+      const uint64_t mask = vget_lane_u64(
+          vreinterpret_u64_u8(
+              vshrn_n_u16(vreinterpretq_u16_u8(match), 4)),
+          0);
+      return p + __builtin_ctzll(mask) / 4;
+    }
+    p += 16;
+  }
+#endif
+  for (; end - p >= 2; ++p) {
+    if (p[0] == '_' && p[1] == 'Z') {
+      return p;
+    }
+  }
+  return end;
+}
+
+// Writes all the bytes, retrying on short writes and interruptions. Returns
+// false on error.
+static bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Reads into the buffer until it is full or the end of the input. Returns
+// the number of bytes read, or -1 on error.
+static ssize_t ReadFull(int fd, char* buffer, size_t size) {
+  size_t total = 0;
+  while (total < size) {
+    const ssize_t n = read(fd, buffer + total, size - total);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += n;
+  }
+  return total;
+}
+
+// The output of a stream, buffered so that it is written in large batches.
+class Output {
+ public:
+  Output(int fd, char* buffer) : fd_(fd), buffer_(buffer), size_(0) {}
+
+  // Writes text, copying it to the buffer if it is short.
+  bool Write(const char* data, size_t size) {
+    if (size > kMaxCopySize) {
+      return Flush() && WriteAll(fd_, data, size);
+    }
+    if (kOutputBufferSize - size_ < size && !Flush()) {
+      return false;
+    }
+    memcpy(buffer_ + size_, data, size);
+    size_ += size;
+    return true;
+  }
+
+  // Writes the demangled name of the symbol, or the symbol itself if it
+  // cannot be demangled.
+  bool WriteSymbol(const char* symbol, size_t length, int flags) {
+    if (kOutputBufferSize - size_ < kMaxDemangledSize && !Flush()) {
+      return false;
+    }
+    if (Demangle(symbol, length, buffer_ + size_, kMaxDemangledSize, flags)) {
+      size_ += strlen(buffer_ + size_);
+      return true;
+    }
+    return Write(symbol, length);
+  }
+
+  bool Flush() {
+    const bool ok = WriteAll(fd_, buffer_, size_);
+    size_ = 0;
+    return ok;
+  }
+
+ private:
+  const int fd_;
+  char* const buffer_;
+  size_t size_;  // Number of bytes in the buffer.
+
+  Output(const Output&);
+  void operator=(const Output&);
+};
+
+// Demangles the symbols in the input buffer, which has "size" bytes, and
+// writes the text to the output. A symbol at the end of the buffer may
+// continue in the input after it, so unless "at_end" is true, the text
+// from the beginning of the last run of symbol characters is not written,
+// and its offset is returned in *kept. "after_symbol_char" tells if the
+// first byte continues a run of symbol characters that has been written.
+// Returns false on write error.
+static bool FilterBuffer(const char* buffer,
+                         size_t size,
+                         bool at_end,
+                         bool after_symbol_char,
+                         int flags,
+                         Output* output,
+                         size_t* kept) {
+  const char* const end = buffer + size;
+  // The text before this has been written.
+  const char* written = buffer;
+  // The end of the text whose symbols have been demangled, which is where
+  // the last run of symbol characters begins if the input continues.
+  const char* limit = end;
+  if (!at_end) {
+    while (limit > buffer && IsSymbolChar(limit[-1])) {
+      --limit;
+    }
+  }
+  const char* p = buffer;
+  while (true) {
+    const char* symbol = FindUnderscoreZ(p, limit);
+    if (symbol == limit) {
+      break;
+    }
+    const bool starts_symbol =
+        symbol == buffer ? !after_symbol_char : !IsSymbolChar(symbol[-1]);
+    const char* symbol_end = symbol + 2;
+    while (symbol_end < limit && IsSymbolChar(*symbol_end)) {
+      ++symbol_end;
+    }
+    if (starts_symbol) {
+      if (!output->Write(written, symbol - written) ||
+          !output->WriteSymbol(symbol, symbol_end - symbol, flags)) {
+        return false;
+      }
+      written = symbol_end;
+    }
+    p = symbol_end;
+  }
+  *kept = limit - buffer;
+  return output->Write(written, limit - written);
+}
+
+EXPORT bool DemangleStream(int in_fd, int out_fd, int flags) {
+  const size_t mapping_size = kInputBufferSize + kOutputBufferSize;
+  void* const mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  char* const input = static_cast<char*>(mapping);
+  Output output(out_fd, input + kInputBufferSize);
+
+  bool ok = true;
+  size_t size = 0;  // Number of bytes in the input buffer.
+  bool after_symbol_char = false;
+  while (ok) {
+    const ssize_t n = ReadFull(in_fd, input + size, kInputBufferSize - size);
+    if (n < 0) {
+      ok = false;
+      break;
+    }
+    size += n;
+    const bool at_end = size < kInputBufferSize;
+    size_t kept = 0;
+    ok = FilterBuffer(input, size, at_end, after_symbol_char, flags, &output,
+                      &kept);
+    if (at_end) {
+      break;
+    }
+    if (kept == 0) {
+      // A run of symbol characters fills the buffer, which is too long to
+      // be a symbol worth demangling: write it as it is.
+      ok = ok && output.Write(input, size);
+      after_symbol_char = true;
+      size = 0;
+    } else {
+      // Move the run of symbol characters at the end to the beginning, to
+      // be continued by the next read.
+      memmove(input, input + kept, size - kept);
+      after_symbol_char = false;
+      size -= kept;
+    }
+  }
+  ok = output.Flush() && ok;
+  munmap(mapping, mapping_size);
+  return ok;
+}
+
+}  // namespace itanium
+}  // namespace sblz
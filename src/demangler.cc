@@ -19,30 +19,51 @@
 namespace sblz {
 namespace itanium {
 
+// Same as StrLen() below, but evaluated at compile time. NULL has length 0.
+constexpr int ConstexprStrLen(const char* str) {
+  int length = 0;
+  while (str != NULL && str[length] != '\0') {
+    ++length;
+  }
+  return length;
+}
+
 struct AbbrevPair {
+  constexpr AbbrevPair(const char* abbrev, const char* real_name, int arity = 0)
+      : abbrev(abbrev),
+        real_name(real_name),
+        arity(arity),
+        real_name_length(ConstexprStrLen(real_name)) {}
   const char* abbrev;
   const char* real_name;
+  int arity;  // Number of operands, for operators only.
+  int real_name_length;  // Computed at compile time, for printing.
 };
 
-// List of operators from Itanium C++ ABI.
-static const AbbrevPair kOperatorList[] = {
-    {"nw", "new"},    {"na", "new[]"}, {"dl", "delete"}, {"da", "delete[]"},
-    {"ps", "+"},      {"ng", "-"},     {"ad", "&"},      {"de", "*"},
-    {"co", "~"},      {"pl", "+"},     {"mi", "-"},      {"ml", "*"},
-    {"dv", "/"},      {"rm", "%"},     {"an", "&"},      {"or", "|"},
-    {"eo", "^"},      {"aS", "="},     {"pL", "+="},     {"mI", "-="},
-    {"mL", "*="},     {"dV", "/="},    {"rM", "%="},     {"aN", "&="},
-    {"oR", "|="},     {"eO", "^="},    {"ls", "<<"},     {"rs", ">>"},
-    {"lS", "<<="},    {"rS", ">>="},   {"eq", "=="},     {"ne", "!="},
-    {"lt", "<"},      {"gt", ">"},     {"le", "<="},     {"ge", ">="},
-    {"nt", "!"},      {"aa", "&&"},    {"oo", "||"},     {"pp", "++"},
-    {"mm", "--"},     {"cm", ","},     {"pm", "->*"},    {"pt", "->"},
-    {"cl", "()"},     {"ix", "[]"},    {"qu", "?"},      {"st", "sizeof"},
-    {"sz", "sizeof"}, {NULL, NULL},
+// List of operators from Itanium C++ ABI. The operators taking a type
+// instead of expressions, or a variable number of expressions, have arity 0.
+static constexpr AbbrevPair kOperatorList[] = {
+    {"nw", "new", 0},      {"na", "new[]", 0},    {"dl", "delete", 1},
+    {"da", "delete[]", 1}, {"ps", "+", 1},        {"ng", "-", 1},
+    {"ad", "&", 1},        {"de", "*", 1},        {"co", "~", 1},
+    {"pl", "+", 2},        {"mi", "-", 2},        {"ml", "*", 2},
+    {"dv", "/", 2},        {"rm", "%", 2},        {"an", "&", 2},
+    {"or", "|", 2},        {"eo", "^", 2},        {"aS", "=", 2},
+    {"pL", "+=", 2},       {"mI", "-=", 2},       {"mL", "*=", 2},
+    {"dV", "/=", 2},       {"rM", "%=", 2},       {"aN", "&=", 2},
+    {"oR", "|=", 2},       {"eO", "^=", 2},       {"ls", "<<", 2},
+    {"rs", ">>", 2},       {"lS", "<<=", 2},      {"rS", ">>=", 2},
+    {"eq", "==", 2},       {"ne", "!=", 2},       {"lt", "<", 2},
+    {"gt", ">", 2},        {"le", "<=", 2},       {"ge", ">=", 2},
+    {"nt", "!", 1},        {"aa", "&&", 2},       {"oo", "||", 2},
+    {"pp", "++", 1},       {"mm", "--", 1},       {"cm", ",", 2},
+    {"pm", "->*", 2},      {"pt", "->", 2},       {"cl", "()", 0},
+    {"ix", "[]", 2},       {"qu", "?", 3},        {"st", "sizeof", 1},
+    {"sz", "sizeof", 1},   {NULL, NULL, 0},
 };
 
 // List of builtin types from Itanium C++ ABI.
-static const AbbrevPair kBuiltinTypeList[] = {
+static constexpr AbbrevPair kBuiltinTypeList[] = {
     {"v", "void"},        {"w", "wchar_t"},
     {"b", "bool"},        {"c", "char"},
     {"a", "signed char"}, {"h", "unsigned char"},
@@ -53,10 +74,21 @@ static const AbbrevPair kBuiltinTypeList[] = {
     {"n", "__int128"},    {"o", "unsigned __int128"},
     {"f", "float"},       {"d", "double"},
     {"e", "long double"}, {"g", "__float128"},
-    {"z", "ellipsis"},    {NULL, NULL}};
+    {"z", "..."},         {NULL, NULL}};
+
+// List of type modifiers, which are printed after the type they modify.
+static const AbbrevPair kTypeModifierList[] = {
+    {"P", "*"},         {"R", "&"},           {"O", "&&"},
+    {"C", " _Complex"}, {"G", " _Imaginary"}, {NULL, NULL}};
+
+// List of the builtin types of integer literals that are printed with a
+// suffix instead of a cast, e.g. "5u" rather than "(unsigned int)5".
+static const AbbrevPair kIntegerLiteralSuffixList[] = {
+    {"i", ""},   {"j", "u"},   {"l", "l"}, {"m", "ul"},
+    {"x", "ll"}, {"y", "ull"}, {NULL, NULL}};
 
 // List of substitutions Itanium C++ ABI.
-static const AbbrevPair kSubstitutionList[] = {
+static constexpr AbbrevPair kSubstitutionList[] = {
     {"St", ""},
     {"Sa", "allocator"},
     {"Sb", "basic_string"},
@@ -70,33 +102,370 @@ static const AbbrevPair kSubstitutionList[] = {
     {"Sd", "iostream"},
     {NULL, NULL}};
 
-// State needed for demangling.
+// Direct-index tables of the codes of the lists above, made at compile time,
+// so that a code is looked up by an indexed load instead of a scan of its
+// list. The entry of a code is the index of its pair in the list plus 1, or
+// 0 if the code is not in the list.
+template <int kNumCodes>
+struct CodeIndex {
+  unsigned char entries[kNumCodes];
+};
+
+// Numbers of the codes of one lowercase letter, and of the codes of a
+// lowercase letter followed by a letter.
+static const int kNumOneLetterCodes = 26;
+static const int kNumTwoLetterCodes = 26 * 52;
+
+// Returns the key of a code of one lowercase letter, or -1 if it is not one.
+constexpr int OneLetterKey(char c) {
+  return c >= 'a' && c <= 'z' ? c - 'a' : -1;
+}
+
+// Returns the key of a code of a lowercase letter followed by a letter, or
+// -1 if it is not one.
+constexpr int TwoLetterKey(char c0, char c1) {
+  return OneLetterKey(c0) < 0 ? -1
+         : c1 >= 'A' && c1 <= 'Z' ? OneLetterKey(c0) * 52 + (c1 - 'A')
+         : c1 >= 'a' && c1 <= 'z' ? OneLetterKey(c0) * 52 + 26 + (c1 - 'a')
+                                  : -1;
+}
+
+// Makes the index of the list, whose codes are keyed from their character at
+// "offset". A code that is not of the right form fails the compilation.
+template <int kNumCodes>
+constexpr CodeIndex<kNumCodes> MakeCodeIndex(const AbbrevPair* list,
+                                             int offset) {
+  CodeIndex<kNumCodes> index = {};
+  for (int i = 0; list[i].abbrev != NULL; ++i) {
+    const char* const code = list[i].abbrev + offset;
+    const int key = kNumCodes == kNumTwoLetterCodes
+                        ? TwoLetterKey(code[0], code[1])
+                        : OneLetterKey(code[0]);
+    index.entries[key] = i + 1;
+  }
+  return index;
+}
+
+static constexpr CodeIndex<kNumTwoLetterCodes> kOperatorIndex =
+    MakeCodeIndex<kNumTwoLetterCodes>(kOperatorList, 0);
+static constexpr CodeIndex<kNumOneLetterCodes> kBuiltinTypeIndex =
+    MakeCodeIndex<kNumOneLetterCodes>(kBuiltinTypeList, 0);
+// Keyed on the letter after 'S'.
+static constexpr CodeIndex<kNumOneLetterCodes> kSubstitutionIndex =
+    MakeCodeIndex<kNumOneLetterCodes>(kSubstitutionList, 1);
+
+// Returns the pair of the code with the key in the list, or NULL if the key
+// is -1 or the code is not in the list.
+template <int kNumCodes>
+static const AbbrevPair* LookUpCode(const AbbrevPair* list,
+                                    const CodeIndex<kNumCodes>& index,
+                                    int key) {
+  const int entry = key >= 0 ? index.entries[key] : 0;
+  return entry > 0 ? &list[entry - 1] : NULL;
+}
+
+// Inline namespaces of the standard libraries, which are dropped in compact
+// mode, e.g. "std::__cxx11::string".
+static const char* const kStdInlineNamespaceList[] = {"__cxx11::", "__1::",
+                                                      NULL};
+
+// A std template whose last arguments have defaults, which are dropped in
+// compact mode when they are the defaults, e.g. "std::vector<int>" instead of
+// "std::vector<int, std::allocator<int> >". A default refers to an earlier
+// argument by "$" and its number, and is written without the space that
+// separates two '>'.
+struct StdTemplateDefaults {
+  const char* name;  // Without "std::", as the inline namespaces are dropped.
+  int num_required_args;  // Number of the arguments without defaults.
+  const char* default_args[3];  // Followed by NULL.
+};
+
+// The maximum number of template arguments of a template in
+// kStdTemplateDefaultsList.
+static const int kMaxStdTemplateArgs = 5;
+
+static const StdTemplateDefaults kStdTemplateDefaultsList[] = {
+    {"vector", 1, {"std::allocator<$0>", NULL}},
+    {"deque", 1, {"std::allocator<$0>", NULL}},
+    {"list", 1, {"std::allocator<$0>", NULL}},
+    {"forward_list", 1, {"std::allocator<$0>", NULL}},
+    {"set", 1, {"std::less<$0>", "std::allocator<$0>", NULL}},
+    {"multiset", 1, {"std::less<$0>", "std::allocator<$0>", NULL}},
+    {"map", 2, {"std::less<$0>", "std::allocator<std::pair<$0 const, $1>>"}},
+    {"multimap",
+     2,
+     {"std::less<$0>", "std::allocator<std::pair<$0 const, $1>>"}},
+    {"unordered_set",
+     1,
+     {"std::hash<$0>", "std::equal_to<$0>", "std::allocator<$0>"}},
+    {"unordered_multiset",
+     1,
+     {"std::hash<$0>", "std::equal_to<$0>", "std::allocator<$0>"}},
+    {"unordered_map",
+     2,
+     {"std::hash<$0>", "std::equal_to<$0>",
+      "std::allocator<std::pair<$0 const, $1>>"}},
+    {"unordered_multimap",
+     2,
+     {"std::hash<$0>", "std::equal_to<$0>",
+      "std::allocator<std::pair<$0 const, $1>>"}},
+    {"unique_ptr", 1, {"std::default_delete<$0>", NULL}},
+    {"basic_string", 1, {"std::char_traits<$0>", "std::allocator<$0>", NULL}},
+    {"basic_string_view", 1, {"std::char_traits<$0>", NULL}},
+    {"basic_istream", 1, {"std::char_traits<$0>", NULL}},
+    {"basic_ostream", 1, {"std::char_traits<$0>", NULL}},
+    {"basic_iostream", 1, {"std::char_traits<$0>", NULL}},
+    {"basic_streambuf", 1, {"std::char_traits<$0>", NULL}},
+    {"basic_stringstream",
+     1,
+     {"std::char_traits<$0>", "std::allocator<$0>", NULL}},
+    {"basic_istringstream",
+     1,
+     {"std::char_traits<$0>", "std::allocator<$0>", NULL}},
+    {"basic_ostringstream",
+     1,
+     {"std::char_traits<$0>", "std::allocator<$0>", NULL}},
+    {"basic_stringbuf",
+     1,
+     {"std::char_traits<$0>", "std::allocator<$0>", NULL}},
+    {"basic_ifstream", 1, {"std::char_traits<$0>", NULL}},
+    {"basic_ofstream", 1, {"std::char_traits<$0>", NULL}},
+    {"basic_fstream", 1, {"std::char_traits<$0>", NULL}},
+    {"basic_filebuf", 1, {"std::char_traits<$0>", NULL}},
+    {NULL, 0, {NULL}}};
+
+// Well-known std types, which are abbreviated in compact mode once their
+// default template arguments are dropped.
+static const AbbrevPair kStdTypeList[] = {
+    {"std::string", "std::basic_string<char>"},
+    {"std::wstring", "std::basic_string<wchar_t>"},
+    {"std::string_view", "std::basic_string_view<char>"},
+    {"std::istream", "std::basic_istream<char>"},
+    {"std::ostream", "std::basic_ostream<char>"},
+    {"std::iostream", "std::basic_iostream<char>"},
+    {"std::streambuf", "std::basic_streambuf<char>"},
+    {"std::istringstream", "std::basic_istringstream<char>"},
+    {"std::ostringstream", "std::basic_ostringstream<char>"},
+    {"std::stringstream", "std::basic_stringstream<char>"},
+    {"std::stringbuf", "std::basic_stringbuf<char>"},
+    {"std::ifstream", "std::basic_ifstream<char>"},
+    {"std::ofstream", "std::basic_ofstream<char>"},
+    {"std::fstream", "std::basic_fstream<char>"},
+    {"std::filebuf", "std::basic_filebuf<char>"},
+    {NULL, NULL}};
+
+// Manglings of well-known std types with template arguments, which are
+// printed by their short names in compact mode, even if the arguments are
+// nested too deep to be printed. Only those with no references to earlier
+// substitutions are listed, as such references depend on the rest of the
+// mangled name.
+static const AbbrevPair kStdTypeManglingList[] = {
+    {"NSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEEE", "std::string"},
+    {"NSt7__cxx1112basic_stringIwSt11char_traitsIwESaIwEEE", "std::wstring"},
+    {"NSt7__cxx1118basic_stringstreamIcSt11char_traitsIcESaIcEEE",
+     "std::stringstream"},
+    {"NSt7__cxx1119basic_istringstreamIcSt11char_traitsIcESaIcEEE",
+     "std::istringstream"},
+    {"NSt7__cxx1119basic_ostringstreamIcSt11char_traitsIcESaIcEEE",
+     "std::ostringstream"},
+    {"St17basic_string_viewIcSt11char_traitsIcEE", "std::string_view"},
+    {"St14basic_ifstreamIcSt11char_traitsIcEE", "std::ifstream"},
+    {"St14basic_ofstreamIcSt11char_traitsIcEE", "std::ofstream"},
+    {NULL, NULL}};
+
+// A substitution candidate, i.e. a component of the mangled name that can
+// be referred to by S_ or S <seq-id> _ later: its output is recorded as a
+// span of the output string, so that a reference is expanded by copying
+// the span instead of parsing anything again.
+struct Substitution {
+  int begin;  // Offset of the span in the output, or -1 if not output.
+  int end;  // Offset of the end of the span in the output.
+  int prev_name_offset;  // "prev_name" after the span, or -1 if outside.
+  int prev_name_length;  // "prev_name_length" after the span.
+  char last_char;  // Last character of the span, see CountOverflow().
+  int hole;  // "type_hole" in the span, as an offset from "begin", or -1.
+  // The mangled <type> of the component, or NULL if it is not a <type>, so
+  // that a type elided in compact mode can be parsed again where it is
+  // referred to. See MaybeParseElidedSubstitution().
+  const char* mangled_begin;
+  const char* mangled_end;
+};
+
+// Capacity of the substitution table. References to components beyond the
+// capacity are expanded as "?".
+static const int kMaxSubstitutions = 64;
+
+// A template argument that <template-param>s refer to, recorded as a span of
+// the output like Substitution.
+struct TemplateArg {
+  int begin;  // Offset of the span in the output, or -1 if not output.
+  int end;  // Offset of the end of the span in the output.
+  char last_char;  // Last character of the span, see CountOverflow().
+  int hole;  // "type_hole" in the span, as an offset from "begin", or -1.
+};
+
+// Capacity of the template argument table. Template parameters referring to
+// arguments beyond the capacity are printed as "?".
+static const int kMaxTemplateArgs = 16;
+
+// Capacity of the component list of DemangleComponents(), whatever the size
+// of the array given by the caller, as the number is kept in a byte.
+static const int kMaxComponents = 255;
+
+// The data of a call of Demangle() not restored on backtracking, on its
+// stack or in the scratch memory of DemangleWithScratch(): the tables of
+// substitutions and template arguments, the components of the name, and the
+// budget of parsing steps, nesting depth and stack, which is spent by
+// BudgetGuard.
+struct Context {
+  char* out_begin;  // Beginning of output string.
+  // Number of characters of the output that fit into the buffer with '\0',
+  // or -1 if there is no room even for '\0'.
+  int out_capacity;
+  Substitution substitutions[kMaxSubstitutions];
+  TemplateArg template_args[kMaxTemplateArgs];
+  DemangleComponent* components;  // Given by the caller, or NULL.
+  int max_components;  // Size of "components".
+  int type_nesting;  // Number of types being parsed, by NestingGuard.
+  // Number of <template-args> being parsed, by NestingGuard, and the
+  // greatest number reached.
+  int template_args_nesting;
+  int max_template_args_nesting;
+  // In compact mode, the number of levels of <template-args> printed, or -1
+  // for no limit, and whether function signatures are printed as "(...)".
+  int max_template_depth;
+  bool elide_signatures;
+  int steps;  // Number of parsing functions entered.
+  int depth;  // Number of parsing functions being run.
+  int max_steps;
+  int max_depth;
+  uintptr_t stack_limit;  // Lowest address of the stack to use, or 0.
+  const char* mangled_end;  // End of mangled name, which has no '\0'.
+  bool over_budget;  // True once the budget is exceeded.
+};
+
+// The stack that a parsing function may use beyond its BudgetGuard, for
+// itself and the functions it calls before the next BudgetGuard.
+static const uintptr_t kStackReserve = 2048;
+
+// CV-qualifiers and ref-qualifiers, as bits.
+static const int kConstQualifier = 1 << 0;
+static const int kVolatileQualifier = 1 << 1;
+static const int kRestrictQualifier = 1 << 2;
+static const int kLvalueRefQualifier = 1 << 3;
+static const int kRvalueRefQualifier = 1 << 4;
+
+// Number of the last characters output past the end of the buffer that are
+// kept, see CountOverflow().
+static const int kOverflowTailSize = 3;
+
+// State needed for demangling. It is copied at each point of backtracking,
+// so it is kept within 64 bytes.
+// The output is counted in full, even past the end of the buffer, so that
+// the size it needs is known: the characters at offsets from the capacity of
+// the buffer on are counted without being written.
 struct State {
   const char* mangled_cur;  // Cursor of mangled name.
-  char* out_cur;  // Cursor of output string.
-  const char* out_begin;  // Beginning of output string.
-  const char* out_end;  // End of output string.
-  const char* prev_name;  // For constructors/destructors.
+  int out_cur;  // Cursor of output string, as an offset.
+  int prev_name;  // For constructors/destructors: offset, or -1.
   int prev_name_length;  // For constructors/destructors.
+  // Where the declarator goes in the <type> just parsed, if it is not at
+  // its end: the offset inside the parentheses of a pointer to function or
+  // array, e.g. after "*" in "int (*)()", or -1. See
+  // ParsePointerToFunctionOrArrayType().
+  int type_hole;
+  // The last characters past the end of the buffer, the last one first, or
+  // '\0' if not known.
+  char overflow_tail[kOverflowTailSize];
   short nest_level;  // For nested names.
   bool append;  // Append flag.
-  bool overflowed;  // True if output gets overflowed.
+  // The context has the substitution table, and the template argument
+  // table, i.e. the arguments of the last <template-args> of the name of
+  // the encoding. Only the numbers of entries are in the state, so that a
+  // state restored on backtracking drops the entries added since it was
+  // saved. The numbers stop at one past the capacities.
+  Context* context;
+  unsigned char num_substitutions;
+  unsigned char num_template_args;
+  unsigned char flags;  // Flags of Demangle().
+  // True in <template-args> and function signatures, whose <template-args>
+  // are not those of the name of the encoding.
+  bool in_args_or_signature;
+  bool name_has_template_args;  // If the last name ends with <template-args>.
+  bool name_is_ctor_or_conversion;  // If the last name has no return type.
+  unsigned char name_qualifiers;  // Qualifiers of the last <nested-name>.
+  // Number of the components in the context, which stops at
+  // kMaxComponents.
+  unsigned char num_components;
 };
 
 static void InitState(State* state,
                       const char* mangled,
                       char* out,
-                      int out_size) {
+                      int out_size,
+                      Context* context,
+                      int flags) {
   state->mangled_cur = mangled;
-  state->out_cur = out;
-  state->out_begin = out;
-  state->out_end = out + out_size;
-  state->prev_name = NULL;
+  state->out_cur = 0;
+  state->prev_name = -1;
   state->prev_name_length = -1;
+  state->type_hole = -1;
+  state->overflow_tail[0] = '\0';
+  state->overflow_tail[1] = '\0';
+  state->overflow_tail[2] = '\0';
   state->nest_level = -1;
   state->append = true;
-  state->overflowed = false;
-}
+  state->context = context;
+  context->out_begin = out;
+  context->out_capacity = out_size - 1;
+  state->num_substitutions = 0;
+  state->num_template_args = 0;
+  state->flags = flags;
+  state->in_args_or_signature = false;
+  state->name_has_template_args = false;
+  state->name_is_ctor_or_conversion = false;
+  state->name_qualifiers = 0;
+  state->num_components = 0;
+}
+
+// Spends a step of the budget of the call, and a level of nesting depth
+// until it goes out of scope, and checks that the stack is not too close to
+// its limit. Each recursive parsing function starts with one, and fails if
+// the budget is exceeded, so that the running time and the stack usage are
+// bounded on any input. The steps are not given back on
+// backtracking, and once the budget is exceeded, the call fails.
+struct BudgetGuard {
+  Context* const context_;
+  explicit BudgetGuard(State* state) : context_(state->context) {
+    ++context_->steps;
+    ++context_->depth;
+    if (context_->steps > context_->max_steps ||
+        context_->depth > context_->max_depth ||
+        reinterpret_cast<uintptr_t>(this) <
+            context_->stack_limit + kStackReserve) {
+      context_->over_budget = true;
+    }
+  }
+  ~BudgetGuard() { --context_->depth; }
+  bool IsOverBudget() const { return context_->over_budget; }
+
+ private:
+  explicit BudgetGuard(const BudgetGuard&);
+  void operator=(const BudgetGuard&);
+};
+
+// Counts a construct being parsed until it goes out of scope: a <type>, as
+// the names in it are not components of the name of the symbol, or
+// <template-args>, which are elided beyond a depth in compact mode.
+struct NestingGuard {
+  int* const count_;
+  explicit NestingGuard(int* count) : count_(count) { ++*count_; }
+  ~NestingGuard() { --*count_; }
+
+ private:
+  explicit NestingGuard(const NestingGuard&);
+  void operator=(const NestingGuard&);
+};
 
 // We don't use strlen() in libc since it's not guaranteed to be async
 // signal safe.
@@ -109,20 +478,42 @@ static size_t StrLen(const char* str) {
   return len;
 }
 
-// Returns true if "str" has at least "n" characters remaining.
-static bool AtLeastNumCharsRemaining(const char* str, int n) {
-  for (int i = 0; i < n; ++i) {
-    if (str[i] == '\0') {
-      return false;
-    }
+// Same as StrLen(), but scans no more than "max_length" characters.
+static size_t StrNLen(const char* str, size_t max_length) {
+  size_t len = 0;
+  while (len < max_length && str[len] != '\0') {
+    ++len;
   }
-  return true;
+  return len;
 }
 
-// Returns true if "str" has "prefix" as a prefix.
-static bool StrPrefix(const char* str, const char* prefix) {
+// Returns the number of characters remaining after "mangled_cur".
+static size_t NumCharsRemaining(const State* state) {
+  return state->context->mangled_end - state->mangled_cur;
+}
+
+// Returns true if there are at least "n" characters remaining.
+static bool AtLeastNumCharsRemaining(const State* state, int n) {
+  return n <= 0 || NumCharsRemaining(state) >= (size_t)n;
+}
+
+// Returns the "i"-th character of "str" that has "length" characters, or
+// '\0' if it is beyond the end. "str" is not read beyond its end, which is
+// not necessarily marked by '\0'.
+static char CharAt(const char* str, size_t length, size_t i) {
+  return i < length ? str[i] : '\0';
+}
+
+// Returns the "i"-th character after "mangled_cur", or '\0' if it is beyond
+// the end of the mangled name.
+static char Peek(const State* state, size_t i) {
+  return CharAt(state->mangled_cur, NumCharsRemaining(state), i);
+}
+
+// Returns true if the rest of the mangled name has "prefix" as a prefix.
+static bool HasPrefix(const State* state, const char* prefix) {
   size_t i = 0;
-  while (str[i] != '\0' && prefix[i] != '\0' && str[i] == prefix[i]) {
+  while (prefix[i] != '\0' && Peek(state, i) == prefix[i]) {
     ++i;
   }
   return prefix[i] == '\0';  // Consumed everything in "prefix".
@@ -132,7 +523,7 @@ static bool StrPrefix(const char* str, const char* prefix) {
 // at "mangled_cur" position.  It is assumed that "one_char_token" does
 // not contain '\0'.
 static bool ParseOneCharToken(State* state, const char one_char_token) {
-  if (state->mangled_cur[0] == one_char_token) {
+  if (Peek(state, 0) == one_char_token) {
     ++state->mangled_cur;
     return true;
   }
@@ -143,8 +534,8 @@ static bool ParseOneCharToken(State* state, const char one_char_token) {
 // at "mangled_cur" position.  It is assumed that "two_char_token" does
 // not contain '\0'.
 static bool ParseTwoCharToken(State* state, const char* two_char_token) {
-  if (state->mangled_cur[0] == two_char_token[0] &&
-      state->mangled_cur[1] == two_char_token[1]) {
+  if (Peek(state, 0) == two_char_token[0] &&
+      Peek(state, 1) == two_char_token[1]) {
     state->mangled_cur += 2;
     return true;
   }
@@ -156,7 +547,7 @@ static bool ParseTwoCharToken(State* state, const char* two_char_token) {
 static bool ParseCharClass(State* state, const char* char_class) {
   const char* p = char_class;
   for (; *p != '\0'; ++p) {
-    if (state->mangled_cur[0] == *p) {
+    if (Peek(state, 0) == *p) {
       ++state->mangled_cur;
       return true;
     }
@@ -190,25 +581,86 @@ static bool ZeroOrMore(ParseFunc parse_func, State* state) {
   return true;
 }
 
-// Append "str" at "out_cur".  If there is an overflow, "overflowed"
-// is set to true for later use.  The output string is ensured to
-// always terminate with '\0' as long as there is no overflow.
-static void Append(State* state, const char* const str, const int length) {
+// The longest output counted. Substitutions may double the output each, so
+// a crafted mangled name may need more than any buffer, and is rejected.
+static const int kMaxOutputLength = 1 << 30;
+
+// Count "length" characters output past the end of the buffer, which are not
+// written, and keep the last of them in "overflow_tail": the output after
+// them depends on its last character, for '<' and '>', and on the one
+// before "::" if the separator is canceled. The text is "str", or it is not
+// known if "str" is NULL, except its last character "last_char".
+static void CountOverflow(State* state,
+                          const char* const str,
+                          const int length,
+                          char last_char) {
+  if (length > kMaxOutputLength - state->out_cur) {
+    state->context->over_budget = true;
+    return;
+  }
+  state->out_cur += length;
   int i;
-  for (i = 0; i < length; ++i) {
-    if (state->out_cur + 1 < state->out_end) {  // +1 for '\0'
-      *state->out_cur = str[i];
-      ++state->out_cur;
-    } else {
-      state->overflowed = true;
-      break;
+  for (i = length < kOverflowTailSize ? 0 : length - kOverflowTailSize;
+       i < length; ++i) {
+    int j;
+    for (j = kOverflowTailSize - 1; j > 0; --j) {
+      state->overflow_tail[j] = state->overflow_tail[j - 1];
     }
+    state->overflow_tail[0] =
+        str != NULL ? str[i] : i + 1 == length ? last_char : '\0';
+  }
+}
+
+// Append "str" at "out_cur".  What does not fit into the buffer is
+// counted by CountOverflow() instead.  The output string is ensured to
+// always terminate with '\0' as long as there is no overflow.
+static void Append(State* state, const char* const str, const int length) {
+  char* const out = state->context->out_begin;
+  const int capacity = state->context->out_capacity;
+  int offset = state->out_cur;
+  int i = 0;
+  for (; i < length && offset < capacity; ++i) {
+    out[offset] = str[i];
+    ++offset;
+  }
+  if (i > 0) {
+    out[offset] = '\0';  // Terminate it with '\0'
   }
-  if (!state->overflowed) {
-    *state->out_cur = '\0';  // Terminate it with '\0'
+  state->out_cur = offset;
+  if (i < length) {
+    CountOverflow(state, str + i, length - i, str[length - 1]);
   }
 }
 
+// Returns the offset of "out_cur" in the output, i.e. the length of the
+// output so far, including the characters past the end of the buffer.
+static int OutputOffset(const State* state) {
+  return state->out_cur;
+}
+
+// Returns true if the output up to offset "end", which is not beyond
+// "out_cur", is in the buffer.
+static bool IsWritten(const State* state, int end) {
+  return end <= state->context->out_capacity;
+}
+
+// Returns the character at offset "offset" of the output, or '\0' if it is
+// not in the buffer.
+static char OutputCharAt(const State* state, int offset) {
+  return offset >= 0 && offset < state->out_cur &&
+                 IsWritten(state, offset + 1)
+             ? state->context->out_begin[offset]
+             : '\0';
+}
+
+// Returns the last character of the output, or '\0' if it is empty or not
+// known.
+static char LastOutputChar(const State* state) {
+  return IsWritten(state, state->out_cur)
+             ? OutputCharAt(state, state->out_cur - 1)
+             : state->overflow_tail[0];
+}
+
 // We don't use equivalents in libc to avoid locale issues.
 static bool IsLower(char c) {
   return c >= 'a' && c <= 'z';
@@ -225,23 +677,25 @@ static bool IsDigit(char c) {
 // Returns true if "str" is a function clone suffix.  These suffixes are used
 // by GCC 4.5.x and later versions to indicate functions which have been
 // cloned during optimization.  We treat any sequence (.<alpha>+.<digit>+)+ as
-// a function clone suffix.
-static bool IsFunctionCloneSuffix(const char* str) {
+// a function clone suffix. "str" has "length" characters.
+static bool IsFunctionCloneSuffix(const char* str, size_t length) {
   size_t i = 0;
-  while (str[i] != '\0') {
+  while (i < length) {
     // Consume a single .<alpha>+.<digit>+ sequence.
-    if (str[i] != '.' || !IsAlpha(str[i + 1])) {
+    if (CharAt(str, length, i) != '.' ||
+        !IsAlpha(CharAt(str, length, i + 1))) {
       return false;
     }
     i += 2;
-    while (IsAlpha(str[i])) {
+    while (IsAlpha(CharAt(str, length, i))) {
       ++i;
     }
-    if (str[i] != '.' || !IsDigit(str[i + 1])) {
+    if (CharAt(str, length, i) != '.' ||
+        !IsDigit(CharAt(str, length, i + 1))) {
       return false;
     }
     i += 2;
-    while (IsDigit(str[i])) {
+    while (IsDigit(CharAt(str, length, i))) {
       ++i;
     }
   }
@@ -255,14 +709,13 @@ static void MaybeAppendWithLength(State* state,
                                   const int length) {
   if (state->append && length > 0) {
     // Append a space if the output buffer ends with '<' and "str"
-    // starts with '<' to avoid <<<.
-    if (str[0] == '<' && state->out_begin < state->out_cur &&
-        state->out_cur[-1] == '<') {
+    // starts with '<' to avoid <<<, and likewise for '>'.
+    if ((str[0] == '<' || str[0] == '>') && LastOutputChar(state) == str[0]) {
       Append(state, " ", 1);
     }
     // Remember the last identifier name for ctors/dtors.
     if (IsAlpha(str[0]) || str[0] == '_') {
-      state->prev_name = state->out_cur;
+      state->prev_name = OutputOffset(state);
       state->prev_name_length = length;
     }
     Append(state, str, length);
@@ -318,10 +771,410 @@ static void MaybeAppendSeparator(State* state) {
 
 // Cancel the last separator if necessary.
 static void MaybeCancelLastSeparator(State* state) {
-  if (state->nest_level >= 1 && state->append &&
-      state->out_begin <= state->out_cur - 2) {
+  if (state->nest_level >= 1 && state->append && state->out_cur >= 2) {
     state->out_cur -= 2;
-    *state->out_cur = '\0';
+    if (IsWritten(state, state->out_cur)) {
+      state->context->out_begin[state->out_cur] = '\0';
+    } else {
+      // The character before the separator is the last one again.
+      state->overflow_tail[0] = state->overflow_tail[2];
+      state->overflow_tail[1] = '\0';
+      state->overflow_tail[2] = '\0';
+    }
+  }
+}
+
+// Append the last identifier name again, for ctors/dtors. If it is not in
+// the buffer, it is only counted, as its text is not known.
+static void MaybeAppendPrevName(State* state) {
+  const int prev_name = state->prev_name;
+  const int length = state->prev_name_length;
+  if (prev_name >= 0 && IsWritten(state, prev_name + length)) {
+    MaybeAppendWithLength(state, state->context->out_begin + prev_name,
+                          length);
+  } else if (state->append && length > 0) {
+    state->prev_name = OutputOffset(state);
+    CountOverflow(state, NULL, length, '\0');
+  }
+}
+
+// Add the component which was output from offset "begin" up to "out_cur" to
+// the substitution table. If nothing is being output, e.g. in template
+// arguments, the component is still numbered, but is expanded as "?".
+static void AddSubstitution(State* state, int begin) {
+  if (state->num_substitutions < kMaxSubstitutions) {
+    Substitution* subst =
+        &state->context->substitutions[state->num_substitutions];
+    const int end = OutputOffset(state);
+    subst->begin = state->append ? begin : -1;
+    subst->end = end;
+    subst->last_char = LastOutputChar(state);
+    subst->prev_name_offset = -1;
+    subst->prev_name_length = state->prev_name_length;
+    if (state->prev_name >= begin && state->prev_name < end) {
+      subst->prev_name_offset = state->prev_name;
+    }
+    subst->hole = -1;
+    subst->mangled_begin = NULL;
+    subst->mangled_end = NULL;
+  }
+  if (state->num_substitutions <= kMaxSubstitutions) {
+    ++state->num_substitutions;
+  }
+}
+
+// Returns "type_hole" as an offset from "begin", or -1 if it is not in the
+// output from "begin" on.
+static int GetTypeHole(const State* state, int begin) {
+  return begin >= 0 && state->type_hole >= begin ? state->type_hole - begin
+                                                 : -1;
+}
+
+// Same as AddSubstitution(), for a <type> parsed from "mangled_begin" up to
+// "mangled_cur".
+static void AddTypeSubstitution(State* state,
+                                int begin,
+                                const char* mangled_begin) {
+  AddSubstitution(state, begin);
+  if (state->num_substitutions <= kMaxSubstitutions) {
+    Substitution* subst =
+        &state->context->substitutions[state->num_substitutions - 1];
+    subst->hole = GetTypeHole(state, begin);
+    subst->mangled_begin = mangled_begin;
+    subst->mangled_end = state->mangled_cur;
+  }
+}
+
+// Same as AddSubstitution(), but only if the component is not the last one
+// of the nested name, i.e. it is a <prefix>.
+static void MaybeAddPrefixSubstitution(State* state, int begin) {
+  if (Peek(state, 0) != 'E') {
+    AddSubstitution(state, begin);
+  }
+}
+
+// Returns true in compact mode, i.e. if the depth of <template-args> is
+// limited.
+static bool IsCompact(const State* state) {
+  return state->context->max_template_depth >= 0;
+}
+
+// Returns the text printed for a component that was not output: "..." if it
+// was elided in compact mode, or "?".
+static const char* UnknownText(const State* state) {
+  return IsCompact(state) ? "..." : "?";
+}
+
+// Append a copy of the output from offset "begin" up to "end", whose last
+// character is "last_char". If the span is not in the buffer, it is only
+// counted: the rest of the output depends on its last character alone, as
+// the span is a name, a type or a template argument, which never starts
+// with '<' or '>'. Unlike other text, the copy is not the last identifier
+// name, i.e. "prev_name" stays.
+static void MaybeAppendSpan(State* state, int begin, int end, char last_char) {
+  if (!state->append || begin >= end) {
+    return;
+  }
+  if (!IsWritten(state, end)) {
+    CountOverflow(state, NULL, end - begin, last_char);
+    return;
+  }
+  const int prev_name = state->prev_name;
+  const int prev_name_length = state->prev_name_length;
+  // The span is behind "out_cur", so copying it forward is safe.
+  MaybeAppendWithLength(state, state->context->out_begin + begin,
+                        end - begin);
+  state->prev_name = prev_name;
+  state->prev_name_length = prev_name_length;
+}
+
+// Append the substitution numbered "index", or "?" if it is not known.
+static void MaybeAppendSubstitution(State* state, int index) {
+  state->type_hole = -1;
+  if (index < 0 || index >= state->num_substitutions ||
+      index >= kMaxSubstitutions ||
+      state->context->substitutions[index].begin < 0) {
+    MaybeAppend(state, UnknownText(state));
+    return;
+  }
+  if (!state->append) {
+    return;
+  }
+  const Substitution& subst = state->context->substitutions[index];
+  if (subst.hole >= 0) {
+    state->type_hole = OutputOffset(state) + subst.hole;
+  }
+  MaybeAppendSpan(state, subst.begin, subst.end, subst.last_char);
+  // Point "prev_name" to the copy of the last identifier in the span, if
+  // any, for ctors/dtors.
+  if (subst.prev_name_offset >= 0) {
+    state->prev_name =
+        OutputOffset(state) - (subst.end - subst.prev_name_offset);
+    state->prev_name_length = subst.prev_name_length;
+  }
+}
+
+// Returns true if the types are printed, i.e. kDemangleParameterTypes or
+// kDemangleCompact.
+static bool ShouldPrintTypes(const State* state) {
+  return (state->flags & (kDemangleParameterTypes | kDemangleCompact)) != 0;
+}
+
+
+// Same as MaybeAppend(), but only if the types are printed.
+static bool MaybeAppendTypeText(State* state, const char* const str) {
+  if (ShouldPrintTypes(state)) {
+    MaybeAppend(state, str);
+  }
+  return true;
+}
+
+// Append the qualifiers, as bits, if the types are printed.
+static void MaybeAppendQualifiers(State* state, int qualifiers) {
+  if (qualifiers & kConstQualifier) {
+    MaybeAppendTypeText(state, " const");
+  }
+  if (qualifiers & kVolatileQualifier) {
+    MaybeAppendTypeText(state, " volatile");
+  }
+  if (qualifiers & kRestrictQualifier) {
+    MaybeAppendTypeText(state, " restrict");
+  }
+  if (qualifiers & kLvalueRefQualifier) {
+    MaybeAppendTypeText(state, " &");
+  }
+  if (qualifiers & kRvalueRefQualifier) {
+    MaybeAppendTypeText(state, " &&");
+  }
+}
+
+// Add the template argument which was output from offset "begin" up to
+// "out_cur" to the template argument table.
+static void AddTemplateArg(State* state, int begin) {
+  if (state->num_template_args < kMaxTemplateArgs) {
+    TemplateArg* arg =
+        &state->context->template_args[state->num_template_args];
+    arg->begin = state->append ? begin : -1;
+    arg->end = OutputOffset(state);
+    arg->last_char = LastOutputChar(state);
+    arg->hole = GetTypeHole(state, begin);
+  }
+  if (state->num_template_args <= kMaxTemplateArgs) {
+    ++state->num_template_args;
+  }
+}
+
+// Append the template argument numbered "index", or "?" if it is not known.
+static void MaybeAppendTemplateArg(State* state, int index) {
+  state->type_hole = -1;
+  if (!ShouldPrintTypes(state) || index < 0 ||
+      index >= state->num_template_args ||
+      index >= kMaxTemplateArgs ||
+      state->context->template_args[index].begin < 0) {
+    MaybeAppend(state, UnknownText(state));
+    return;
+  }
+  const TemplateArg& arg = state->context->template_args[index];
+  if (arg.hole >= 0) {
+    state->type_hole = OutputOffset(state) + arg.hole;
+  }
+  MaybeAppendSpan(state, arg.begin, arg.end, arg.last_char);
+}
+
+// Add the component of the given kind which was output from offset "begin"
+// up to offset "end" to the component list, if it is a component of the name
+// of the symbol, i.e. not in a type, <template-args> or a function signature.
+static void MaybeAddComponentSpan(State* state,
+                                  DemangleComponentKind kind,
+                                  int begin,
+                                  int end) {
+  if (state->context->components == NULL || !state->append ||
+      !IsWritten(state, state->out_cur) || state->in_args_or_signature ||
+      state->context->type_nesting > 0 ||
+      state->num_components >= kMaxComponents) {
+    return;
+  }
+  if (state->num_components < state->context->max_components) {
+    DemangleComponent* component =
+        &state->context->components[state->num_components];
+    component->kind = kind;
+    component->begin = begin;
+    component->end = end;
+  }
+  ++state->num_components;
+}
+
+// Same as MaybeAddComponentSpan(), up to "out_cur".
+// Returns true so that it can be placed in "if" conditions.
+static bool MaybeAddComponent(State* state,
+                              DemangleComponentKind kind,
+                              int begin) {
+  MaybeAddComponentSpan(state, kind, begin, OutputOffset(state));
+  return true;
+}
+
+// Returns the component numbered "index", or NULL if it is not recorded.
+static DemangleComponent* GetComponent(State* state, int index) {
+  if (index < 0 || index >= state->num_components ||
+      index >= state->context->max_components) {
+    return NULL;
+  }
+  return &state->context->components[index];
+}
+
+// Returns the index of the last component from index "first" on that is
+// not <template-args>, i.e. the last name, or -1 if not found.
+static int FindLastNameComponent(State* state, int first) {
+  int i;
+  for (i = state->num_components - 1; i >= first; --i) {
+    const DemangleComponent* component = GetComponent(state, i);
+    if (component != NULL && component->kind != kComponentTemplateArgs) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Classify the components of a <nested-name> from index "first" on: the
+// names but the last are the enclosing scopes, which are known to be
+// classes if they have template arguments or the last name is a ctor/dtor.
+static void ClassifyNestedComponents(State* state, int first) {
+  const int last = FindLastNameComponent(state, first);
+  if (last < 0) {
+    return;
+  }
+  DemangleComponent* const name = GetComponent(state, last);
+  int i;
+  for (i = first; i < last; ++i) {
+    DemangleComponent* scope = GetComponent(state, i);
+    if (scope->kind == kComponentName) {
+      scope->kind = OutputCharAt(state, scope->begin) == '('
+                        ? kComponentNamespace  // "(anonymous namespace)"
+                        : kComponentScope;
+    }
+    const DemangleComponent* next = GetComponent(state, i + 1);
+    if (scope->kind == kComponentScope &&
+        (next->kind == kComponentTemplateArgs ||
+         (i + 1 == last && name->kind == kComponentCtorDtor))) {
+      scope->kind = kComponentClass;
+    }
+  }
+  // A <substitution> or a <template-param> as the last name.
+  if (name->kind == kComponentScope) {
+    name->kind = kComponentName;
+  }
+}
+
+// Reverse the characters from "first" up to "last".
+static void Reverse(char* first, char* last) {
+  while (first < last) {
+    --last;
+    const char c = *first;
+    *first = *last;
+    *last = c;
+    ++first;
+  }
+}
+
+// Returns how much RotateOutput() moves the output at offset "offset".
+static int GetRotationShift(int offset, int begin, int middle, int end) {
+  if (offset >= middle && offset < end) {
+    return begin - middle;
+  }
+  if (offset >= begin && offset < middle) {
+    return end - middle;
+  }
+  return 0;
+}
+
+// Swap the output from offset "begin" up to "middle" with the output from
+// "middle" up to "out_cur", in place, e.g. to print a return type, which is
+// parsed after the name, before the name. The substitutions and template
+// arguments in there are moved along. If the output is not all in the
+// buffer, it is not rotated, as only its length matters then, and its last
+// character, which becomes the one before "middle", is not known; it is
+// never '<' or '>' unless a function signature follows.
+// Returns true so that it can be placed in "if" conditions.
+static bool RotateOutput(State* state, int begin, int middle) {
+  const int end = OutputOffset(state);
+  if (!state->append || begin == middle || middle == end) {
+    return true;
+  }
+  if (!IsWritten(state, end)) {
+    state->overflow_tail[0] = '\0';
+    return true;
+  }
+  char* const out = state->context->out_begin;
+  Reverse(out + begin, out + middle);
+  Reverse(out + middle, out + end);
+  Reverse(out + begin, out + end);
+  // A span moves along with its beginning; spans never straddle "middle".
+  int i;
+  for (i = 0; i < state->num_substitutions && i < kMaxSubstitutions; ++i) {
+    Substitution* subst = &state->context->substitutions[i];
+    if (subst->begin >= 0) {
+      const int shift = GetRotationShift(subst->begin, begin, middle, end);
+      subst->begin += shift;
+      subst->end += shift;
+      if (subst->prev_name_offset >= 0) {
+        subst->prev_name_offset += shift;
+      }
+    }
+  }
+  for (i = 0; i < state->num_template_args && i < kMaxTemplateArgs; ++i) {
+    TemplateArg* arg = &state->context->template_args[i];
+    if (arg->begin >= 0) {
+      const int shift = GetRotationShift(arg->begin, begin, middle, end);
+      arg->begin += shift;
+      arg->end += shift;
+    }
+  }
+  for (i = 0; i < state->num_components; ++i) {
+    DemangleComponent* component = GetComponent(state, i);
+    if (component != NULL) {
+      const int shift = GetRotationShift(component->begin, begin, middle, end);
+      component->begin += shift;
+      component->end += shift;
+    }
+  }
+  if (state->prev_name >= 0) {
+    state->prev_name +=
+        GetRotationShift(state->prev_name, begin, middle, end);
+  }
+  return true;
+}
+
+// Same as RotateOutput(), where "begin" may be inside substitutions and
+// template arguments, e.g. to put text into a type at its "type_hole". As
+// those are no longer contiguous, they are dropped; a dropped <type> is
+// parsed again where it is referred to, see MaybeParseElidedSubstitution().
+static bool RotateOutputAtHole(State* state, int begin, int middle) {
+  if (state->append) {
+    int i;
+    for (i = 0; i < state->num_substitutions && i < kMaxSubstitutions; ++i) {
+      Substitution* subst = &state->context->substitutions[i];
+      if (subst->begin >= 0 && subst->begin < begin && subst->end > begin) {
+        subst->begin = -1;
+      }
+    }
+    for (i = 0; i < state->num_template_args && i < kMaxTemplateArgs; ++i) {
+      TemplateArg* arg = &state->context->template_args[i];
+      if (arg->begin >= 0 && arg->begin < begin && arg->end > begin) {
+        arg->begin = -1;
+      }
+    }
+  }
+  return RotateOutput(state, begin, middle);
+}
+
+// Move the output from offset "begin" up to "out_cur", which was appended
+// to the <type> just parsed, to its "type_hole" if any, e.g. " const" for
+// "int (* const)()". The hole is then after the text.
+static void MaybeMoveToTypeHole(State* state, int begin) {
+  if (state->type_hole >= 0) {
+    const int length = OutputOffset(state) - begin;
+    RotateOutputAtHole(state, state->type_hole, begin);
+    state->type_hole += length;
   }
 }
 
@@ -330,15 +1183,15 @@ static void MaybeCancelLastSeparator(State* state) {
 static bool IdentifierIsAnonymousNamespace(State* state, int length) {
   static const char anon_prefix[] = "_GLOBAL__N_";
   return (length > (int)sizeof(anon_prefix) - 1 &&  // Should be longer.
-          StrPrefix(state->mangled_cur, anon_prefix));
+          HasPrefix(state, anon_prefix));
 }
 
 // Forward declarations of our parsing functions.
 static bool ParseMangledName(State* state);
 static bool ParseEncoding(State* state);
+static bool ParseFunctionSignature(State* state, int name_begin);
 static bool ParseName(State* state);
 static bool ParseUnscopedName(State* state);
-static bool ParseUnscopedTemplateName(State* state);
 static bool ParseNestedName(State* state);
 static bool ParsePrefix(State* state);
 static bool ParseUnqualifiedName(State* state);
@@ -346,7 +1199,7 @@ static bool ParseSourceName(State* state);
 static bool ParseLocalSourceName(State* state);
 static bool ParseNumber(State* state, int* number_out);
 static bool ParseFloatNumber(State* state);
-static bool ParseSeqId(State* state);
+static bool ParseSeqId(State* state, int* seq_id_out);
 static bool ParseIdentifier(State* state, int length);
 static bool ParseAbiTags(State* state);
 static bool ParseAbiTag(State* state);
@@ -357,19 +1210,26 @@ static bool ParseNVOffset(State* state);
 static bool ParseVOffset(State* state);
 static bool ParseCtorDtorName(State* state);
 static bool ParseType(State* state);
-static bool ParseCVQualifiers(State* state);
+static bool ParsePointerToFunctionOrArrayType(State* state);
+static bool ParseCVQualifiers(State* state, int* qualifiers_out);
+static bool ParseRefQualifier(State* state, int* qualifiers_out);
 static bool ParseBuiltinType(State* state);
 static bool ParseFunctionType(State* state);
+static bool ParseFunctionTypeWithDeclarator(State* state,
+                                            int declarator_begin);
 static bool ParseBareFunctionType(State* state);
 static bool ParseClassEnumType(State* state);
 static bool ParseArrayType(State* state);
+static bool ParseArrayTypeWithDeclarator(State* state, int declarator_begin);
 static bool ParsePointerToMemberType(State* state);
 static bool ParseTemplateParam(State* state);
-static bool ParseTemplateTemplateParam(State* state);
 static bool ParseTemplateArgs(State* state);
+static bool ParseTemplateArgList(State* state, bool record);
 static bool ParseTemplateArg(State* state);
 static bool ParseExpression(State* state);
+static bool ParseOperatorExpression(State* state);
 static bool ParseExprPrimary(State* state);
+static bool ParseLiteralValue(State* state);
 static bool ParseLocalName(State* state);
 static bool ParseDiscriminator(State* state);
 static bool ParseSubstitution(State* state);
@@ -383,13 +1243,16 @@ static bool ParseSubstitution(State* state);
 // - Reorder patterns to shorten the code
 // - Reorder patterns to give greedier functions precedence
 //   We'll mark "Less greedy than" for these cases in the code
+// - Dispatch on the next one or two characters of the mangled name, so
+//   that an alternative is tried only if it can match, and parse the
+//   common prefix of alternatives once instead of once per alternative
 //
 // Each parsing function changes the state and returns true on
 // success.  Otherwise, don't change the state and returns false.  To
 // ensure that the state isn't changed in the latter case, we save the
 // original state before we call more than one parsing functions
 // consecutively with &&, and restore the state if unsuccessful.  See
-// ParseEncoding() as an example of this convention.  We follow the
+// ParseNestedName() as an example of this convention.  We follow the
 // convention throughout the code.
 //
 // Originally we tried to do demangling without following the full ABI
@@ -413,15 +1276,77 @@ static bool ParseMangledName(State* state) {
 //            ::= <(data) name>
 //            ::= <special-name>
 static bool ParseEncoding(State* state) {
-  State copy = *state;
-  if (ParseName(state) && ParseBareFunctionType(state)) {
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
+  }
+  if (Peek(state, 0) == 'T' || Peek(state, 0) == 'G') {
+    return ParseSpecialName(state);
+  }
+  const int name_begin = OutputOffset(state);
+  const int first_component = state->num_components;
+  if (ParseName(state)) {
+    // Less greedy than <(function) name> <bare-function-type>.
+    const int last_name = FindLastNameComponent(state, first_component);
+    if (ParseFunctionSignature(state, name_begin) && last_name >= 0) {
+      DemangleComponent* name = GetComponent(state, last_name);
+      if (name->kind == kComponentName) {
+        name->kind = kComponentFunction;
+      }
+    }
     return true;
   }
-  *state = copy;
+  return false;
+}
 
-  if (ParseName(state) || ParseSpecialName(state)) {
-    return true;
+// The <bare-function-type> of a function <encoding>, whose name was output
+// from offset "name_begin", followed by the qualifiers of the name. If the
+// name ends with <template-args>, i.e. the function is a template, the
+// first type is the return type, which is printed before the name, unless
+// the function is a ctor or a conversion operator.
+static bool ParseFunctionSignature(State* state, int name_begin) {
+  if (!ShouldPrintTypes(state)) {
+    const int parameters_begin = OutputOffset(state);
+    return ParseBareFunctionType(state) &&
+           MaybeAddComponent(state, kComponentParameters, parameters_begin);
+  }
+  State copy = *state;
+  const int qualifiers = state->name_qualifiers;
+  const int return_begin = OutputOffset(state);
+  const bool has_return_type =
+      state->name_has_template_args && !state->name_is_ctor_or_conversion;
+  // In compact mode, the return type and the parameter types may be dropped
+  // to fit the width: they are parsed without output, and "(...)" is printed
+  // instead, or "()" if there are no parameters.
+  const bool elide = state->context->elide_signatures;
+  state->in_args_or_signature = true;
+  if (elide) {
+    DisableAppend(state);
+  }
+  if (!has_return_type ||
+      (ParseType(state) && MaybeAppend(state, " ") &&
+       RotateOutput(state, name_begin, return_begin))) {
+    const int parameters_begin = OutputOffset(state);
+    const char* const parameters_mangled = state->mangled_cur;
+    if (ParseBareFunctionType(state)) {
+      state->in_args_or_signature = copy.in_args_or_signature;
+      if (elide) {
+        RestoreAppend(state, copy.append);
+        const bool is_void = state->mangled_cur == parameters_mangled + 1 &&
+                             parameters_mangled[0] == 'v';
+        MaybeAppend(state, is_void ? "()" : "(...)");
+      } else if (has_return_type) {
+        // The return type, followed by a space, is now before the name.
+        MaybeAddComponentSpan(
+            state, kComponentReturnType, name_begin,
+            name_begin + (parameters_begin - return_begin) - 1);
+      }
+      MaybeAddComponent(state, kComponentParameters, parameters_begin);
+      MaybeAppendQualifiers(state, qualifiers);
+      return true;
+    }
   }
+  *state = copy;
   return false;
 }
 
@@ -429,21 +1354,46 @@ static bool ParseEncoding(State* state) {
 //        ::= <unscoped-template-name> <template-args>
 //        ::= <unscoped-name>
 //        ::= <local-name>
+// <unscoped-template-name> ::= <unscoped-name>
+//                          ::= <substitution>
+// The <unscoped-name> as an <unscoped-template-name> is a substitution
+// candidate.
 static bool ParseName(State* state) {
-  if (ParseNestedName(state) || ParseLocalName(state)) {
-    return true;
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
+  }
+  switch (Peek(state, 0)) {
+    case 'N':
+      return ParseNestedName(state);
+    case 'Z':
+      return ParseLocalName(state);
   }
 
-  State copy = *state;
-  if (ParseUnscopedTemplateName(state) && ParseTemplateArgs(state)) {
+  const int begin = OutputOffset(state);
+  if (ParseUnscopedName(state)) {
+    // The <unscoped-name> as an <unscoped-template-name>.
+    if (Peek(state, 0) == 'I') {
+      State unscoped_name = *state;
+      AddSubstitution(state, begin);
+      // Less greedy than <unscoped-template-name> <template-args>.
+      if (!ParseTemplateArgs(state)) {
+        *state = unscoped_name;
+      }
+    }
+    state->name_qualifiers = 0;
     return true;
   }
-  *state = copy;
 
-  // Less greedy than <unscoped-template-name> <template-args>.
-  if (ParseUnscopedName(state)) {
+  // The <substitution> as an <unscoped-template-name>.
+  State copy = *state;
+  if (ParseSubstitution(state) &&
+      MaybeAddComponent(state, kComponentName, begin) &&
+      ParseTemplateArgs(state)) {
+    state->name_qualifiers = 0;
     return true;
   }
+  *state = copy;
   return false;
 }
 
@@ -455,28 +1405,30 @@ static bool ParseUnscopedName(State* state) {
   }
 
   State copy = *state;
-  if (ParseTwoCharToken(state, "St") && MaybeAppend(state, "std::") &&
-      ParseUnqualifiedName(state)) {
+  const int begin = OutputOffset(state);
+  if (ParseTwoCharToken(state, "St") && MaybeAppend(state, "std") &&
+      MaybeAddComponent(state, kComponentNamespace, begin) &&
+      MaybeAppend(state, "::") && ParseUnqualifiedName(state)) {
     return true;
   }
   *state = copy;
   return false;
 }
 
-// <unscoped-template-name> ::= <unscoped-name>
-//                          ::= <substitution>
-static bool ParseUnscopedTemplateName(State* state) {
-  return ParseUnscopedName(state) || ParseSubstitution(state);
-}
-
-// <nested-name> ::= N [<CV-qualifiers>] <prefix> <unqualified-name> E
-//               ::= N [<CV-qualifiers>] <template-prefix> <template-args> E
+// <nested-name> ::= N [<CV-qualifiers>] [<ref-qualifier>] <prefix>
+//                   <unqualified-name> E
+//               ::= N [<CV-qualifiers>] [<ref-qualifier>] <template-prefix>
+//                   <template-args> E
 static bool ParseNestedName(State* state) {
   State copy = *state;
+  int qualifiers = 0;
   if (ParseOneCharToken(state, 'N') && EnterNestedName(state) &&
-      Optional(ParseCVQualifiers(state)) && ParsePrefix(state) &&
+      Optional(ParseCVQualifiers(state, &qualifiers)) &&
+      Optional(ParseRefQualifier(state, &qualifiers)) && ParsePrefix(state) &&
       LeaveNestedName(state, copy.nest_level) &&
       ParseOneCharToken(state, 'E')) {
+    ClassifyNestedComponents(state, copy.num_components);
+    state->name_qualifiers = qualifiers;
     return true;
   }
   *state = copy;
@@ -494,19 +1446,41 @@ static bool ParseNestedName(State* state) {
 // <template-prefix> ::= <prefix> <(template) unqualified-name>
 //                   ::= <template-param>
 //                   ::= <substitution>
+//
+// Each <prefix> and <template-prefix> is a substitution candidate, unless it
+// is a <substitution> itself.
 static bool ParsePrefix(State* state) {
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
+  }
+  const int begin = OutputOffset(state);
   bool has_something = false;
   while (true) {
     MaybeAppendSeparator(state);
-    if (ParseTemplateParam(state) || ParseSubstitution(state) ||
-        ParseUnscopedName(state)) {
+    const int component_begin = OutputOffset(state);
+    const bool is_std = HasPrefix(state, "St");
+    const bool is_substitution = ParseSubstitution(state);
+    const bool is_template_param =
+        !is_substitution && ParseTemplateParam(state);
+    if (is_substitution || is_template_param || ParseUnscopedName(state)) {
       has_something = true;
+      if (is_substitution || is_template_param) {
+        // An <unscoped-name> adds its own components.
+        MaybeAddComponent(state,
+                          is_std ? kComponentNamespace : kComponentScope,
+                          component_begin);
+      }
       MaybeIncreaseNestLevel(state);
+      if (!is_substitution) {
+        MaybeAddPrefixSubstitution(state, begin);
+      }
       continue;
     }
     MaybeCancelLastSeparator(state);
     if (has_something && ParseTemplateArgs(state)) {
-      return ParsePrefix(state);
+      MaybeAddPrefixSubstitution(state, begin);
+      has_something = false;
     } else {
       break;
     }
@@ -519,9 +1493,34 @@ static bool ParsePrefix(State* state) {
 //                    ::= <source-name> [<abi-tags>]
 //                    ::= <local-source-name> [<abi-tags>]
 static bool ParseUnqualifiedName(State* state) {
-  return (ParseOperatorName(state) || ParseCtorDtorName(state) ||
-          (ParseSourceName(state) && Optional(ParseAbiTags(state))) ||
-          (ParseLocalSourceName(state) && Optional(ParseAbiTags(state))));
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
+  }
+  const char c = Peek(state, 0);
+  const bool is_ctor_or_conversion =
+      c == 'C' || c == 'D' || HasPrefix(state, "cv");
+  const int begin = OutputOffset(state);
+  DemangleComponentKind kind = kComponentName;
+  bool parsed;
+  if (c == 'C' || c == 'D') {
+    parsed = ParseCtorDtorName(state);
+    kind = kComponentCtorDtor;
+  } else if (c == 'L') {
+    parsed = ParseLocalSourceName(state) && Optional(ParseAbiTags(state));
+  } else if (IsDigit(c)) {
+    parsed = ParseSourceName(state) && Optional(ParseAbiTags(state));
+  } else {
+    parsed = IsLower(c) && ParseOperatorName(state);
+    kind = kComponentOperator;
+  }
+  if (parsed) {
+    MaybeAddComponent(state, kind, begin);
+    state->name_has_template_args = false;
+    state->name_is_ctor_or_conversion = is_ctor_or_conversion;
+    return true;
+  }
+  return false;
 }
 
 // <source-name> ::= <positive length number> <identifier>
@@ -552,17 +1551,21 @@ static bool ParseLocalSourceName(State* state) {
 
 // <number> ::= [n] <non-negative decimal integer>
 // If "number_out" is non-null, then *number_out is set to the value of the
-// parsed number on success.
+// parsed number on success. The magnitude saturates at kMaxNumber instead of
+// overflowing.
 static bool ParseNumber(State* state, int* number_out) {
+  static const int kMaxNumber = 0x7fffffff;
   int sign = 1;
   if (ParseOneCharToken(state, 'n')) {
     sign = -1;
   }
   const char* p = state->mangled_cur;
   int number = 0;
-  for (; *p != '\0'; ++p) {
+  for (; p != state->context->mangled_end; ++p) {
     if (IsDigit(*p)) {
-      number = number * 10 + (*p - '0');
+      const int digit = *p - '0';
+      number = number > (kMaxNumber - digit) / 10 ? kMaxNumber
+                                                  : number * 10 + digit;
     } else {
       break;
     }
@@ -581,7 +1584,7 @@ static bool ParseNumber(State* state, int* number_out) {
 // hexadecimal string.
 static bool ParseFloatNumber(State* state) {
   const char* p = state->mangled_cur;
-  for (; *p != '\0'; ++p) {
+  for (; p != state->context->mangled_end; ++p) {
     if (!IsDigit(*p) && !(*p >= 'a' && *p <= 'f')) {
       break;
     }
@@ -595,15 +1598,34 @@ static bool ParseFloatNumber(State* state) {
 
 // The <seq-id> is a sequence number in base 36,
 // using digits and upper case letters
-static bool ParseSeqId(State* state) {
+// If "seq_id_out" is non-null, then *seq_id_out is set to the value of the
+// parsed number on success. The value saturates at kMaxSubstitutions, which
+// is past the end of the substitution table, so a long <seq-id> can not
+// overflow.
+static bool ParseSeqId(State* state, int* seq_id_out) {
   const char* p = state->mangled_cur;
-  for (; *p != '\0'; ++p) {
-    if (!IsDigit(*p) && !(*p >= 'A' && *p <= 'Z')) {
+  int seq_id = 0;
+  for (; p != state->context->mangled_end; ++p) {
+    int digit;
+    if (IsDigit(*p)) {
+      digit = *p - '0';
+    } else if (*p >= 'A' && *p <= 'Z') {
+      digit = *p - 'A' + 10;
+    } else {
       break;
     }
+    if (seq_id < kMaxSubstitutions) {
+      seq_id = seq_id * 36 + digit;
+    }
+  }
+  if (seq_id > kMaxSubstitutions) {
+    seq_id = kMaxSubstitutions;
   }
   if (p != state->mangled_cur) {  // Conversion succeeded.
     state->mangled_cur = p;
+    if (seq_id_out != NULL) {
+      *seq_id_out = seq_id;
+    }
     return true;
   }
   return false;
@@ -611,7 +1633,7 @@ static bool ParseSeqId(State* state) {
 
 // <identifier> ::= <unqualified source code identifier> (of given length)
 static bool ParseIdentifier(State* state, int length) {
-  if (length == -1 || !AtLeastNumCharsRemaining(state->mangled_cur, length)) {
+  if (length < 0 || !AtLeastNumCharsRemaining(state, length)) {
     return false;
   }
   if (IdentifierIsAnonymousNamespace(state, length)) {
@@ -644,7 +1666,7 @@ static bool ParseAbiTag(State* state) {
 //                 ::= cv <type>  # (cast)
 //                 ::= v  <digit> <source-name> # vendor extended operator
 static bool ParseOperatorName(State* state) {
-  if (!AtLeastNumCharsRemaining(state->mangled_cur, 2)) {
+  if (!AtLeastNumCharsRemaining(state, 2)) {
     return false;
   }
   // First check with "cv" (cast) case.
@@ -665,24 +1687,22 @@ static bool ParseOperatorName(State* state) {
 
   // Other operator names should start with a lower alphabet followed
   // by a lower/upper alphabet.
-  if (!(IsLower(state->mangled_cur[0]) && IsAlpha(state->mangled_cur[1]))) {
+  if (!(IsLower(Peek(state, 0)) && IsAlpha(Peek(state, 1)))) {
     return false;
   }
-  // We may want to perform a binary search if we really need speed.
-  const AbbrevPair* p;
-  for (p = kOperatorList; p->abbrev != NULL; ++p) {
-    if (state->mangled_cur[0] == p->abbrev[0] &&
-        state->mangled_cur[1] == p->abbrev[1]) {
-      MaybeAppend(state, "operator");
-      if (IsLower(*p->real_name)) {  // new, delete, etc.
-        MaybeAppend(state, " ");
-      }
-      MaybeAppend(state, p->real_name);
-      state->mangled_cur += 2;
-      return true;
-    }
+  const AbbrevPair* p =
+      LookUpCode(kOperatorList, kOperatorIndex,
+                 TwoLetterKey(Peek(state, 0), Peek(state, 1)));
+  if (p == NULL) {
+    return false;
   }
-  return false;
+  MaybeAppend(state, "operator");
+  if (IsLower(*p->real_name)) {  // new, delete, etc.
+    MaybeAppend(state, " ");
+  }
+  MaybeAppendWithLength(state, p->real_name, p->real_name_length);
+  state->mangled_cur += 2;
+  return true;
 }
 
 // <special-name> ::= TV <type>
@@ -704,58 +1724,76 @@ static bool ParseOperatorName(State* state) {
 // Note: we don't care much about them since they don't appear in
 // stack traces.  The are special data.
 static bool ParseSpecialName(State* state) {
-  State copy = *state;
-  if (ParseOneCharToken(state, 'T') && ParseCharClass(state, "VTIS") &&
-      ParseType(state)) {
-    return true;
-  }
-  *state = copy;
-
-  if (ParseTwoCharToken(state, "Tc") && ParseCallOffset(state) &&
-      ParseCallOffset(state) && ParseEncoding(state)) {
-    return true;
-  }
-  *state = copy;
-
-  if (ParseTwoCharToken(state, "GV") && ParseName(state)) {
-    return true;
-  }
-  *state = copy;
-
-  if (ParseOneCharToken(state, 'T') && ParseCallOffset(state) &&
-      ParseEncoding(state)) {
-    return true;
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
   }
-  *state = copy;
-
-  // G++ extensions
-  if (ParseTwoCharToken(state, "TC") && ParseType(state) &&
-      ParseNumber(state, NULL) && ParseOneCharToken(state, '_') &&
-      DisableAppend(state) && ParseType(state)) {
-    RestoreAppend(state, copy.append);
-    return true;
+  State copy = *state;
+  if (ParseOneCharToken(state, 'G')) {
+    switch (Peek(state, 0)) {
+      case 'V':
+      case 'R':  // G++ extension.
+        ++state->mangled_cur;
+        if (ParseName(state)) {
+          return true;
+        }
+        break;
+      case 'A':  // G++ extension.
+        ++state->mangled_cur;
+        if (ParseEncoding(state)) {
+          return true;
+        }
+        break;
+    }
+    *state = copy;
+    return false;
   }
-  *state = copy;
 
-  if (ParseOneCharToken(state, 'T') && ParseCharClass(state, "FJ") &&
-      ParseType(state)) {
-    return true;
+  if (!ParseOneCharToken(state, 'T')) {
+    return false;
   }
-  *state = copy;
-
-  if (ParseTwoCharToken(state, "GR") && ParseName(state)) {
-    return true;
-  }
-  *state = copy;
-
-  if (ParseTwoCharToken(state, "GA") && ParseEncoding(state)) {
-    return true;
-  }
-  *state = copy;
-
-  if (ParseOneCharToken(state, 'T') && ParseCharClass(state, "hv") &&
-      ParseCallOffset(state) && ParseEncoding(state)) {
-    return true;
+  switch (Peek(state, 0)) {
+    case 'V':
+    case 'T':
+    case 'I':
+    case 'S':
+    case 'F':  // G++ extension.
+    case 'J':  // G++ extension.
+      ++state->mangled_cur;
+      if (ParseType(state)) {
+        return true;
+      }
+      break;
+    case 'c':
+      ++state->mangled_cur;
+      if (ParseCallOffset(state) && ParseCallOffset(state) &&
+          ParseEncoding(state)) {
+        return true;
+      }
+      break;
+    case 'C':  // G++ extension.
+      ++state->mangled_cur;
+      if (ParseType(state) && ParseNumber(state, NULL) &&
+          ParseOneCharToken(state, '_') && DisableAppend(state) &&
+          ParseType(state)) {
+        RestoreAppend(state, copy.append);
+        return true;
+      }
+      break;
+    case 'h':
+    case 'v': {
+      State call_offset = *state;
+      if (ParseCallOffset(state) && ParseEncoding(state)) {
+        return true;
+      }
+      *state = call_offset;
+      // G++ extension, less greedy than T <call-offset> <(base) encoding>.
+      ++state->mangled_cur;
+      if (ParseCallOffset(state) && ParseEncoding(state)) {
+        return true;
+      }
+      break;
+    }
   }
   *state = copy;
   return false;
@@ -801,18 +1839,14 @@ static bool ParseVOffset(State* state) {
 static bool ParseCtorDtorName(State* state) {
   State copy = *state;
   if (ParseOneCharToken(state, 'C') && ParseCharClass(state, "123")) {
-    const char* const prev_name = state->prev_name;
-    const int prev_name_length = state->prev_name_length;
-    MaybeAppendWithLength(state, prev_name, prev_name_length);
+    MaybeAppendPrevName(state);
     return true;
   }
   *state = copy;
 
   if (ParseOneCharToken(state, 'D') && ParseCharClass(state, "012")) {
-    const char* const prev_name = state->prev_name;
-    const int prev_name_length = state->prev_name_length;
     MaybeAppend(state, "~");
-    MaybeAppendWithLength(state, prev_name, prev_name_length);
+    MaybeAppendPrevName(state);
     return true;
   }
   *state = copy;
@@ -838,76 +1872,249 @@ static bool ParseCtorDtorName(State* state) {
 //        ::= Dt <expression> E  # decltype of an id-expression or class
 //                               # member access (C++0x)
 //        ::= DT <expression> E  # decltype of an expression (C++0x)
+//
+// Each type is a substitution candidate, unless it is a <builtin-type> or a
+// <substitution>.
 static bool ParseType(State* state) {
-  // We should check CV-qualifers, and PRGC things first.
-  State copy = *state;
-  if (ParseCVQualifiers(state) && ParseType(state)) {
-    return true;
-  }
-  *state = copy;
-
-  if (ParseCharClass(state, "OPRCG") && ParseType(state)) {
-    return true;
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
   }
-  *state = copy;
-
-  if (ParseTwoCharToken(state, "Dp") && ParseType(state)) {
-    return true;
+  NestingGuard type_nesting(&state->context->type_nesting);
+  State copy = *state;
+  const int begin = OutputOffset(state);
+  state->type_hole = -1;
+  switch (Peek(state, 0)) {
+    case 'r':
+    case 'V':
+    case 'K': {
+      int qualifiers = 0;
+      if (ParseCVQualifiers(state, &qualifiers) && ParseType(state)) {
+        const int qualifiers_begin = OutputOffset(state);
+        MaybeAppendQualifiers(state, qualifiers);
+        MaybeMoveToTypeHole(state, qualifiers_begin);
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        return true;
+      }
+      break;
+    }
+    case 'P':
+    case 'R':
+    case 'O':
+      if (ParsePointerToFunctionOrArrayType(state)) {
+        return true;
+      }
+      // Fall through.
+    case 'C':
+    case 'G': {
+      const AbbrevPair* p;
+      for (p = kTypeModifierList; p->abbrev != NULL; ++p) {
+        if (Peek(state, 0) == p->abbrev[0]) {
+          break;
+        }
+      }
+      ++state->mangled_cur;
+      if (ParseType(state)) {
+        const int modifier_begin = OutputOffset(state);
+        MaybeAppendTypeText(state, p->real_name);
+        MaybeMoveToTypeHole(state, modifier_begin);
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        return true;
+      }
+      break;
+    }
+    case 'D':
+      if (ParseTwoCharToken(state, "Dp") && ParseType(state)) {
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        return true;
+      }
+      *state = copy;
+      if (ParseOneCharToken(state, 'D') && ParseCharClass(state, "tT") &&
+          MaybeAppendTypeText(state, "decltype (") && ParseExpression(state) &&
+          ParseOneCharToken(state, 'E') && MaybeAppendTypeText(state, ")")) {
+        state->type_hole = -1;
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        return true;
+      }
+      break;
+    case 'U':
+      // The vendor extended type qualifier is printed after the type.
+      ++state->mangled_cur;
+      if (ParseSourceName(state)) {
+        const int type_begin = OutputOffset(state);
+        if (ParseType(state)) {
+          if (ShouldPrintTypes(state)) {
+            MaybeAppend(state, " ");
+            RotateOutput(state, begin, type_begin);
+          }
+          state->type_hole = -1;
+          AddTypeSubstitution(state, begin, copy.mangled_cur);
+          return true;
+        }
+      }
+      break;
+    case 'F':
+      if (ParseFunctionType(state)) {
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        return true;
+      }
+      break;
+    case 'A':
+      if (ParseArrayType(state)) {
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        return true;
+      }
+      break;
+    case 'M':
+      if (ParsePointerToMemberType(state)) {
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        return true;
+      }
+      break;
+    case 'T':
+      // <template-template-param> <template-args>, where a <substitution> as
+      // the <template-template-param> is handled as a <class-enum-type>.
+      // Both the <template-param> and the type are substitution candidates.
+      if (ParseTemplateParam(state)) {
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        // Less greedy than <template-template-param> <template-args>.
+        if (ParseTemplateArgs(state)) {
+          state->type_hole = -1;
+          AddTypeSubstitution(state, begin, copy.mangled_cur);
+        }
+        return true;
+      }
+      break;
+    case 'S':
+      // Less greedy than <class-enum-type>, e.g. S_ <template-args>.
+      if (ParseClassEnumType(state)) {
+        state->type_hole = -1;
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        return true;
+      }
+      return ParseSubstitution(state);
+    default:
+      if (Peek(state, 0) != 'N' && Peek(state, 0) != 'Z' &&
+          Peek(state, 0) != 'L' && !IsDigit(Peek(state, 0))) {
+        return ParseBuiltinType(state);
+      }
+      if (ParseClassEnumType(state)) {
+        state->type_hole = -1;
+        AddTypeSubstitution(state, begin, copy.mangled_cur);
+        return true;
+      }
+      break;
   }
   *state = copy;
+  return false;
+}
 
-  if (ParseOneCharToken(state, 'D') && ParseCharClass(state, "tT") &&
-      ParseExpression(state) && ParseOneCharToken(state, 'E')) {
-    return true;
+// A chain of pointers and references to a function or array type, which is
+// printed with the chain inside the type, e.g. "void (*&)(int)" for RPFviE
+// and "int (*) [10]" for PA10_i, if the types are printed. The declarator of
+// an enclosing type goes inside the parentheses, after the chain: it is the
+// "type_hole" of the type, e.g. "int (* const&)()" for RKPFivE.
+// Each function, array, pointer and reference type in the chain is a
+// substitution candidate, but only the outermost one is printed as a whole.
+static bool ParsePointerToFunctionOrArrayType(State* state) {
+  if (!ShouldPrintTypes(state)) {
+    return false;
   }
-  *state = copy;
-
-  if (ParseOneCharToken(state, 'U') && ParseSourceName(state) &&
-      ParseType(state)) {
-    return true;
+  // Look ahead for the function or array type before parsing anything.
+  static const int kMaxChainLength = 8;
+  const char* const chain = state->mangled_cur;
+  int chain_length = 0;
+  while (chain_length < kMaxChainLength &&
+         (Peek(state, chain_length) == 'P' ||
+          Peek(state, chain_length) == 'R' ||
+          Peek(state, chain_length) == 'O')) {
+    ++chain_length;
+  }
+  if (chain_length == 0 || (Peek(state, chain_length) != 'F' &&
+                            Peek(state, chain_length) != 'A')) {
+    return false;
   }
-  *state = copy;
-
-  if (ParseBuiltinType(state) || ParseFunctionType(state) ||
-      ParseClassEnumType(state) || ParseArrayType(state) ||
-      ParsePointerToMemberType(state) || ParseSubstitution(state)) {
-    return true;
+  State copy = *state;
+  const int begin = OutputOffset(state);
+  state->mangled_cur += chain_length;
+  // The innermost pointer or reference is printed first.
+  MaybeAppend(state, "(");
+  int i;
+  for (i = chain_length - 1; i >= 0; --i) {
+    const AbbrevPair* p;
+    for (p = kTypeModifierList; p->abbrev != NULL; ++p) {
+      if (chain[i] == p->abbrev[0]) {
+        MaybeAppend(state, p->real_name);
+      }
+    }
   }
-
-  if (ParseTemplateTemplateParam(state) && ParseTemplateArgs(state)) {
+  const int hole = OutputOffset(state) - begin;
+  MaybeAppend(state, ")");
+  if (ParseFunctionTypeWithDeclarator(state, begin) ||
+      ParseArrayTypeWithDeclarator(state, begin)) {
+    state->type_hole += hole;
+    // The inner types are not printed as a whole. The inner pointers and
+    // references are parsed again where they are referred to, but not the
+    // function or array type: a pointer to it would not go inside it.
+    AddSubstitution(state, -1);
+    for (i = chain_length - 1; i > 0; --i) {
+      AddTypeSubstitution(state, -1, chain + i);
+    }
+    AddTypeSubstitution(state, begin, chain);
     return true;
   }
   *state = copy;
-
-  // Less greedy than <template-template-param> <template-args>.
-  if (ParseTemplateParam(state)) {
-    return true;
-  }
-
   return false;
 }
 
 // <CV-qualifiers> ::= [r] [V] [K]
 // We don't allow empty <CV-qualifiers> to avoid infinite loop in
 // ParseType().
-static bool ParseCVQualifiers(State* state) {
-  int num_cv_qualifiers = 0;
-  num_cv_qualifiers += ParseOneCharToken(state, 'r');
-  num_cv_qualifiers += ParseOneCharToken(state, 'V');
-  num_cv_qualifiers += ParseOneCharToken(state, 'K');
-  return num_cv_qualifiers > 0;
+// If "qualifiers_out" is non-null, then the qualifiers are or'ed into
+// *qualifiers_out as bits.
+static bool ParseCVQualifiers(State* state, int* qualifiers_out) {
+  int qualifiers = 0;
+  if (ParseOneCharToken(state, 'r')) {
+    qualifiers |= kRestrictQualifier;
+  }
+  if (ParseOneCharToken(state, 'V')) {
+    qualifiers |= kVolatileQualifier;
+  }
+  if (ParseOneCharToken(state, 'K')) {
+    qualifiers |= kConstQualifier;
+  }
+  if (qualifiers_out != NULL) {
+    *qualifiers_out |= qualifiers;
+  }
+  return qualifiers != 0;
+}
+
+// <ref-qualifier> ::= R  # & ref-qualifier
+//                 ::= O  # && ref-qualifier
+// If "qualifiers_out" is non-null, then the qualifier is or'ed into
+// *qualifiers_out as a bit.
+static bool ParseRefQualifier(State* state, int* qualifiers_out) {
+  int qualifiers = 0;
+  if (ParseOneCharToken(state, 'R')) {
+    qualifiers = kLvalueRefQualifier;
+  } else if (ParseOneCharToken(state, 'O')) {
+    qualifiers = kRvalueRefQualifier;
+  }
+  if (qualifiers_out != NULL) {
+    *qualifiers_out |= qualifiers;
+  }
+  return qualifiers != 0;
 }
 
 // <builtin-type> ::= v, etc.
 //                ::= u <source-name>
 static bool ParseBuiltinType(State* state) {
-  const AbbrevPair* p;
-  for (p = kBuiltinTypeList; p->abbrev != NULL; ++p) {
-    if (state->mangled_cur[0] == p->abbrev[0]) {
-      MaybeAppend(state, p->real_name);
-      ++state->mangled_cur;
-      return true;
-    }
+  const AbbrevPair* p = LookUpCode(kBuiltinTypeList, kBuiltinTypeIndex,
+                                   OneLetterKey(Peek(state, 0)));
+  if (p != NULL) {
+    MaybeAppendWithLength(state, p->real_name, p->real_name_length);
+    ++state->mangled_cur;
+    return true;
   }
 
   State copy = *state;
@@ -918,11 +2125,19 @@ static bool ParseBuiltinType(State* state) {
   return false;
 }
 
-// <function-type> ::= F [Y] <bare-function-type> E
+// <function-type> ::= F [Y] <bare-function-type> [<ref-qualifier>] E
 static bool ParseFunctionType(State* state) {
+  if (ShouldPrintTypes(state)) {
+    if (ParseFunctionTypeWithDeclarator(state, OutputOffset(state))) {
+      state->type_hole = -1;
+      return true;
+    }
+    return false;
+  }
   State copy = *state;
   if (ParseOneCharToken(state, 'F') &&
       Optional(ParseOneCharToken(state, 'Y')) && ParseBareFunctionType(state) &&
+      Optional(ParseRefQualifier(state, NULL)) &&
       ParseOneCharToken(state, 'E')) {
     return true;
   }
@@ -930,27 +2145,125 @@ static bool ParseFunctionType(State* state) {
   return false;
 }
 
-// <bare-function-type> ::= <(signature) type>+
-static bool ParseBareFunctionType(State* state) {
+// Same as ParseFunctionType() if the types are printed, but prints the type
+// around the declarator output from offset "declarator_begin", e.g. the
+// return type before "(*)" and the parameter types after. If the return
+// type has a "type_hole", the declarator and the parameter types go there,
+// e.g. "int (*(*)(char))()" for PFPFivEcE. On success, "type_hole" is the
+// offset of the declarator.
+static bool ParseFunctionTypeWithDeclarator(State* state,
+                                            int declarator_begin) {
   State copy = *state;
-  DisableAppend(state);
-  if (OneOrMore(ParseType, state)) {
-    RestoreAppend(state, copy.append);
-    MaybeAppend(state, "()");
+  const int return_begin = OutputOffset(state);
+  if (!(ParseOneCharToken(state, 'F') &&
+        Optional(ParseOneCharToken(state, 'Y')) && ParseType(state))) {
+    *state = copy;
+    return false;
+  }
+  const int return_end = OutputOffset(state);
+  const int return_hole = state->type_hole;
+  if (return_hole < 0) {
+    MaybeAppend(state, " ");
+  }
+  int declarator = declarator_begin + OutputOffset(state) - return_begin;
+  RotateOutput(state, declarator_begin, return_begin);
+  int qualifiers = 0;
+  if (ParseBareFunctionType(state) &&
+      Optional(ParseRefQualifier(state, &qualifiers)) &&
+      ParseOneCharToken(state, 'E')) {
+    MaybeAppendQualifiers(state, qualifiers);
+    if (return_hole >= 0) {
+      // Move the return type after its hole to the end.
+      declarator = declarator_begin + return_hole - return_begin;
+      RotateOutputAtHole(state, declarator,
+                         declarator + return_end - return_hole);
+    }
+    state->type_hole = declarator;
     return true;
   }
   *state = copy;
   return false;
 }
 
+// <bare-function-type> ::= <(signature) type>+
+// If the types are printed, they are printed in parentheses separated by
+// ", ", and a sole void is printed as "()".
+static bool ParseBareFunctionType(State* state) {
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
+  }
+  State copy = *state;
+  if (!ShouldPrintTypes(state)) {
+    DisableAppend(state);
+    if (OneOrMore(ParseType, state)) {
+      RestoreAppend(state, copy.append);
+      MaybeAppend(state, "()");
+      return true;
+    }
+    *state = copy;
+    return false;
+  }
+  MaybeAppend(state, "(");
+  if (ParseOneCharToken(state, 'v')) {
+    MaybeAppend(state, ")");
+    return true;
+  }
+  int num_types = 0;
+  while (true) {
+    State prev = *state;
+    if (num_types > 0) {
+      MaybeAppend(state, ", ");
+    }
+    if (!ParseType(state)) {
+      *state = prev;
+      break;
+    }
+    ++num_types;
+  }
+  if (num_types == 0) {
+    *state = copy;
+    return false;
+  }
+  MaybeAppend(state, ")");
+  return true;
+}
+
 // <class-enum-type> ::= <name>
+// In compact mode, a well-known std type is printed by its short name. It
+// is still parsed, without output, so that the substitution candidates in
+// it are numbered.
 static bool ParseClassEnumType(State* state) {
+  if (IsCompact(state) && state->append) {
+    for (const AbbrevPair* p = kStdTypeManglingList; p->abbrev != NULL; ++p) {
+      if (!HasPrefix(state, p->abbrev)) {
+        continue;
+      }
+      State copy = *state;
+      DisableAppend(state);
+      if (ParseName(state) &&
+          state->mangled_cur == copy.mangled_cur + StrLen(p->abbrev)) {
+        RestoreAppend(state, copy.append);
+        MaybeAppend(state, p->real_name);
+        return true;
+      }
+      *state = copy;
+      break;
+    }
+  }
   return ParseName(state);
 }
 
 // <array-type> ::= A <(positive dimension) number> _ <(element) type>
 //              ::= A [<(dimension) expression>] _ <(element) type>
 static bool ParseArrayType(State* state) {
+  if (ShouldPrintTypes(state)) {
+    if (ParseArrayTypeWithDeclarator(state, OutputOffset(state))) {
+      state->type_hole = -1;
+      return true;
+    }
+    return false;
+  }
   State copy = *state;
   if (ParseOneCharToken(state, 'A') && ParseNumber(state, NULL) &&
       ParseOneCharToken(state, '_') && ParseType(state)) {
@@ -966,11 +2279,126 @@ static bool ParseArrayType(State* state) {
   return false;
 }
 
+// Same as ParseArrayType() if the types are printed, but prints the type
+// around the declarator output from offset "declarator_begin", e.g. the
+// element type before "(*)" and the dimension after. The dimensions of an
+// array of arrays are printed together, e.g. "int (*) [2][3]" for PA2_A3_i.
+// If the element type has a "type_hole", the declarator and the dimensions
+// go there, e.g. "int (* [3])()" for A3_PFivE. On success, "type_hole" is
+// the offset of the declarator.
+static bool ParseArrayTypeWithDeclarator(State* state, int declarator_begin) {
+  // The mangled arrays of the inner dimensions, as substitution candidates.
+  static const int kMaxDimensions = 8;
+  const char* arrays[kMaxDimensions];
+  State copy = *state;
+  int num_dimensions = 0;
+  while (Peek(state, 0) == 'A') {
+    if (num_dimensions < kMaxDimensions) {
+      arrays[num_dimensions] = state->mangled_cur;
+    }
+    ++state->mangled_cur;
+    if (num_dimensions == 0 && OutputOffset(state) != declarator_begin) {
+      MaybeAppend(state, " ");
+    }
+    MaybeAppend(state, "[");
+    const char* const dimension = state->mangled_cur;
+    if (ParseNumber(state, NULL)) {
+      MaybeAppendWithLength(state, dimension, state->mangled_cur - dimension);
+    } else {
+      Optional(ParseExpression(state));
+    }
+    MaybeAppend(state, "]");
+    if (!ParseOneCharToken(state, '_')) {
+      *state = copy;
+      return false;
+    }
+    ++num_dimensions;
+  }
+  const int element_begin = OutputOffset(state);
+  if (num_dimensions == 0 || !ParseType(state)) {
+    *state = copy;
+    return false;
+  }
+  const int element_end = OutputOffset(state);
+  const int element_hole = state->type_hole;
+  MaybeAppend(state, " ");
+  int declarator = declarator_begin + OutputOffset(state) - element_begin;
+  RotateOutput(state, declarator_begin, element_begin);
+  if (element_hole >= 0) {
+    // Move the element type after its hole to the end.
+    const int hole = declarator_begin + element_hole - element_begin;
+    RotateOutputAtHole(state, hole, hole + element_end - element_hole);
+    declarator = hole + 1;
+  }
+  // The arrays of the inner dimensions are not printed as a whole, but are
+  // parsed again where they are referred to.
+  for (int i = num_dimensions - 1; i > 0; --i) {
+    if (i < kMaxDimensions) {
+      AddTypeSubstitution(state, -1, arrays[i]);
+    } else {
+      AddSubstitution(state, -1);
+    }
+  }
+  state->type_hole = declarator;
+  return true;
+}
+
 // <pointer-to-member-type> ::= M <(class) type> <(member) type>
+// If the types are printed, a pointer to member function is printed around
+// the class, e.g. "void (A::*)(int) const" for M1AKFviE, and a pointer to
+// data member like "int A::*" for M1Ai.
 static bool ParsePointerToMemberType(State* state) {
   State copy = *state;
-  if (ParseOneCharToken(state, 'M') && ParseType(state) && ParseType(state)) {
-    return true;
+  if (!ShouldPrintTypes(state)) {
+    if (ParseOneCharToken(state, 'M') && ParseType(state) &&
+        ParseType(state)) {
+      return true;
+    }
+    *state = copy;
+    return false;
+  }
+
+  // Look ahead to see if the member is a function.
+  if (!(ParseOneCharToken(state, 'M') && DisableAppend(state) &&
+        ParseType(state))) {
+    *state = copy;
+    return false;
+  }
+  ParseCVQualifiers(state, NULL);
+  const bool is_function = Peek(state, 0) == 'F';
+  *state = copy;
+
+  const int begin = OutputOffset(state);
+  int qualifiers = 0;
+  if (is_function && ParseOneCharToken(state, 'M') &&
+      MaybeAppend(state, "(") && ParseType(state) &&
+      MaybeAppend(state, "::*")) {
+    // The declarator of an enclosing type goes after "::*".
+    const int hole = OutputOffset(state) - begin;
+    if (MaybeAppend(state, ")") &&
+        Optional(ParseCVQualifiers(state, &qualifiers)) &&
+        ParseFunctionTypeWithDeclarator(state, begin)) {
+      MaybeAppendQualifiers(state, qualifiers);
+      state->type_hole += hole;
+      // The function type, and the cv-qualified one, are not printed as a
+      // whole.
+      AddSubstitution(state, -1);
+      if (qualifiers != 0) {
+        AddSubstitution(state, -1);
+      }
+      return true;
+    }
+  }
+  *state = copy;
+
+  if (!is_function && ParseOneCharToken(state, 'M') && ParseType(state) &&
+      MaybeAppend(state, "::*")) {
+    const int member_begin = OutputOffset(state);
+    if (ParseType(state) && MaybeAppend(state, " ")) {
+      RotateOutput(state, begin, member_begin);
+      state->type_hole = -1;
+      return true;
+    }
   }
   *state = copy;
   return false;
@@ -978,63 +2406,154 @@ static bool ParsePointerToMemberType(State* state) {
 
 // <template-param> ::= T_
 //                  ::= T <parameter-2 non-negative number> _
+// It is printed as the template argument it refers to if the types are
+// printed, and as "?" otherwise.
 static bool ParseTemplateParam(State* state) {
   if (ParseTwoCharToken(state, "T_")) {
-    MaybeAppend(state, "?");  // We don't support template substitutions.
+    MaybeAppendTemplateArg(state, 0);
     return true;
   }
 
   State copy = *state;
-  if (ParseOneCharToken(state, 'T') && ParseNumber(state, NULL) &&
-      ParseOneCharToken(state, '_')) {
-    MaybeAppend(state, "?");  // We don't support template substitutions.
+  int number = -1;
+  if (ParseOneCharToken(state, 'T') && ParseNumber(state, &number) &&
+      number >= 0 && ParseOneCharToken(state, '_')) {
+    // Any number past the table is unknown; don't let "number + 1" overflow.
+    MaybeAppendTemplateArg(
+        state, number < kMaxTemplateArgs ? number + 1 : kMaxTemplateArgs);
     return true;
   }
   *state = copy;
   return false;
 }
 
-// <template-template-param> ::= <template-param>
-//                           ::= <substitution>
-static bool ParseTemplateTemplateParam(State* state) {
-  return (ParseTemplateParam(state) || ParseSubstitution(state));
-}
-
 // <template-args> ::= I <template-arg>+ E
+// The arguments of the name of the encoding, i.e. those not nested in other
+// <template-args> or in the function signature, are recorded in the
+// template argument table for <template-param>s.
 static bool ParseTemplateArgs(State* state) {
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
+  }
   State copy = *state;
-  DisableAppend(state);
-  if (ParseOneCharToken(state, 'I') && OneOrMore(ParseTemplateArg, state) &&
-      ParseOneCharToken(state, 'E')) {
-    RestoreAppend(state, copy.append);
-    MaybeAppend(state, "<>");
+  if (!ShouldPrintTypes(state)) {
+    DisableAppend(state);
+    if (ParseOneCharToken(state, 'I') && OneOrMore(ParseTemplateArg, state) &&
+        ParseOneCharToken(state, 'E')) {
+      RestoreAppend(state, copy.append);
+      MaybeAppend(state, "<>");
+      MaybeAddComponent(state, kComponentTemplateArgs,
+                        OutputOffset(state) - 2);
+      state->name_has_template_args = true;
+      return true;
+    }
+    *state = copy;
+    return false;
+  }
+  // In compact mode, the <template-args> nested too deep are parsed without
+  // output, so that their text is never generated, and printed as "<...>".
+  Context* const context = state->context;
+  const bool elide = context->max_template_depth >= 0 &&
+                     context->template_args_nesting >=
+                         context->max_template_depth;
+  NestingGuard template_args_nesting(&context->template_args_nesting);
+  if (context->max_template_args_nesting < context->template_args_nesting) {
+    context->max_template_args_nesting = context->template_args_nesting;
+  }
+  const bool record = !state->in_args_or_signature;
+  state->in_args_or_signature = true;
+  const int begin = OutputOffset(state);
+  if (elide) {
+    DisableAppend(state);
+  }
+  if (ParseOneCharToken(state, 'I') && Peek(state, 0) != 'E' &&
+      MaybeAppend(state, "<") && ParseTemplateArgList(state, record) &&
+      ParseOneCharToken(state, 'E') && MaybeAppend(state, ">")) {
+    state->in_args_or_signature = copy.in_args_or_signature;
+    if (elide) {
+      RestoreAppend(state, copy.append);
+      MaybeAppend(state, "<...>");
+    }
+    // Skip the space that separates "<" from a preceding '<', if any.
+    MaybeAddComponent(state, kComponentTemplateArgs,
+                      OutputCharAt(state, begin) == ' ' ? begin + 1 : begin);
+    // The arguments are not names, e.g. for ctors/dtors.
+    state->prev_name = copy.prev_name;
+    state->prev_name_length = copy.prev_name_length;
+    state->name_is_ctor_or_conversion = copy.name_is_ctor_or_conversion;
+    state->name_has_template_args = true;
     return true;
   }
   *state = copy;
   return false;
 }
 
+// <template-arg>* up to the terminating E, printed separated by ", ". If
+// "record" is true, they replace the arguments in the template argument
+// table.
+static bool ParseTemplateArgList(State* state, bool record) {
+  if (record) {
+    state->num_template_args = 0;
+  }
+  int num_args = 0;
+  while (Peek(state, 0) != 'E') {
+    if (num_args > 0) {
+      MaybeAppend(state, ", ");
+    }
+    const int begin = OutputOffset(state);
+    if (!ParseTemplateArg(state)) {
+      return false;
+    }
+    if (record) {
+      AddTemplateArg(state, begin);
+    }
+    ++num_args;
+  }
+  return true;
+}
+
 // <template-arg>  ::= <type>
 //                 ::= <expr-primary>
 //                 ::= I <template-arg>* E        # argument pack
 //                 ::= J <template-arg>* E        # argument pack
 //                 ::= X <expression> E
 static bool ParseTemplateArg(State* state) {
-  State copy = *state;
-  if ((ParseOneCharToken(state, 'I') || ParseOneCharToken(state, 'J')) &&
-      ZeroOrMore(ParseTemplateArg, state) && ParseOneCharToken(state, 'E')) {
-    return true;
-  }
-  *state = copy;
-
-  if (ParseType(state) || ParseExprPrimary(state)) {
-    return true;
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
   }
-  *state = copy;
-
-  if (ParseOneCharToken(state, 'X') && ParseExpression(state) &&
-      ParseOneCharToken(state, 'E')) {
-    return true;
+  State copy = *state;
+  switch (Peek(state, 0)) {
+    case 'I':
+    case 'J':
+      ++state->mangled_cur;
+      if ((ShouldPrintTypes(state) ? ParseTemplateArgList(state, false)
+                                   : ZeroOrMore(ParseTemplateArg, state)) &&
+          ParseOneCharToken(state, 'E')) {
+        state->type_hole = -1;
+        return true;
+      }
+      break;
+    case 'X':
+      ++state->mangled_cur;
+      if (ParseExpression(state) && ParseOneCharToken(state, 'E')) {
+        state->type_hole = -1;
+        return true;
+      }
+      break;
+    case 'L':
+      // <expr-primary>, less greedy than a <type> of <local-source-name>.
+      if (ParseType(state)) {
+        return true;
+      }
+      if (ParseExprPrimary(state)) {
+        state->type_hole = -1;
+        return true;
+      }
+      return false;
+    default:
+      return ParseType(state);
   }
   *state = copy;
   return false;
@@ -1050,42 +2569,93 @@ static bool ParseTemplateArg(State* state) {
 //              ::= sr <type> <unqualified-name> <template-args>
 //              ::= sr <type> <unqualified-name>
 static bool ParseExpression(State* state) {
-  if (ParseTemplateParam(state) || ParseExprPrimary(state)) {
-    return true;
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
   }
-
-  State copy = *state;
-  if (ParseOperatorName(state) && ParseExpression(state) &&
-      ParseExpression(state) && ParseExpression(state)) {
-    return true;
+  switch (Peek(state, 0)) {
+    case 'T':
+      return ParseTemplateParam(state);
+    case 'L':
+      return ParseExprPrimary(state);
   }
-  *state = copy;
-
-  if (ParseOperatorName(state) && ParseExpression(state) &&
-      ParseExpression(state)) {
+  if (ParseOperatorExpression(state)) {
     return true;
   }
-  *state = copy;
 
+  // The operator name is parsed once for up to three expressions, with the
+  // greedier first.
+  State copy = *state;
   if (ParseOperatorName(state) && ParseExpression(state)) {
+    if (ParseExpression(state)) {
+      Optional(ParseExpression(state));
+    }
     return true;
   }
   *state = copy;
 
-  if (ParseTwoCharToken(state, "st") && ParseType(state)) {
+  if (ParseTwoCharToken(state, "st") &&
+      MaybeAppendTypeText(state, "sizeof (") && ParseType(state) &&
+      MaybeAppendTypeText(state, ")")) {
     return true;
   }
   *state = copy;
 
   if (ParseTwoCharToken(state, "sr") && ParseType(state) &&
-      ParseUnqualifiedName(state) && ParseTemplateArgs(state)) {
+      MaybeAppendTypeText(state, "::") && ParseUnqualifiedName(state)) {
+    // Less greedy than sr <type> <unqualified-name> <template-args>.
+    Optional(ParseTemplateArgs(state));
     return true;
   }
   *state = copy;
+  return false;
+}
 
-  if (ParseTwoCharToken(state, "sr") && ParseType(state) &&
-      ParseUnqualifiedName(state)) {
-    return true;
+// <operator-name> <expression>+, printed like c++filt if the types are
+// printed, e.g. "(1)+(2)" for plLi1ELi2E and "&g" for adL_Z1gE. The number
+// of expressions is the arity of the operator. Cast and vendor extended
+// operators, and those of arity 0, are left to ParseExpression().
+static bool ParseOperatorExpression(State* state) {
+  if (!ShouldPrintTypes(state) ||
+      !AtLeastNumCharsRemaining(state, 2)) {
+    return false;
+  }
+  const AbbrevPair* p =
+      LookUpCode(kOperatorList, kOperatorIndex,
+                 TwoLetterKey(Peek(state, 0), Peek(state, 1)));
+  if (p == NULL) {
+    return false;
+  }
+  const char* const op = p->real_name;
+  State copy = *state;
+  state->mangled_cur += 2;
+  switch (p->arity) {
+    case 1:
+      // Operators like sizeof are followed by a space and parentheses.
+      if (MaybeAppend(state, op) &&
+          (!IsLower(op[0]) || MaybeAppend(state, " (")) &&
+          ParseExpression(state) &&
+          (!IsLower(op[0]) || MaybeAppend(state, ")"))) {
+        return true;
+      }
+      break;
+    case 2:
+      if (MaybeAppend(state, "(") && ParseExpression(state) &&
+          MaybeAppend(state, ")") && MaybeAppend(state, op) &&
+          MaybeAppend(state, "(") && ParseExpression(state) &&
+          MaybeAppend(state, ")")) {
+        return true;
+      }
+      break;
+    case 3:
+      if (MaybeAppend(state, "(") && ParseExpression(state) &&
+          MaybeAppend(state, ")") && MaybeAppend(state, op) &&
+          MaybeAppend(state, "(") && ParseExpression(state) &&
+          MaybeAppend(state, "):(") && ParseExpression(state) &&
+          MaybeAppend(state, ")")) {
+        return true;
+      }
+      break;
   }
   *state = copy;
   return false;
@@ -1097,31 +2667,98 @@ static bool ParseExpression(State* state) {
 //                // A bug in g++'s C++ ABI version 2 (-fabi-version=2).
 //                ::= LZ <encoding> E
 static bool ParseExprPrimary(State* state) {
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
+  }
   State copy = *state;
-  if (ParseOneCharToken(state, 'L') && ParseType(state) &&
-      ParseNumber(state, NULL) && ParseOneCharToken(state, 'E')) {
-    return true;
+  if (!ParseOneCharToken(state, 'L')) {
+    return false;
+  }
+  switch (Peek(state, 0)) {
+    case '_':
+      if (ParseMangledName(state) && ParseOneCharToken(state, 'E')) {
+        return true;
+      }
+      break;
+    case 'Z':
+      ++state->mangled_cur;
+      if (ParseEncoding(state) && ParseOneCharToken(state, 'E')) {
+        return true;
+      }
+      break;
+    default:
+      if (ShouldPrintTypes(state)) {
+        if (ParseLiteralValue(state) && ParseOneCharToken(state, 'E')) {
+          return true;
+        }
+        break;
+      }
+      // The number and the float share the type, and a float may start
+      // with digits, e.g. 3f800000.
+      if (ParseType(state)) {
+        const char* const value = state->mangled_cur;
+        if (ParseNumber(state, NULL) && ParseOneCharToken(state, 'E')) {
+          return true;
+        }
+        state->mangled_cur = value;
+        if (ParseFloatNumber(state) && ParseOneCharToken(state, 'E')) {
+          return true;
+        }
+      }
+      break;
   }
   *state = copy;
+  return false;
+}
 
-  if (ParseOneCharToken(state, 'L') && ParseType(state) &&
-      ParseFloatNumber(state) && ParseOneCharToken(state, 'E')) {
+// <type> <(value) number> and <type> <(value) float> of <expr-primary>,
+// printed like c++filt, e.g. "5" for i5, "-5l" for ln5, "true" for b1 and
+// "(char)65" for c65.
+static bool ParseLiteralValue(State* state) {
+  State copy = *state;
+  if (Peek(state, 0) == 'b' &&
+      (Peek(state, 1) == '0' || Peek(state, 1) == '1') &&
+      Peek(state, 2) == 'E') {
+    MaybeAppend(state, Peek(state, 1) == '1' ? "true" : "false");
+    state->mangled_cur += 2;
     return true;
   }
-  *state = copy;
 
-  if (ParseOneCharToken(state, 'L') && ParseMangledName(state) &&
-      ParseOneCharToken(state, 'E')) {
-    return true;
+  const AbbrevPair* suffix;
+  for (suffix = kIntegerLiteralSuffixList; suffix->abbrev != NULL;
+       ++suffix) {
+    if (Peek(state, 0) == suffix->abbrev[0]) {
+      break;
+    }
+  }
+  if (suffix->abbrev != NULL) {
+    ++state->mangled_cur;
+  } else if (!(MaybeAppend(state, "(") && ParseType(state) &&
+               MaybeAppend(state, ")"))) {
+    *state = copy;
+    return false;
   }
-  *state = copy;
 
-  if (ParseTwoCharToken(state, "LZ") && ParseEncoding(state) &&
-      ParseOneCharToken(state, 'E')) {
+  const char* value = state->mangled_cur;
+  // A float may start with digits, e.g. 3f800000.
+  if (ParseNumber(state, NULL) && Peek(state, 0) == 'E') {
+    if (value[0] == 'n') {
+      MaybeAppend(state, "-");
+      ++value;
+    }
+    MaybeAppendWithLength(state, value, state->mangled_cur - value);
+    if (suffix->abbrev != NULL) {
+      MaybeAppend(state, suffix->real_name);
+    }
+    return true;
+  }
+  state->mangled_cur = value;
+  if (suffix->abbrev == NULL && ParseFloatNumber(state)) {
+    MaybeAppendWithLength(state, value, state->mangled_cur - value);
     return true;
   }
   *state = copy;
-
   return false;
 }
 
@@ -1129,17 +2766,24 @@ static bool ParseExprPrimary(State* state) {
 //                 [<discriminator>]
 //              := Z <(function) encoding> E s [<discriminator>]
 static bool ParseLocalName(State* state) {
+  BudgetGuard guard(state);
+  if (guard.IsOverBudget()) {
+    return false;
+  }
   State copy = *state;
   if (ParseOneCharToken(state, 'Z') && ParseEncoding(state) &&
-      ParseOneCharToken(state, 'E') && MaybeAppend(state, "::") &&
-      ParseName(state) && Optional(ParseDiscriminator(state))) {
-    return true;
-  }
-  *state = copy;
+      ParseOneCharToken(state, 'E')) {
+    // The encoding is parsed once for both alternatives.
+    State encoding = *state;
+    if (MaybeAppend(state, "::") && ParseName(state) &&
+        Optional(ParseDiscriminator(state))) {
+      return true;
+    }
+    *state = encoding;
 
-  if (ParseOneCharToken(state, 'Z') && ParseEncoding(state) &&
-      ParseTwoCharToken(state, "Es") && Optional(ParseDiscriminator(state))) {
-    return true;
+    if (ParseOneCharToken(state, 's') && Optional(ParseDiscriminator(state))) {
+      return true;
+    }
   }
   *state = copy;
   return false;
@@ -1155,36 +2799,80 @@ static bool ParseDiscriminator(State* state) {
   return false;
 }
 
+// A <type> that was not output, e.g. as it was nested too deep in
+// <template-args> in compact mode, or whose span was dropped by
+// RotateOutputAtHole(), may be referred to where it is printed, e.g. by a
+// parameter. Then it is parsed again from the mangled name, so that its
+// text is printed instead of "..." or "?". The substitution candidates in it are
+// already numbered, so only the output is kept. Returns false if the
+// substitution numbered "index" is not such a type, or if it can not be
+// parsed again.
+static bool MaybeParseElidedSubstitution(State* state, int index) {
+  if (!ShouldPrintTypes(state) || !state->append || index < 0 ||
+      index >= state->num_substitutions || index >= kMaxSubstitutions) {
+    return false;
+  }
+  const Substitution& subst = state->context->substitutions[index];
+  if (subst.begin >= 0 || subst.mangled_begin == NULL) {
+    return false;
+  }
+  State copy = *state;
+  const char* const mangled_end = subst.mangled_end;
+  state->mangled_cur = subst.mangled_begin;
+  if (!ParseType(state) || state->mangled_cur != mangled_end) {
+    *state = copy;
+    return false;
+  }
+  State parsed = *state;
+  *state = copy;
+  state->out_cur = parsed.out_cur;
+  state->type_hole = parsed.type_hole;
+  for (int i = 0; i < kOverflowTailSize; ++i) {
+    state->overflow_tail[i] = parsed.overflow_tail[i];
+  }
+  // For ctors/dtors, as MaybeAppendSubstitution() does.
+  if (parsed.prev_name >= copy.out_cur) {
+    state->prev_name = parsed.prev_name;
+    state->prev_name_length = parsed.prev_name_length;
+  }
+  return true;
+}
+
 // <substitution> ::= S_
 //                ::= S <seq-id> _
 //                ::= St, etc.
 static bool ParseSubstitution(State* state) {
   if (ParseTwoCharToken(state, "S_")) {
-    MaybeAppend(state, "?");  // We don't support substitutions.
+    if (!MaybeParseElidedSubstitution(state, 0)) {
+      MaybeAppendSubstitution(state, 0);
+    }
     return true;
   }
 
   State copy = *state;
-  if (ParseOneCharToken(state, 'S') && ParseSeqId(state) &&
+  int seq_id = -1;
+  if (ParseOneCharToken(state, 'S') && ParseSeqId(state, &seq_id) &&
       ParseOneCharToken(state, '_')) {
-    MaybeAppend(state, "?");  // We don't support substitutions.
+    // The seq-id is one less than the index.
+    if (!MaybeParseElidedSubstitution(state, seq_id + 1)) {
+      MaybeAppendSubstitution(state, seq_id + 1);
+    }
     return true;
   }
   *state = copy;
 
   // Expand abbreviations like "St" => "std".
   if (ParseOneCharToken(state, 'S')) {
-    const AbbrevPair* p;
-    for (p = kSubstitutionList; p->abbrev != NULL; ++p) {
-      if (state->mangled_cur[0] == p->abbrev[1]) {
-        MaybeAppend(state, "std");
-        if (p->real_name[0] != '\0') {
-          MaybeAppend(state, "::");
-          MaybeAppend(state, p->real_name);
-        }
-        ++state->mangled_cur;
-        return true;
+    const AbbrevPair* p = LookUpCode(kSubstitutionList, kSubstitutionIndex,
+                                     OneLetterKey(Peek(state, 0)));
+    if (p != NULL) {
+      MaybeAppend(state, "std");
+      if (p->real_name_length > 0) {
+        MaybeAppend(state, "::");
+        MaybeAppendWithLength(state, p->real_name, p->real_name_length);
       }
+      ++state->mangled_cur;
+      return true;
     }
   }
   *state = copy;
@@ -1195,14 +2883,16 @@ static bool ParseSubstitution(State* state) {
 // or version suffix.  Returns true only if all of "mangled_cur" was consumed.
 static bool ParseTopLevelMangledName(State* state) {
   if (ParseMangledName(state)) {
-    if (state->mangled_cur[0] != '\0') {
+    if (Peek(state, 0) != '\0') {
       // Drop trailing function clone suffix, if any.
-      if (IsFunctionCloneSuffix(state->mangled_cur)) {
+      if (IsFunctionCloneSuffix(state->mangled_cur,
+                                NumCharsRemaining(state))) {
         return true;
       }
       // Append trailing version suffix if any, e.g. _Z3foo@@GLIBCXX_3.4
-      if (state->mangled_cur[0] == '@') {
-        MaybeAppend(state, state->mangled_cur);
+      if (Peek(state, 0) == '@') {
+        MaybeAppendWithLength(state, state->mangled_cur,
+                              NumCharsRemaining(state));
         return true;
       }
       return false;  // Unconsumed suffix.
@@ -1212,12 +2902,595 @@ static bool ParseTopLevelMangledName(State* state) {
   return false;
 }
 
-// The demangler entry point.
-EXPORT bool Demangle(const char* symbol, char* buffer, size_t buffer_size) {
+// Initializes the context of a call, i.e. the end of the mangled name, the
+// budget given by the limits (NULL for the default limits) and the lowest
+// address of the stack to use (0 for no limit). No components are recorded
+// unless the caller sets the component list, and nothing is elided unless
+// the caller sets the limits of compact mode.
+static void InitContext(Context* context,
+                        const char* mangled_end,
+                        const DemangleLimits* limits,
+                        uintptr_t stack_limit) {
+  context->mangled_end = mangled_end;
+  context->steps = 0;
+  context->depth = 0;
+  context->max_steps =
+      limits ? limits->max_steps : DemangleLimits::kDefaultMaxSteps;
+  context->max_depth =
+      limits ? limits->max_depth : DemangleLimits::kDefaultMaxDepth;
+  context->stack_limit = stack_limit;
+  context->over_budget = false;
+  context->components = NULL;
+  context->max_components = 0;
+  context->type_nesting = 0;
+  context->template_args_nesting = 0;
+  context->max_template_args_nesting = 0;
+  context->max_template_depth = -1;
+  context->elide_signatures = false;
+}
+
+// Parses the mangled name of the state, and returns true on success, i.e.
+// if it is valid and the output fits into the buffer. If "required_size" is
+// not NULL, it is set to the size of the buffer needed by the output,
+// including '\0', or to 0 if the mangled name is not valid.
+static bool Parse(State* state, size_t* required_size) {
+  const bool valid =
+      ParseTopLevelMangledName(state) && !state->context->over_budget;
+  if (required_size != NULL) {
+    *required_size = valid ? OutputOffset(state) + 1 : 0;
+  }
+  if (!valid || !IsWritten(state, state->out_cur)) {
+    return false;
+  }
+  // An alternative that did not match may have left its output after the
+  // cursor, e.g. "::" of Z <encoding> E <name> before Z <encoding> E s.
+  state->context->out_begin[state->out_cur] = '\0';
+  return true;
+}
+
+// Returns true if "c" may be in an identifier.
+static bool IsIdentifierChar(char c) {
+  return IsAlpha(c) || IsDigit(c) || c == '_';
+}
+
+// Returns true if "text", which has "length" characters, has "prefix" at
+// offset "pos".
+static bool HasPrefixAt(const char* text, int length, int pos,
+                        const char* prefix) {
+  int i = 0;
+  while (prefix[i] != '\0' && CharAt(text, length, pos + i) == prefix[i]) {
+    ++i;
+  }
+  return prefix[i] == '\0';
+}
+
+// Returns true if a name may begin at offset "pos" of "text", i.e. it does
+// not continue an identifier or a qualified name.
+static bool IsNameBoundary(const char* text, int pos) {
+  return pos == 0 || !(IsIdentifierChar(text[pos - 1]) || text[pos - 1] == ':');
+}
+
+// The following functions edit "text", which has "length" characters, in
+// place, and return its new length, which is not greater. Each one copies
+// the text to itself once, skipping what is dropped.
+
+// Drops the inline namespaces, e.g. "__cxx11::" in "std::__cxx11::list".
+static int DropInlineNamespaces(char* text, int length) {
+  int out = 0;
+  int in = 0;
+  while (in < length) {
+    if (out >= 2 && text[out - 2] == ':' && text[out - 1] == ':' &&
+        text[in] == '_') {
+      const char* const* p = kStdInlineNamespaceList;
+      while (*p != NULL && !HasPrefixAt(text, length, in, *p)) {
+        ++p;
+      }
+      if (*p != NULL) {
+        in += StrLen(*p);
+        continue;
+      }
+    }
+    if (out != in) {
+      text[out] = text[in];
+    }
+    ++out;
+    ++in;
+  }
+  return out;
+}
+
+// Returns the template in kStdTemplateDefaultsList whose name ends at offset
+// "end" of "text", i.e. before its '<', or NULL if none.
+static const StdTemplateDefaults* FindStdTemplateDefaults(const char* text,
+                                                          int end) {
+  int begin = end;
+  while (begin > 0 && IsIdentifierChar(text[begin - 1])) {
+    --begin;
+  }
+  if (begin < 5 || !HasPrefixAt(text, end, begin - 5, "std::") ||
+      !IsNameBoundary(text, begin - 5)) {
+    return NULL;
+  }
+  for (const StdTemplateDefaults* t = kStdTemplateDefaultsList;
+       t->name != NULL; ++t) {
+    const int name_length = StrLen(t->name);
+    if (name_length == end - begin && HasPrefixAt(text, end, begin, t->name)) {
+      return t;
+    }
+  }
+  return NULL;
+}
+
+// Returns true if the template argument from offset "begin" up to "end" of
+// "text" is the default argument "pattern", given the earlier arguments in
+// "arg_begins" and "arg_ends". The space that separates two '>' is skipped.
+// Template arguments elided as "<...>" in the text are taken to match those
+// of the pattern, e.g. "std::allocator<...>" matches "std::allocator<$0>",
+// as only the name of the template is known.
+static bool IsDefaultTemplateArg(const char* text,
+                                 int begin,
+                                 int end,
+                                 const char* pattern,
+                                 const int* arg_begins,
+                                 const int* arg_ends) {
+  int pos = begin;
+  for (const char* p = pattern; *p != '\0'; ++p) {
+    if (*p == '$') {
+      const int arg = *++p - '0';
+      for (int i = arg_begins[arg]; i < arg_ends[arg]; ++i) {
+        if (pos == end || text[pos++] != text[i]) {
+          return false;
+        }
+      }
+      continue;
+    }
+    if (*p == '<' && HasPrefixAt(text, end, pos, "<...>")) {
+      for (int nesting = 1; nesting > 0;) {
+        ++p;
+        nesting += *p == '<' ? 1 : *p == '>' ? -1 : 0;
+      }
+      pos += StrLen("<...>");
+      continue;
+    }
+    if (*p == '>' && pos + 1 < end && text[pos] == ' ' &&
+        text[pos - 1] == '>') {
+      ++pos;
+    }
+    if (pos == end || text[pos++] != *p) {
+      return false;
+    }
+  }
+  return pos == end;
+}
+
+// An open '<' seen by DropDefaultTemplateArgs(): the template, if it is in
+// kStdTemplateDefaultsList, and the offsets of the ',' between its
+// arguments so far.
+struct OpenTemplateArgs {
+  const StdTemplateDefaults* std_template;
+  int begin;  // Offset after the '<'.
+  int num_commas;
+  int commas[kMaxStdTemplateArgs - 1];
+};
+
+// The depth of the template arguments tracked by DropDefaultTemplateArgs().
+static const int kMaxOpenTemplateArgs = 16;
+
+// Drops the last arguments of the std templates in kStdTemplateDefaultsList
+// that are their defaults, e.g. ", std::allocator<int>" in
+// "std::vector<int, std::allocator<int> >". The arguments of a template are
+// checked when its '>' is reached, so that their own default arguments are
+// already dropped, as are those of the defaults compared with them.
+static int DropDefaultTemplateArgs(char* text, int length) {
+  OpenTemplateArgs open[kMaxOpenTemplateArgs];
+  int num_open = 0;
+  int num_untracked = 0;  // The '<' open beyond kMaxOpenTemplateArgs.
+  int out = 0;
+  int in = 0;
+  while (in < length) {
+    const char c = text[in];
+    // The '<', '>' and ',' of operator names are not those of arguments.
+    if (c == 'o' && IsNameBoundary(text, out) &&
+        HasPrefixAt(text, length, in, "operator")) {
+      const int operator_end = in + StrLen("operator");
+      while (in < operator_end ||
+             (in < length && (text[in] == '<' || text[in] == '>' ||
+                              text[in] == '=' || text[in] == '-' ||
+                              text[in] == ','))) {
+        text[out++] = text[in++];
+      }
+      continue;
+    }
+    if (c == '<') {
+      if (num_open < kMaxOpenTemplateArgs && num_untracked == 0) {
+        OpenTemplateArgs* args = &open[num_open++];
+        args->std_template = FindStdTemplateDefaults(text, out);
+        args->begin = out + 1;
+        args->num_commas = 0;
+      } else {
+        ++num_untracked;
+      }
+    } else if (c == ',' && num_open > 0 && num_untracked == 0) {
+      OpenTemplateArgs* args = &open[num_open - 1];
+      if (args->num_commas < kMaxStdTemplateArgs - 1) {
+        args->commas[args->num_commas++] = out;
+      } else {
+        args->std_template = NULL;  // Too many arguments to be one.
+      }
+    } else if (c == '>' && num_untracked > 0) {
+      --num_untracked;
+    } else if (c == '>' && num_open > 0) {
+      const OpenTemplateArgs& args = open[--num_open];
+      const StdTemplateDefaults* t = args.std_template;
+      int num_args = args.num_commas + 1;
+      if (t != NULL && num_args <= t->num_required_args + 3) {
+        int arg_begins[kMaxStdTemplateArgs];
+        int arg_ends[kMaxStdTemplateArgs];
+        for (int i = 0; i < num_args; ++i) {
+          arg_begins[i] = i == 0 ? args.begin : args.commas[i - 1] + 1;
+          if (text[arg_begins[i]] == ' ') {
+            ++arg_begins[i];
+          }
+          arg_ends[i] = i + 1 < num_args ? args.commas[i] : out;
+          if (arg_ends[i] > arg_begins[i] && text[arg_ends[i] - 1] == ' ') {
+            --arg_ends[i];  // The space before '>'.
+          }
+        }
+        const int all_args = num_args;
+        while (num_args > t->num_required_args &&
+               IsDefaultTemplateArg(
+                   text, arg_begins[num_args - 1], arg_ends[num_args - 1],
+                   t->default_args[num_args - 1 - t->num_required_args],
+                   arg_begins, arg_ends)) {
+          --num_args;
+        }
+        if (num_args < all_args) {
+          // There is room for " >", as a dropped argument is longer.
+          out = args.commas[num_args - 1];
+          if (text[out - 1] == '>') {
+            text[out++] = ' ';
+          }
+          text[out++] = '>';
+          ++in;
+          continue;
+        }
+      }
+    }
+    text[out++] = text[in++];
+  }
+  return out;
+}
+
+// Abbreviates the well-known std types, e.g. "std::basic_string<char>".
+static int AbbreviateStdTypes(char* text, int length) {
+  int out = 0;
+  int in = 0;
+  while (in < length) {
+    if (text[in] == 's' && IsNameBoundary(text, out) &&
+        HasPrefixAt(text, length, in, "std::basic_")) {
+      const AbbrevPair* p = kStdTypeList;
+      while (p->abbrev != NULL &&
+             !HasPrefixAt(text, length, in, p->real_name)) {
+        ++p;
+      }
+      if (p->abbrev != NULL) {
+        in += StrLen(p->real_name);
+        // The abbreviation is shorter, so it does not overwrite the rest.
+        for (const char* c = p->abbrev; *c != '\0'; ++c) {
+          text[out++] = *c;
+        }
+        // The space only separated the '>' of the type from the next.
+        if (CharAt(text, length, in) == ' ' &&
+            CharAt(text, length, in + 1) == '>') {
+          ++in;
+        }
+        continue;
+      }
+    }
+    if (out != in) {
+      text[out] = text[in];
+    }
+    ++out;
+    ++in;
+  }
+  return out;
+}
+
+// Abbreviates the std names of the demangled name: the inline namespaces
+// are dropped first, then the default template arguments, so that the
+// well-known types are left with their first arguments only. The text is
+// edited after parsing, as the spans of substitutions and template
+// arguments that refer to it are only valid during parsing.
+static int AbbreviateStdNames(char* text, int length) {
+  length = DropInlineNamespaces(text, length);
+  length = DropDefaultTemplateArgs(text, length);
+  return AbbreviateStdTypes(text, length);
+}
+
+// Demangles the symbol in compact mode, see DemangleCompact(). Each pass
+// parses the symbol again, more compactly than the last one, until the name
+// fits the width: with one level of <template-args> less each time, then
+// with the function signatures elided, then with the names only, which are
+// cut at the width as the last resort.
+static bool DemangleCompactly(const char* symbol,
+                              size_t symbol_length,
+                              char* buffer,
+                              size_t buffer_size,
+                              int max_template_depth,
+                              size_t max_width,
+                              const DemangleLimits* limits) {
+  if (buffer_size == 0) {
+    return false;
+  }
+  if (max_width > buffer_size - 1) {
+    max_width = buffer_size - 1;
+  }
+  const char* const symbol_end = symbol + StrNLen(symbol, symbol_length);
+  int depth = max_template_depth > 0 ? max_template_depth : 0;
+  bool elide_signatures = false;
+  while (true) {
+    State state;
+    Context context;
+    InitContext(&context, symbol_end, limits, /*stack_limit=*/0);
+    const bool names_only = elide_signatures && depth < 0;
+    if (!names_only) {
+      context.max_template_depth = depth;
+      context.elide_signatures = elide_signatures;
+    }
+    InitState(&state, /*mangled=*/symbol, /*out=*/buffer,
+              /*out_size=*/buffer_size, &context,
+              names_only ? kDemangleNamesOnly : kDemangleCompact);
+    if (!ParseTopLevelMangledName(&state) || context.over_budget) {
+      return false;
+    }
+    // The output is not valid if it overflowed the buffer, except with the
+    // names only, which are never rotated, so it is cut at the end.
+    const bool overflowed = !IsWritten(&state, state.out_cur);
+    if (!overflowed || names_only) {
+      int length = AbbreviateStdNames(
+          buffer, overflowed ? context.out_capacity : state.out_cur);
+      if (length <= static_cast<int>(max_width) && !overflowed) {
+        buffer[length] = '\0';
+        return true;
+      }
+      if (names_only) {
+        length = max_width;
+        if (max_width >= 3) {
+          buffer[--length] = '.';
+          buffer[--length] = '.';
+          buffer[--length] = '.';
+        }
+        buffer[max_width] = '\0';
+        return true;
+      }
+    }
+    // Skip the depths the name does not reach.
+    if (depth > context.max_template_args_nesting) {
+      depth = context.max_template_args_nesting;
+    }
+    if (depth > 0) {
+      --depth;
+    } else if (!elide_signatures) {
+      elide_signatures = true;
+    } else {
+      depth = -1;
+    }
+  }
+}
+
+// The demangler entry point. If "required_size" is not NULL, it is set as
+// Parse() does. A name in compact mode is made to fit, so the size it needs
+// is the size of the name in the buffer.
+static bool DemangleSymbol(const char* symbol,
+                           size_t symbol_length,
+                           char* buffer,
+                           size_t buffer_size,
+                           size_t* required_size,
+                           int flags,
+                           const DemangleLimits* limits) {
+  if (flags & kDemangleCompact) {
+    const bool ok =
+        DemangleCompactly(symbol, symbol_length, buffer, buffer_size,
+                          kDemangleCompactTemplateDepth,
+                          buffer_size > 0 ? buffer_size - 1 : 0, limits);
+    if (required_size != NULL) {
+      *required_size = ok ? StrLen(buffer) + 1 : 0;
+    }
+    return ok;
+  }
   State state;
+  Context context;
+  // The symbol ends at the first '\0', if any, so that the parser never
+  // sees '\0' before the end.
+  InitContext(&context, symbol + StrNLen(symbol, symbol_length), limits,
+              /*stack_limit=*/0);
   InitState(&state, /*mangled=*/symbol, /*out=*/buffer,
-            /*out_size=*/buffer_size);
-  return ParseTopLevelMangledName(&state) && !state.overflowed;
+            /*out_size=*/buffer_size, &context, flags);
+  return Parse(&state, required_size);
+}
+
+EXPORT bool Demangle(const char* symbol,
+                     size_t symbol_length,
+                     char* buffer,
+                     size_t buffer_size,
+                     int flags,
+                     const DemangleLimits* limits) {
+  return DemangleSymbol(symbol, symbol_length, buffer, buffer_size,
+                        /*required_size=*/NULL, flags, limits);
+}
+
+EXPORT bool Demangle(const char* symbol,
+                     char* buffer,
+                     size_t buffer_size,
+                     int flags,
+                     const DemangleLimits* limits) {
+  return DemangleSymbol(symbol, StrLen(symbol), buffer, buffer_size,
+                        /*required_size=*/NULL, flags, limits);
+}
+
+EXPORT bool Demangle(const char* symbol,
+                     char* buffer,
+                     size_t buffer_size,
+                     size_t* required_size,
+                     int flags,
+                     const DemangleLimits* limits) {
+  return DemangleSymbol(symbol, StrLen(symbol), buffer, buffer_size,
+                        required_size, flags, limits);
+}
+
+EXPORT bool Demangle(const char* symbol,
+                     OutputSink sink,
+                     void* sink_context,
+                     int flags,
+                     const DemangleLimits* limits) {
+  char buffer[kDemangleSinkBufferSize];
+  if (!DemangleSymbol(symbol, StrLen(symbol), buffer, sizeof(buffer),
+                      /*required_size=*/NULL, flags, limits)) {
+    return false;
+  }
+  const size_t length = StrLen(buffer);
+  if (length > 0) {
+    sink(buffer, length, sink_context);
+  }
+  return true;
+}
+
+EXPORT bool DemangleCompact(const char* symbol,
+                            char* buffer,
+                            size_t buffer_size,
+                            int max_template_depth,
+                            size_t max_width,
+                            const DemangleLimits* limits) {
+  return DemangleCompactly(symbol, StrLen(symbol), buffer, buffer_size,
+                           max_template_depth, max_width, limits);
+}
+
+EXPORT bool DemangleComponents(const char* symbol,
+                               char* buffer,
+                               size_t buffer_size,
+                               DemangleComponent* components,
+                               int max_components,
+                               int* num_components,
+                               int flags,
+                               const DemangleLimits* limits) {
+  State state;
+  Context context;
+  InitContext(&context, symbol + StrLen(symbol), limits, /*stack_limit=*/0);
+  context.components = components;
+  context.max_components = max_components;
+  InitState(&state, /*mangled=*/symbol, /*out=*/buffer,
+            /*out_size=*/buffer_size, &context, flags);
+  const bool ok = Parse(&state, NULL);
+  *num_components = ok ? state.num_components : 0;
+  return ok;
+}
+
+#if defined(OS_LINUX) && (defined(__x86_64__) || defined(__aarch64__))
+
+// Calls func(arg) with the stack pointer set to stack_top, which is aligned
+// to 16 bytes, and switches back to the stack of the caller on return. The
+// frame is described with CFI, so that unwinders can walk from the new
+// stack back to the caller.
+extern "C" void SblzRunOnStack(void* arg,
+                               void (*func)(void*),
+                               void* stack_top);
+
+#if defined(__x86_64__)
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".type SblzRunOnStack, @function\n"
+    "SblzRunOnStack:\n"
+    ".cfi_startproc\n"
+    "  pushq %rbp\n"
+    ".cfi_def_cfa_offset 16\n"
+    ".cfi_offset %rbp, -16\n"
+    "  movq %rsp, %rbp\n"
+    ".cfi_def_cfa_register %rbp\n"
+    "  movq %rdx, %rsp\n"
+    "  callq *%rsi\n"
+    "  movq %rbp, %rsp\n"
+    "  popq %rbp\n"
+    ".cfi_def_cfa %rsp, 8\n"
+    "  retq\n"
+    ".cfi_endproc\n"
+    ".size SblzRunOnStack, .-SblzRunOnStack\n");
+#elif defined(__aarch64__)
+__asm__(
+    ".text\n"
+    ".p2align 2\n"
+    ".type SblzRunOnStack, %function\n"
+    "SblzRunOnStack:\n"
+    ".cfi_startproc\n"
+    "  stp x29, x30, [sp, #-16]!\n"
+    ".cfi_def_cfa_offset 16\n"
+    ".cfi_offset x29, -16\n"
+    ".cfi_offset x30, -8\n"
+    "  mov x29, sp\n"
+    ".cfi_def_cfa_register x29\n"
+    "  mov sp, x2\n"
+    "  blr x1\n"
+    "  mov sp, x29\n"
+    "  ldp x29, x30, [sp], #16\n"
+    ".cfi_def_cfa sp, 0\n"
+    "  ret\n"
+    ".cfi_endproc\n"
+    ".size SblzRunOnStack, .-SblzRunOnStack\n");
+#endif
+
+#define HAVE_RUN_ON_STACK 1
+
+// The argument and the result of Parse() run by SblzRunOnStack().
+struct ParseCall {
+  State* state;
+  bool result;
+};
+
+static void ParseOnStack(void* arg) {
+  ParseCall* call = static_cast<ParseCall*>(arg);
+  call->result = Parse(call->state, NULL);
+}
+
+#endif
+
+EXPORT bool DemangleWithScratch(const char* symbol,
+                                char* buffer,
+                                size_t buffer_size,
+                                void* scratch,
+                                size_t scratch_size,
+                                int flags,
+                                const DemangleLimits* limits) {
+  // The context and the state are at the bottom of the scratch memory, and
+  // the stack is above them.
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(scratch);
+  const uintptr_t end = begin + scratch_size;
+  const uintptr_t context_address = (begin + 15) & ~uintptr_t(15);
+  const uintptr_t state_address = context_address + sizeof(Context);
+  const uintptr_t stack_limit = state_address + sizeof(State);
+  if (scratch == NULL || end < begin || end < stack_limit + kStackReserve) {
+    return false;
+  }
+  Context* context = reinterpret_cast<Context*>(context_address);
+  State* state = reinterpret_cast<State*>(state_address);
+#if defined(HAVE_RUN_ON_STACK)
+  InitContext(context, symbol + StrLen(symbol), limits, stack_limit);
+  InitState(state, /*mangled=*/symbol, /*out=*/buffer,
+            /*out_size=*/buffer_size, context, flags);
+  ParseCall call = {state, false};
+  SblzRunOnStack(&call, ParseOnStack,
+                 reinterpret_cast<void*>(end & ~uintptr_t(15)));
+  return call.result;
+#else
+  // Run on the stack of the caller, but use no more of it than the rest of
+  // the scratch memory.
+  const uintptr_t stack_top = reinterpret_cast<uintptr_t>(&begin);
+  const uintptr_t stack_size = end - stack_limit;
+  InitContext(context, symbol + StrLen(symbol), limits,
+              stack_top > stack_size ? stack_top - stack_size : 0);
+  InitState(state, /*mangled=*/symbol, /*out=*/buffer,
+            /*out_size=*/buffer_size, context, flags);
+  return Parse(state, NULL);
+#endif
 }
 
 }  // namespace itanium
@@ -0,0 +1,28 @@
+// Copyright (c) 2020 Leedehai. All rights reserved.
+// Use of this source code is governed under the LICENSE.txt file.
+
+// The module table kept by symbolizer.cc, as seen by the other parts of the
+// library. Everything here is async-signal-safe.
+
+#ifndef SBLZ_SRC_MODULE_TABLE_H_
+#define SBLZ_SRC_MODULE_TABLE_H_
+
+#include <stdint.h>  // uint64_t
+
+namespace sblz {
+namespace posix {
+namespace internal {
+
+// Returns false if "address" is known not to be in executable code, i.e. the
+// module table is not empty and no module in it contains "address".
+bool MayBeCodeAddress(uint64_t address);
+
+// Returns the address of the .eh_frame_hdr section of the module containing
+// "address" in the module table, or 0 if not found.
+uint64_t FindEhFrameHdr(uint64_t address);
+
+}  // namespace internal
+}  // namespace posix
+}  // namespace sblz
+
+#endif
@@ -5,22 +5,31 @@
 // Copyright (c) 2008, Google Inc.
 // License of glog: see CREDITS
 
+#include <stdint.h>  // uint64_t, uintptr_t
 #include <string.h>  // memchr(), memcmp(), memmove(), memset(), memcpy()
 
-#include <algorithm>  // std::min()
+#include <algorithm>  // std::min(), std::sort()
+#include <atomic>  // std::atomic<>
 #include <limits>  // std::numeric_limits<>
+#include <vector>  // std::vector<>
 
 #include "common.h"
+#include "module_table.h"
 #include "sblz/sblz.h"
 
 #if defined(OS_LINUX)
 
-#include <stdlib.h>  // abort()
+#include <stdio.h>  // rename()
+#include <stdlib.h>  // abort(), mkstemp()
 // System headers
 #include <elf.h>  // Edhr
 #include <errno.h>  // errno
 #include <fcntl.h>  // O_RDONLY
-#include <link.h>  // ElfW
+#include <limits.h>  // PATH_MAX
+#include <link.h>  // ElfW, dl_iterate_phdr()
+#include <sys/auxv.h>  // getauxval()
+#include <sys/mman.h>  // mmap()
+#include <sys/stat.h>  // fstat(), fchmod()
 #include <unistd.h>  // open()
 
 #elif defined(OS_MACOS)
@@ -33,6 +42,28 @@
 namespace sblz {
 namespace posix {
 
+// A raw trace, see RecordRawTrace(), is in the byte order of the machine
+// that records it, without padding:
+//   header: magic (8 bytes), number of frames (uint32_t), number of modules
+//       (uint32_t);
+//   frames: for each address, its offset (uint64_t) and the index of its
+//       module (uint32_t), or kRawTraceNoModule with the address itself;
+//   modules: in the order of their first frames, the load bias (uint64_t),
+//       the size of the build ID (uint8_t), and the build ID.
+// The frames have a fixed size, so they are written before the modules are
+// known.
+
+// The magic number at the beginning of a raw trace. The last byte is the
+// version of the format.
+static const char kRawTraceMagic[8] = {'S', 'B', 'L', 'Z', 'T', 'R', 'C', 1};
+
+// Size of a frame, and size of a module without its build ID.
+const size_t kRawTraceFrameSize = 12;
+const size_t kRawTraceModuleHeaderSize = 9;
+
+// The module index of an address not in the module table.
+const uint32_t kRawTraceNoModule = 0xffffffff;
+
 #if defined(OS_LINUX)
 
 // Re-runs fn until it doesn't cause EINTR, which means that the function
@@ -110,6 +141,80 @@ static bool ReadFromOffsetExact(const int fd,
   return len == count;
 }
 
+// A read-only memory mapping of a part of a file.
+struct FileMapping {
+  const char* data;  // NULL if not mapped.
+  off_t offset;  // File offset of "data", aligned to the page size.
+  size_t size;
+};
+
+// Read-only memory mappings of the parts of an object file that are read
+// to symbolize: the ELF header, the section headers, and the regular and
+// dynamic symbol tables with their string tables.
+struct MappedObjectFile {
+  enum {
+    kElfHeader,
+    kSectionHeaders,
+    kSymtab,
+    kStrtab,
+    kDynsym,
+    kDynstr,
+    kNumMappings,
+  };
+  FileMapping mappings[kNumMappings];
+};
+
+// Reads an object file from its memory mappings if the data is mapped, and
+// otherwise from its file descriptor, which may be -1 if the object file is
+// not opened.
+class ObjectFileReader {
+ public:
+  ObjectFileReader(int fd, const MappedObjectFile* mapped_file)
+      : fd_(fd), mapped_file_(mapped_file) {}
+
+  // Returns the memory where the data at "offset" is mapped, and sets the
+  // number of bytes mapped from there into "size". Returns NULL if the
+  // data at "offset" is not mapped.
+  const char* GetMapped(const off_t offset, size_t* size) const {
+    if (mapped_file_ == NULL) {
+      return NULL;
+    }
+    for (const FileMapping& mapping : mapped_file_->mappings) {
+      if (mapping.data != NULL && mapping.offset <= offset &&
+          offset - mapping.offset < static_cast<off_t>(mapping.size)) {
+        *size = mapping.size - (offset - mapping.offset);
+        return mapping.data + (offset - mapping.offset);
+      }
+    }
+    return NULL;
+  }
+
+  // Same as ReadFromOffset(), reading from memory if the data is mapped.
+  ssize_t Read(void* buf, const size_t count, const off_t offset) const {
+    size_t size;
+    const char* data = GetMapped(offset, &size);
+    if (data != NULL && size >= count) {
+      memcpy(buf, data, count);
+      return count;
+    }
+    if (fd_ < 0) {
+      return -1;
+    }
+    return ReadFromOffset(fd_, buf, count, offset);
+  }
+
+  // Same as ReadFromOffsetExact(), reading from memory if the data is
+  // mapped.
+  bool ReadExact(void* buf, const size_t count, const off_t offset) const {
+    ssize_t len = Read(buf, count, offset);
+    return len == static_cast<ssize_t>(count);
+  }
+
+ private:
+  const int fd_;
+  const MappedObjectFile* const mapped_file_;
+};
+
 // Helper class for reading lines from file.
 //
 // Note: we don't use ProcMapsIterator since the object is big (it has
@@ -343,19 +448,33 @@ void WriteAddressNumber(void* address,
 // and return true. Otherwise, return false.
 // To keep stack consumption low, we would like this function to not get
 // inlined.
-static bool GetSectionHeaderByType(const int fd,
+static bool GetSectionHeaderByType(const ObjectFileReader& reader,
                                    ElfW(Half) sh_num,
                                    const off_t sh_offset,
                                    ElfW(Word) type,
                                    ElfW(Shdr) * buffer) {
+  // Look into the section headers in place if they are mapped.
+  size_t mapped_size;
+  const ElfW(Shdr)* headers = reinterpret_cast<const ElfW(Shdr)*>(
+      reader.GetMapped(sh_offset, &mapped_size));
+  if (headers != NULL && mapped_size >= sh_num * sizeof(headers[0])) {
+    for (int i = 0; i < sh_num; ++i) {
+      if (headers[i].sh_type == type) {
+        *buffer = headers[i];
+        return true;
+      }
+    }
+    return false;
+  }
+
   // Read at most 16 section headers at a time to save read calls.
   ElfW(Shdr) buf[16];
   for (int i = 0; i < sh_num;) {
     const ssize_t num_bytes_left = (sh_num - i) * sizeof(buf[0]);
     const ssize_t num_bytes_to_read =
         (sizeof(buf) > num_bytes_left) ? num_bytes_left : sizeof(buf);
-    const ssize_t len = ReadFromOffset(fd, buf, num_bytes_to_read,
-                                       sh_offset + i * sizeof(buf[0]));
+    const ssize_t len = reader.Read(buf, num_bytes_to_read,
+                                    sh_offset + i * sizeof(buf[0]));
     if (len == -1) {
       return false;
     }
@@ -373,24 +492,255 @@ static bool GetSectionHeaderByType(const int fd,
   return false;
 }
 
-// Read a symbol table and look for the symbol containing the
-// pc. Iterate over symbols in a symbol table and look for the symbol
-// containing "pc". On success, return true and write the symbol name
-// to buffer. Otherwise, return false.
+// Program counters to symbolize, sorted in ascending order, along with the
+// output buffers. A batch holds at most kMaxBatchSize program counters to
+// keep stack consumption low.
+const int kMaxBatchSize = 32;
+struct PcBatch {
+  uint64_t pcs[kMaxBatchSize];
+  char* buffers[kMaxBatchSize];  // buffers[i] receives the symbol of pcs[i].
+  // If not NULL, required_sizes[i] receives the size buffers[i] needs.
+  size_t* required_sizes[kMaxBatchSize];
+  bool done[kMaxBatchSize];  // True once pcs[i] is symbolized or given up.
+  int size;
+  int buffer_size;
+  bool demangle;  // Write the demangled names instead of the symbols.
+  // If not NULL, the sink receives the name of pcs[0] instead of buffers[0],
+  // and sink_size counts the bytes given to it. Only for a batch of one pc.
+  OutputSink sink;
+  void* sink_context;
+  size_t sink_size;
+};
+
+// Give the data to the sink of the batch. "batch" is the context, so that
+// this can be passed to itanium::Demangle() as a sink.
+static void SinkToBatch(const char* data, size_t size, void* batch) {
+  PcBatch* const pc_batch = static_cast<PcBatch*>(batch);
+  if (size > 0) {
+    pc_batch->sink(data, size, pc_batch->sink_context);
+    pc_batch->sink_size += size;
+  }
+}
+
+// Returns the index of the first program counter in batch->pcs[begin, end)
+// that is not less than "address", or "end" if there is none.
+static int LowerBound(const PcBatch* batch, int begin, int end,
+                      uint64_t address) {
+  while (begin < end) {
+    const int mid = begin + (end - begin) / 2;
+    if (batch->pcs[mid] < address) {
+      begin = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+  return begin;
+}
+
+// Returns the length of the '\0'-terminated string at "offset" in the
+// object file, or -1 if it cannot be read.
+static ssize_t ReadStringLength(const ObjectFileReader& reader,
+                                const off_t offset) {
+  char chunk[256];
+  ssize_t length = 0;
+  while (true) {
+    const ssize_t len = reader.Read(chunk, sizeof(chunk), offset + length);
+    if (len <= 0) {
+      return -1;
+    }
+    const char* end = reinterpret_cast<const char*>(memchr(chunk, '\0', len));
+    if (end != NULL) {
+      return length + (end - chunk);
+    }
+    length += len;
+  }
+}
+
+// Read the '\0'-terminated symbol name at "offset" in the object file into
+// "buffer". If the string table is mapped, the name is copied from there.
+// Returns false if the name cannot be read or does not fit into the
+// buffer, in which case the buffer is zeroed. If "required_size" is not
+// NULL, a name that does not fit is truncated instead, and the size of the
+// whole name is written to it.
+static bool ReadSymbolName(const ObjectFileReader& reader,
+                           const off_t offset,
+                           char* buffer,
+                           int buffer_size,
+                           size_t* required_size) {
+  size_t mapped_size;
+  const char* name = reader.GetMapped(offset, &mapped_size);
+  if (name != NULL) {
+    const char* name_end = reinterpret_cast<const char*>(memchr(
+        name, '\0',
+        required_size != NULL ? mapped_size
+                              : std::min<size_t>(mapped_size, buffer_size)));
+    if (name_end == NULL) {
+      memset(buffer, 0, buffer_size);
+      return false;
+    }
+    const size_t size = name_end - name + 1;
+    if (required_size != NULL) {
+      *required_size = size;
+    }
+    const size_t copy_size = std::min<size_t>(size, buffer_size);
+    memcpy(buffer, name, copy_size);
+    buffer[copy_size - 1] = '\0';
+    return true;
+  }
+
+  ssize_t len = reader.Read(buffer, buffer_size, offset);
+  if (len > 0 && required_size != NULL) {
+    const char* name_end =
+        reinterpret_cast<const char*>(memchr(buffer, '\0', len));
+    if (name_end != NULL) {
+      *required_size = name_end - buffer + 1;
+      return true;
+    }
+    const ssize_t rest_length =
+        len < buffer_size ? -1 : ReadStringLength(reader, offset + len);
+    if (rest_length >= 0) {
+      *required_size = len + rest_length + 1;
+      buffer[buffer_size - 1] = '\0';
+      return true;
+    }
+  } else if (len > 0 && memchr(buffer, '\0', buffer_size) != NULL) {
+    return true;
+  }
+  memset(buffer, 0, buffer_size);
+  return false;
+}
+
+// Give the '\0'-terminated symbol name at "offset" in the object file to the
+// sink of the batch. If the string table is mapped, the name is given from
+// there; otherwise it is read and given in chunks, after checking that it
+// can be read to its end. Returns false if the name cannot be read, in which
+// case nothing is given to the sink.
+static bool SinkSymbolName(const ObjectFileReader& reader,
+                           const off_t offset,
+                           PcBatch* batch) {
+  size_t mapped_size;
+  const char* name = reader.GetMapped(offset, &mapped_size);
+  if (name != NULL) {
+    const char* name_end =
+        reinterpret_cast<const char*>(memchr(name, '\0', mapped_size));
+    if (name_end == NULL) {
+      return false;
+    }
+    SinkToBatch(name, name_end - name, batch);
+    return true;
+  }
+
+  char chunk[256];
+  ssize_t len = reader.Read(chunk, sizeof(chunk), offset);
+  if (len <= 0) {
+    return false;
+  }
+  const char* chunk_end =
+      reinterpret_cast<const char*>(memchr(chunk, '\0', len));
+  if (chunk_end != NULL) {
+    SinkToBatch(chunk, chunk_end - chunk, batch);
+    return true;
+  }
+  if (len < static_cast<ssize_t>(sizeof(chunk))) {
+    return false;
+  }
+  ssize_t rest_length = ReadStringLength(reader, offset + len);
+  if (rest_length < 0) {
+    return false;
+  }
+  SinkToBatch(chunk, len, batch);
+  off_t chunk_offset = offset + len;
+  while (rest_length > 0) {
+    len = reader.Read(chunk, std::min<size_t>(rest_length, sizeof(chunk)),
+                      chunk_offset);
+    if (len <= 0) {
+      break;  // The object file changed since it was checked.
+    }
+    SinkToBatch(chunk, len, batch);
+    chunk_offset += len;
+    rest_length -= len;
+  }
+  return true;
+}
+
+// The largest mangled name demangled when the string table is not mapped
+// into memory. A longer one is written as is, truncated.
+const int kMaxMangledNameSize = 1024;
+
+// Write the name of the symbol at "offset" in the object file to the buffer
+// of batch->pcs[k], demangled if "demangle" is set, falling back to the
+// symbol if it cannot be demangled. Returns true on success.
+// The name is demangled straight from the string table if it is mapped into
+// memory, so a mangled name longer than the buffer is still demangled.
+// To keep stack consumption low, we would like this function to not get
+// inlined.
+static __attribute__((noinline)) bool WriteSymbolName(
+    const ObjectFileReader& reader,
+    const off_t offset,
+    bool demangle,
+    PcBatch* batch,
+    int k) {
+  char* buffer = batch->buffers[k];
+  size_t* required_size = batch->required_sizes[k];
+  if (!demangle) {
+    return batch->sink != NULL
+               ? SinkSymbolName(reader, offset, batch)
+               : ReadSymbolName(reader, offset, buffer, batch->buffer_size,
+                                required_size);
+  }
+  size_t mapped_size;
+  const char* name = reader.GetMapped(offset, &mapped_size);
+  char mangled[kMaxMangledNameSize];
+  if (name == NULL || memchr(name, '\0', mapped_size) == NULL) {
+    if (!ReadSymbolName(reader, offset, mangled, sizeof(mangled), NULL)) {
+      // Too long to demangle, handle it as Symbolize() does.
+      return batch->sink != NULL
+                 ? SinkSymbolName(reader, offset, batch)
+                 : ReadSymbolName(reader, offset, buffer, batch->buffer_size,
+                                  required_size);
+    }
+    name = mangled;
+  }
+  if (batch->sink != NULL) {
+    if (!itanium::Demangle(name, SinkToBatch, batch)) {
+      SinkToBatch(name, strlen(name), batch);
+    }
+    return true;
+  }
+  if (!itanium::Demangle(name, buffer, batch->buffer_size, required_size)) {
+    // Not a mangled name, or too long to demangle into the buffer. In the
+    // latter case, the size needed is that of the demangled name.
+    strncpy(buffer, name, batch->buffer_size - 1);
+    buffer[batch->buffer_size - 1] = '\0';
+    if (required_size != NULL && *required_size == 0) {
+      *required_size = strlen(name) + 1;
+    }
+  }
+  return true;
+}
+
+// Read a symbol table and look for the symbols containing the pcs in
+// batch->pcs[begin, end), which are in the same object file, in one walk.
+// For each pc whose symbol is found, write the symbol name to its buffer
+// and mark it as done. Returns true if all the pcs are done.
 // To keep stack consumption low, we would like this function to not get
 // inlined.
-bool FindSymbol(uint64_t pc,
-                const int fd,
-                char* buffer,
-                int buffer_size,
-                uint64_t symbol_offset,
-                const ElfW(Shdr) * strtab,
-                const ElfW(Shdr) * symtab) {
+static bool FindSymbols(const ObjectFileReader& reader,
+                        uint64_t symbol_offset,
+                        const ElfW(Shdr) * strtab,
+                        const ElfW(Shdr) * symtab,
+                        PcBatch* batch,
+                        int begin,
+                        int end) {
   if (symtab == NULL) {
     return false;
   }
+  int num_pending = 0;
+  for (int k = begin; k < end; ++k) {
+    num_pending += !batch->done[k];
+  }
   const int num_symbols = symtab->sh_size / symtab->sh_entsize;
-  for (int i = 0; i < num_symbols;) {
+  for (int i = 0; i < num_symbols && num_pending > 0;) {
     off_t offset = symtab->sh_offset + i * symtab->sh_entsize;
 
     // If we are reading Elf64_Sym's, we want to limit this array to
@@ -402,306 +752,2214 @@ bool FindSymbol(uint64_t pc,
 #define NUM_SYMBOLS 64
 #endif
 
-    // Read at most NUM_SYMBOLS symbols at once to save read() calls.
+    // Look into the symbols in place if they are mapped. Otherwise, read
+    // at most NUM_SYMBOLS symbols at once to save read() calls.
     ElfW(Sym) buf[NUM_SYMBOLS];
-    int num_symbols_to_read = std::min(NUM_SYMBOLS, num_symbols - i);
-    const ssize_t len =
-        ReadFromOffset(fd, &buf, sizeof(buf[0]) * num_symbols_to_read, offset);
-    SAFE_ASSERT(len % sizeof(buf[0]) == 0);
-    const ssize_t num_symbols_in_buf = len / sizeof(buf[0]);
-    SAFE_ASSERT(num_symbols_in_buf <= num_symbols_to_read);
-    for (int j = 0; j < num_symbols_in_buf; ++j) {
-      const ElfW(Sym)& symbol = buf[j];
+    size_t mapped_size;
+    const ElfW(Sym)* symbols = reinterpret_cast<const ElfW(Sym)*>(
+        reader.GetMapped(offset, &mapped_size));
+    ssize_t num_symbols_in_buf;
+    if (symbols != NULL && mapped_size >= sizeof(buf[0])) {
+      num_symbols_in_buf =
+          std::min<size_t>(mapped_size / sizeof(buf[0]), num_symbols - i);
+    } else {
+      int num_symbols_to_read = std::min(NUM_SYMBOLS, num_symbols - i);
+      const ssize_t len =
+          reader.Read(&buf, sizeof(buf[0]) * num_symbols_to_read, offset);
+      if (len <= 0) {
+        break;  // EOF or error.
+      }
+      SAFE_ASSERT(len % sizeof(buf[0]) == 0);
+      num_symbols_in_buf = len / sizeof(buf[0]);
+      SAFE_ASSERT(num_symbols_in_buf <= num_symbols_to_read);
+      symbols = buf;
+    }
+    for (int j = 0; j < num_symbols_in_buf && num_pending > 0; ++j) {
+      const ElfW(Sym)& symbol = symbols[j];
+      if (symbol.st_value == 0 ||  // Skip null value symbols.
+          symbol.st_shndx == 0) {  // Skip undefined symbols.
+        continue;
+      }
       uint64_t start_address = symbol.st_value;
       start_address += symbol_offset;
       uint64_t end_address = start_address + symbol.st_size;
-      if (symbol.st_value != 0 &&  // Skip null value symbols.
-          symbol.st_shndx != 0 &&  // Skip undefined symbols.
-          start_address <= pc && pc < end_address) {
-        ssize_t len1 = ReadFromOffset(fd, buffer, buffer_size,
-                                      strtab->sh_offset + symbol.st_name);
-        if (len1 <= 0 || memchr(buffer, '\0', buffer_size) == NULL) {
-          memset(buffer, 0, buffer_size);
-          return false;
+      for (int k = LowerBound(batch, begin, end, start_address);
+           k < end && batch->pcs[k] < end_address; ++k) {
+        if (batch->done[k]) {
+          continue;
+        }
+        if (!WriteSymbolName(reader, strtab->sh_offset + symbol.st_name,
+                             batch->demangle, batch, k)) {
+          continue;
         }
-        return true;  // Obtained the symbol name.
+        batch->done[k] = true;  // Obtained the symbol name.
+        --num_pending;
       }
     }
     i += num_symbols_in_buf;
   }
-  return false;
+  return num_pending == 0;
 }
 
-// Find the object file that contains the given program counter (pc) value.
-// If found, sets `start_address` to the start address of where this object
-// file is mapped in memory, sets the module base address into `base_address`,
-// copies the object file name into `obj_filename_buffer`, and attempts to
-// open the object file. If the object file is opened successfully, returns
-// the file descriptor. Otherwise, returns -1.
-// See http://man7.org/linux/man-pages/man5/proc.5.html for introduction.
-static int FindAndOpenObjectFileWithProgramCounter(uint64_t pc,
-                                                   uint64_t* start_address,
-                                                   uint64_t* base_address,
-                                                   char* obj_filename_buffer,
-                                                   int buffer_size) {
-  int object_fd;
+// A parsed line in /proc/self/maps. Pointers point into the line buffer.
+struct MapsLine {
+  uint64_t start_address;
+  uint64_t end_address;
+  uint64_t file_offset;
+  const char* flags;  // At least four letters, e.g. "r-xp".
+  const char* path;  // Empty if the mapping is anonymous.
+};
 
-  int maps_fd;
-  NO_INTR(maps_fd = open("/proc/self/maps", O_RDONLY));
-  FileDescriptor wrapped_maps_fd(maps_fd);
-  if (wrapped_maps_fd.get() < 0) {
-    return -1;
+// Parse a line in /proc/self/maps into "map". Returns false if the line is
+// malformed. Here is an example of a line:
+//
+// 08048000-0804c000 r-xp 00000000 08:01 2142121    /bin/cat
+//
+// We want start address (08048000), end address (0804c000), flags
+// (r-xp), file offset (00000000) and file name (/bin/cat).
+static bool ParseMapsLine(const char* cursor,
+                          const char* eol,
+                          MapsLine* map) {
+  // Read start address.
+  cursor = GetHex(cursor, eol, &map->start_address);
+  if (cursor == eol || *cursor != '-') {
+    return false;  // Malformed line.
   }
+  ++cursor;  // Skip '-'.
 
-  int mem_fd;
-  NO_INTR(mem_fd = open("/proc/self/mem", O_RDONLY));
-  FileDescriptor wrapped_mem_fd(mem_fd);
-  if (wrapped_mem_fd.get() < 0) {
-    return -1;
+  // Read end address.
+  cursor = GetHex(cursor, eol, &map->end_address);
+  if (cursor == eol || *cursor != ' ') {
+    return false;  // Malformed line.
   }
+  ++cursor;  // Skip ' '.
 
-  // Iterate over maps and look for the map containing the pc.  Then
-  // look into the symbol tables inside.
-  char buf[1024];  // Big enough for line of sane /proc/self/maps
-  int num_maps = 0;
-  LineReader reader(wrapped_maps_fd.get(), buf, sizeof(buf), 0);
-  while (true) {
-    num_maps++;
-    const char* cursor;
-    const char* eol;
-    if (!reader.ReadLine(&cursor, &eol)) {  // EOF or malformed line.
-      return -1;
-    }
-
-    // Start parsing line in /proc/self/maps.  Here is an example:
-    //
-    // 08048000-0804c000 r-xp 00000000 08:01 2142121    /bin/cat
-    //
-    // We want start address (08048000), end address (0804c000), flags
-    // (r-xp) and file name (/bin/cat).
-
-    // Read start address.
-    cursor = GetHex(cursor, eol, start_address);
-    if (cursor == eol || *cursor != '-') {
-      return -1;  // Malformed line.
-    }
-    ++cursor;  // Skip '-'.
+  // Read flags.  Skip flags until we encounter a space or eol.
+  map->flags = cursor;
+  while (cursor < eol && *cursor != ' ') {
+    ++cursor;
+  }
+  // We expect at least four letters for flags (ex. "r-xp").
+  if (cursor == eol || cursor < map->flags + 4) {
+    return false;  // Malformed line.
+  }
+  ++cursor;  // Skip ' '.
 
-    // Read end address.
-    uint64_t end_address;
-    cursor = GetHex(cursor, eol, &end_address);
-    if (cursor == eol || *cursor != ' ') {
-      return -1;  // Malformed line.
+  // Read file offset.
+  cursor = GetHex(cursor, eol, &map->file_offset);
+  if (cursor == eol || *cursor != ' ') {
+    return false;  // Malformed line.
+  }
+  ++cursor;  // Skip ' '.
+
+  // Skip to file name.  "cursor" now points to dev.  We need to
+  // skip at least two spaces for dev and inode.
+  int num_spaces = 0;
+  while (cursor < eol) {
+    if (*cursor == ' ') {
+      ++num_spaces;
+    } else if (num_spaces >= 2) {
+      // The first non-space character after skipping two spaces
+      // is the beginning of the file name.
+      break;
     }
-    ++cursor;  // Skip ' '.
+    ++cursor;
+  }
+  map->path = cursor;  // Points to '\0' at "eol" if there is no file name.
+  return true;
+}
 
-    // Read flags.  Skip flags until we encounter a space or eol.
-    const char* const flags_start = cursor;
-    while (cursor < eol && *cursor != ' ') {
-      ++cursor;
+// Find the GNU build ID in the notes of "notes_size" bytes, e.g. the
+// content of a SHT_NOTE section or a PT_NOTE segment, and copy it into
+// "build_id", which has room for kMaxBuildIdSize bytes. Returns its size, or
+// -1 if not found.
+static int FindBuildIdInNotes(const char* notes,
+                              size_t notes_size,
+                              uint8_t* build_id) {
+  // A note is a header followed by its name and its descriptor, each padded
+  // to 4 bytes.
+  size_t offset = 0;
+  while (offset + sizeof(ElfW(Nhdr)) <= notes_size) {
+    ElfW(Nhdr) note;
+    memcpy(&note, notes + offset, sizeof(note));
+    const size_t name_offset = offset + sizeof(note);
+    const size_t desc_offset = name_offset + ((note.n_namesz + 3) & ~3u);
+    if (desc_offset + note.n_descsz > notes_size) {
+      break;
     }
-    // We expect at least four letters for flags (ex. "r-xp").
-    if (cursor == eol || cursor < flags_start + 4) {
-      return -1;  // Malformed line.
+    if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4 &&
+        memcmp(notes + name_offset, "GNU", 4) == 0 && note.n_descsz > 0 &&
+        note.n_descsz <= kMaxBuildIdSize) {
+      memcpy(build_id, notes + desc_offset, note.n_descsz);
+      return note.n_descsz;
     }
+    offset = desc_offset + ((note.n_descsz + 3) & ~3u);
+  }
+  return -1;
+}
 
-    // Determine the base address by reading ELF headers in process memory.
-    ElfW(Ehdr) ehdr;
-    // Skip non-readable maps.
-    if (flags_start[0] == 'r' &&
-        ReadFromOffsetExact(mem_fd, &ehdr, sizeof(ElfW(Ehdr)),
-                            *start_address) &&
-        memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0) {
-      switch (ehdr.e_type) {
-        case ET_EXEC:
-          *base_address = 0;
-          break;
-        case ET_DYN:
-          // Find the segment containing file offset 0. This will correspond
-          // to the ELF header that we just read. Normally this will have
-          // virtual address 0, but this is not guaranteed. We must subtract
-          // the virtual address from the address where the ELF header was
-          // mapped to get the base address.
-          //
-          // If we fail to find a segment for file offset 0, use the address
-          // of the ELF header as the base address.
-          *base_address = *start_address;
-          for (unsigned i = 0; i != ehdr.e_phnum; ++i) {
-            ElfW(Phdr) phdr;
-            if (ReadFromOffsetExact(
-                    mem_fd, &phdr, sizeof(phdr),
-                    *start_address + ehdr.e_phoff + i * sizeof(phdr)) &&
-                phdr.p_type == PT_LOAD && phdr.p_offset == 0) {
-              *base_address = *start_address - phdr.p_vaddr;
-              break;
-            }
-          }
-          break;
-        default:
-          // ET_REL or ET_CORE. These aren't directly executable, so they don't
-          // affect the base address.
-          break;
-      }
+// Read the build ID of the module whose ELF header "ehdr" is mapped at
+// "header_address" and whose base address is "base_address" from its
+// PT_NOTE segments in process memory through "mem_fd" into "build_id",
+// which has room for kMaxBuildIdSize bytes. Returns its size, or -1 if
+// not found.
+static int ReadBuildIdFromMemory(const int mem_fd,
+                                 const ElfW(Ehdr) & ehdr,
+                                 uint64_t header_address,
+                                 uint64_t base_address,
+                                 uint8_t* build_id) {
+  for (unsigned i = 0; i != ehdr.e_phnum; ++i) {
+    ElfW(Phdr) phdr;
+    if (!ReadFromOffsetExact(
+            mem_fd, &phdr, sizeof(phdr),
+            header_address + ehdr.e_phoff + i * sizeof(phdr)) ||
+        phdr.p_type != PT_NOTE) {
+      continue;
     }
-
-    // Check start and end addresses.
-    if (!(*start_address <= pc && pc < end_address)) {
-      continue;  // We skip this map.  PC isn't in this map.
+    char notes[1024];
+    const size_t notes_size = std::min<size_t>(phdr.p_memsz, sizeof(notes));
+    if (!ReadFromOffsetExact(mem_fd, notes, notes_size,
+                             base_address + phdr.p_vaddr)) {
+      continue;
     }
-
-    // Check flags.  We are only interested in "r*x" maps.
-    if (flags_start[0] != 'r' || flags_start[2] != 'x') {
-      continue;  // We skip this map.
+    const int build_id_size = FindBuildIdInNotes(notes, notes_size, build_id);
+    if (build_id_size > 0) {
+      return build_id_size;
     }
-    ++cursor;  // Skip ' '.
-
-    // Read file offset.
-    uint64_t file_offset;
-    cursor = GetHex(cursor, eol, &file_offset);
-    if (cursor == eol || *cursor != ' ') {
-      return -1;  // Malformed line.
-    }
-    ++cursor;  // Skip ' '.
-
-    // Skip to file name.  "cursor" now points to dev.  We need to
-    // skip at least two spaces for dev and inode.
-    int num_spaces = 0;
-    while (cursor < eol) {
-      if (*cursor == ' ') {
-        ++num_spaces;
-      } else if (num_spaces >= 2) {
-        // The first non-space character after skipping two spaces
-        // is the beginning of the file name.
-        break;
-      }
-      ++cursor;
+  }
+  return -1;
+}
+
+// If the readable mapping "map" starts with an ELF header, determine the
+// module base address by reading the ELF header in process memory through
+// "mem_fd" and update "base_address". Otherwise, "base_address" is left
+// untouched, as the mapping belongs to the module seen most recently.
+// If "eh_frame_hdr" is not NULL, it is updated along with "base_address" to
+// the address of the .eh_frame_hdr section of the module, or 0 if none.
+// Likewise, if "build_id_size" is not NULL, the build ID of the module is
+// read into "build_id", which has room for kMaxBuildIdSize bytes, and its
+// size into "build_id_size", or -1 if none.
+// Returns true if "base_address" was updated.
+static bool MaybeUpdateBaseAddress(const int mem_fd,
+                                   const MapsLine& map,
+                                   uint64_t* base_address,
+                                   uint64_t* eh_frame_hdr = NULL,
+                                   uint8_t* build_id = NULL,
+                                   int* build_id_size = NULL) {
+  ElfW(Ehdr) ehdr;
+  // Skip non-readable maps.
+  if (map.flags[0] != 'r' ||
+      !ReadFromOffsetExact(mem_fd, &ehdr, sizeof(ElfW(Ehdr)),
+                           map.start_address) ||
+      memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0) {
+    return false;
+  }
+  bool find_base_address = false;
+  switch (ehdr.e_type) {
+    case ET_EXEC:
+      *base_address = 0;
+      break;
+    case ET_DYN:
+      // Find the segment containing file offset 0. This will correspond
+      // to the ELF header that we just read. Normally this will have
+      // virtual address 0, but this is not guaranteed. We must subtract
+      // the virtual address from the address where the ELF header was
+      // mapped to get the base address.
+      //
+      // If we fail to find a segment for file offset 0, use the address
+      // of the ELF header as the base address.
+      *base_address = map.start_address;
+      find_base_address = true;
+      break;
+    default:
+      // ET_REL or ET_CORE. These aren't directly executable, so they don't
+      // affect the base address.
+      return false;
+  }
+  if (!find_base_address && eh_frame_hdr == NULL && build_id_size == NULL) {
+    return true;
+  }
+  uint64_t eh_frame_hdr_vaddr = 0;
+  for (unsigned i = 0; i != ehdr.e_phnum; ++i) {
+    ElfW(Phdr) phdr;
+    if (!ReadFromOffsetExact(
+            mem_fd, &phdr, sizeof(phdr),
+            map.start_address + ehdr.e_phoff + i * sizeof(phdr))) {
+      continue;
     }
-    if (cursor == eol) {
-      return -1;  // Malformed line.
+    if (find_base_address && phdr.p_type == PT_LOAD && phdr.p_offset == 0) {
+      *base_address = map.start_address - phdr.p_vaddr;
+      find_base_address = false;
+    } else if (phdr.p_type == PT_GNU_EH_FRAME) {
+      eh_frame_hdr_vaddr = phdr.p_vaddr;
     }
+  }
+  if (eh_frame_hdr != NULL) {
+    *eh_frame_hdr =
+        eh_frame_hdr_vaddr != 0 ? *base_address + eh_frame_hdr_vaddr : 0;
+  }
+  if (build_id_size != NULL) {
+    *build_id_size = ReadBuildIdFromMemory(mem_fd, ehdr, map.start_address,
+                                           *base_address, build_id);
+  }
+  return true;
+}
 
-    // Finally, "cursor" now points to file name of our interest.
-    NO_INTR(object_fd = open(cursor, O_RDONLY));
-    if (object_fd < 0) {
-      // Failed to open object file.  Copy the object file name to
-      // |obj_filename_buffer|.
-      strncpy(obj_filename_buffer, cursor, buffer_size);
-      // Making sure |obj_filename_buffer| is always null-terminated.
-      obj_filename_buffer[buffer_size - 1] = '\0';
-      return -1;
+// An entry in the symbol index of a module, see BuildSymbolIndex().
+struct SymbolIndexEntry {
+  uint64_t address;  // Symbol value, i.e. the address before relocation.
+  uint32_t size;
+  // File offset of the '\0'-terminated symbol name, or its offset in the
+  // string table if the index is from a symbol index file.
+  uint32_t name_offset;
+  // The greatest end address of this entry and the entries before it,
+  // relative to "address", so that a lookup knows when no earlier entry can
+  // contain an address. It fits, as no entry is larger than 4 GiB.
+  uint32_t reach;
+  // The position of the symbol in the symbol tables, as FindSymbols()
+  // returns the first symbol containing an address.
+  uint32_t order;
+};
+
+// The magic number at the beginning of a symbol index file. The last byte
+// is the version of the format.
+static const char kSymbolIndexFileMagic[8] = {'S', 'B', 'L', 'Z',
+                                              'I', 'D', 'X', 2};
+
+// Flags of a symbol index file.
+const uint32_t kSymbolIndexHasDemangledNames = 1 << 0;
+
+// The header of a symbol index file, see WriteSymbolIndexFile(). The offsets
+// are from the beginning of the file.
+struct SymbolIndexFileHeader {
+  char magic[8];  // kSymbolIndexFileMagic.
+  uint32_t flags;
+  uint32_t build_id_size;
+  uint8_t build_id[kMaxBuildIdSize];  // The build ID of the object file.
+  uint64_t num_entries;
+  uint64_t entries_offset;  // Of the SymbolIndexEntry array.
+  uint64_t strings_offset;  // Of the string table.
+  uint64_t strings_size;
+};
+
+// A symbol index file loaded by LoadSymbolIndexFiles(), mapped read-only.
+// See WriteSymbolIndexFile() for the format.
+struct SymbolIndexFile {
+  FileMapping file;  // The whole file.
+  // The string table, as if it were mapped from offset 0 of the object file,
+  // so that the names are read by an ObjectFileReader, as those in the
+  // object file are.
+  MappedObjectFile strings;
+  const char* strings_end;
+  bool has_demangled_names;
+};
+
+// An executable mapping recorded in the module table.
+struct Module {
+  uint64_t start_address;
+  uint64_t end_address;
+  uint64_t base_address;
+  // Address of the .eh_frame_hdr section in memory, or 0 if none.
+  uint64_t eh_frame_hdr;
+  int path_offset;  // Offset of the '\0'-terminated path in the path pool.
+  // Offset of the build ID in the path pool, and its size, or 0 if none.
+  // See RecordRawTrace().
+  int build_id_offset;
+  int build_id_size;
+  // The symbol index sorted by address, or NULL if not built. See
+  // BuildSymbolIndex().
+  const SymbolIndexEntry* symbol_index;
+  int symbol_index_size;
+  // The symbol index file that "symbol_index" is in, whose string table has
+  // the names, or NULL if the index is not from a file. See
+  // LoadSymbolIndexFiles().
+  const SymbolIndexFile* symbol_index_file;
+  // The memory mappings of the object file, or NULL if not mapped. See
+  // MapObjectFiles().
+  const MappedObjectFile* mapped_file;
+  // The pre-opened descriptor of the object file, or -1 if not opened. See
+  // OpenObjectFiles().
+  int fd;
+};
+
+// Capacity of the module table. A mapping beyond the capacity is not
+// recorded, and addresses in it are looked up by parsing /proc/self/maps.
+// The path pool holds the build IDs too.
+const int kMaxModules = 1024;
+const int kModulePathPoolSize = 64 * 1024;
+
+// The module table, filled by InitModuleTable() and read by Symbolize().
+// The modules are sorted by address, since /proc/self/maps is sorted.
+struct ModuleTable {
+  Module modules[kMaxModules];
+  char path_pool[kModulePathPoolSize];
+  // Published after the modules are written, so that a reader in a signal
+  // handler never sees a partially written module.
+  std::atomic<int> num_modules;
+  // Incremented each time the table is filled, to invalidate SymbolCache.
+  std::atomic<unsigned> generation;
+};
+
+static ModuleTable g_module_table;
+
+// The memory mapped by BuildSymbolIndex() if the caller did not provide one.
+static void* g_symbol_index_mapping = NULL;
+static size_t g_symbol_index_mapping_size = 0;
+
+// The symbol index files mapped by LoadSymbolIndexFiles(). One file is
+// mapped only once even if its object file has more than one module.
+const int kMaxSymbolIndexFiles = 256;
+static SymbolIndexFile g_symbol_index_files[kMaxSymbolIndexFiles];
+static int g_num_symbol_index_files = 0;
+
+// The object files mapped by MapObjectFiles(). One object file is mapped
+// only once even if it has more than one module.
+const int kMaxMappedObjectFiles = 256;
+static MappedObjectFile g_mapped_object_files[kMaxMappedObjectFiles];
+static int g_num_mapped_object_files = 0;
+
+// The object files opened by OpenObjectFiles(). One object file is opened
+// only once even if it has more than one module.
+const int kMaxOpenObjectFiles = 256;
+static int g_object_file_fds[kMaxOpenObjectFiles];
+static int g_num_object_file_fds = 0;
+
+// Unmap the memory allocated for the symbol indices.
+static void UnmapSymbolIndex() {
+  if (g_symbol_index_mapping != NULL) {
+    munmap(g_symbol_index_mapping, g_symbol_index_mapping_size);
+    g_symbol_index_mapping = NULL;
+    g_symbol_index_mapping_size = 0;
+  }
+}
+
+// Unmap the parts of an object file mapped by MapObjectFile().
+static void UnmapObjectFile(MappedObjectFile* mapped_file) {
+  for (FileMapping& mapping : mapped_file->mappings) {
+    if (mapping.data != NULL) {
+      munmap(const_cast<char*>(mapping.data), mapping.size);
+      mapping.data = NULL;
     }
-    return object_fd;
   }
 }
 
-// Get the symbol name of "pc" from the file pointed by "fd". Process
-// both regular and dynamic symbol tables if necessary. On success,
-// write the symbol name to "buffer" and return true. Otherwise, return
-// false.
-static bool GetSymbolFromObjectFile(const int fd,
-                                    uint64_t pc,
-                                    char* buffer,
-                                    int buffer_size,
-                                    uint64_t base_address) {
-  // Read the ELF header.
-  ElfW(Ehdr) elf_header;
-  if (!ReadFromOffsetExact(fd, &elf_header, sizeof(elf_header), 0)) {
-    return false;
+// Unmap the symbol index files mapped by LoadSymbolIndexFiles().
+static void UnmapSymbolIndexFiles() {
+  for (int i = 0; i < g_num_symbol_index_files; ++i) {
+    FileMapping* file = &g_symbol_index_files[i].file;
+    munmap(const_cast<char*>(file->data), file->size);
+    file->data = NULL;
+  }
+  g_num_symbol_index_files = 0;
+}
+
+// Unmap the object files mapped by MapObjectFiles().
+static void UnmapObjectFiles() {
+  for (int i = 0; i < g_num_mapped_object_files; ++i) {
+    UnmapObjectFile(&g_mapped_object_files[i]);
   }
+  g_num_mapped_object_files = 0;
+}
 
-  ElfW(Shdr) symtab, strtab;
+// Close the object files opened by OpenObjectFiles().
+static void CloseObjectFiles() {
+  for (int i = 0; i < g_num_object_file_fds; ++i) {
+    close(g_object_file_fds[i]);
+  }
+  g_num_object_file_fds = 0;
+}
 
-  // Consult a regular symbol table first.
-  if (GetSectionHeaderByType(fd, elf_header.e_shnum, elf_header.e_shoff,
-                             SHT_SYMTAB, &symtab)) {
-    if (!ReadFromOffsetExact(
-            fd, &strtab, sizeof(strtab),
-            elf_header.e_shoff + symtab.sh_link * sizeof(symtab))) {
-      return false;
-    }
-    if (FindSymbol(pc, fd, buffer, buffer_size, base_address, &strtab,
-                   &symtab)) {
-      return true;  // Found the symbol in a regular symbol table.
+static unsigned GetModuleTableGeneration() {
+  return g_module_table.generation.load(std::memory_order_relaxed);
+}
+
+static const char* GetModulePath(const Module* module) {
+  return g_module_table.path_pool + module->path_offset;
+}
+
+// Find the module containing "pc" in the module table by binary search.
+// Returns NULL if the table is empty or no module in it contains "pc".
+static const Module* FindModuleInTable(uint64_t pc) {
+  const int num_modules =
+      g_module_table.num_modules.load(std::memory_order_acquire);
+  int low = 0;
+  int high = num_modules;
+  while (low < high) {
+    const int mid = low + (high - low) / 2;
+    const Module* module = &g_module_table.modules[mid];
+    if (pc < module->start_address) {
+      high = mid;
+    } else if (pc >= module->end_address) {
+      low = mid + 1;
+    } else {
+      return module;
     }
   }
+  return NULL;
+}
 
-  // If the symbol is not found, then consult a dynamic symbol table.
-  if (GetSectionHeaderByType(fd, elf_header.e_shnum, elf_header.e_shoff,
-                             SHT_DYNSYM, &symtab)) {
-    if (!ReadFromOffsetExact(
-            fd, &strtab, sizeof(strtab),
-            elf_header.e_shoff + symtab.sh_link * sizeof(symtab))) {
-      return false;
+// Find the symbol containing "address" (before relocation) in the symbol
+// index of "module" by binary search. As FindSymbols() does, the symbol
+// first in the symbol tables is returned if several contain "address", e.g.
+// an outer function and a symbol nested in it. Returns NULL if not found.
+static const SymbolIndexEntry* FindSymbolInIndex(const Module* module,
+                                                 uint64_t address) {
+  const SymbolIndexEntry* entries = module->symbol_index;
+  // Find the first entry starting after "address".
+  int low = 0;
+  int high = module->symbol_index_size;
+  while (low < high) {
+    const int mid = low + (high - low) / 2;
+    if (entries[mid].address <= address) {
+      low = mid + 1;
+    } else {
+      high = mid;
     }
-    if (FindSymbol(pc, fd, buffer, buffer_size, base_address, &strtab,
-                   &symtab)) {
-      return true;  // Found the symbol in a dynamic symbol table.
+  }
+  // Go back over the entries starting at or before "address" while they
+  // may still contain it.
+  const SymbolIndexEntry* found = NULL;
+  for (int i = low - 1;
+       i >= 0 && address - entries[i].address < entries[i].reach; --i) {
+    if (address - entries[i].address < entries[i].size &&
+        (found == NULL || entries[i].order < found->order)) {
+      found = &entries[i];
     }
   }
-
-  return false;
+  return found;
 }
 
-EXPORT bool Symbolize(void* address, char* buffer, size_t buffer_size) {
-  uint64_t start_addr = 0;
-  uint64_t base_addr = 0;
+// Fills the module table. The table is emptied on construction, and the
+// modules added are published by Publish().
+class ModuleTableBuilder {
+ public:
+  ModuleTableBuilder()
+      : table_(&g_module_table), num_modules_(0), path_pool_used_(0) {
+    table_->num_modules.store(0, std::memory_order_release);
+    table_->generation.fetch_add(1, std::memory_order_relaxed);
+    UnmapSymbolIndex();
+    UnmapSymbolIndexFiles();
+    UnmapObjectFiles();
+    CloseObjectFiles();
+  }
 
-  if (buffer_size < 5) {
-    return false;
+  // Add a module with the path of "path_length" bytes and the build ID of
+  // "build_id_size" bytes, which is ignored if the size is not positive.
+  // Returns false if the table is full.
+  bool AddModule(uint64_t start_address,
+                 uint64_t end_address,
+                 uint64_t base_address,
+                 uint64_t eh_frame_hdr,
+                 const char* path,
+                 int path_length,
+                 const uint8_t* build_id,
+                 int build_id_size) {
+    if (num_modules_ == kMaxModules) {
+      return false;
+    }
+    Module* module = &table_->modules[num_modules_];
+    module->start_address = start_address;
+    module->end_address = end_address;
+    module->base_address = base_address;
+    module->eh_frame_hdr = eh_frame_hdr;
+    module->symbol_index = NULL;
+    module->symbol_index_size = 0;
+    module->symbol_index_file = NULL;
+    module->mapped_file = NULL;
+    module->fd = -1;
+    if (build_id_size < 0) {
+      build_id_size = 0;
+    }
+    // Consecutive modules of the same object file share the path and the
+    // build ID.
+    const char* prev_path =
+        num_modules_ > 0 ? GetModulePath(module - 1) : NULL;
+    if (prev_path != NULL && strncmp(prev_path, path, path_length) == 0 &&
+        prev_path[path_length] == '\0') {
+      module->path_offset = (module - 1)->path_offset;
+      module->build_id_offset = (module - 1)->build_id_offset;
+      module->build_id_size = (module - 1)->build_id_size;
+    } else {
+      if (path_pool_used_ + path_length + 1 + build_id_size >
+          kModulePathPoolSize) {
+        return false;
+      }
+      memcpy(table_->path_pool + path_pool_used_, path, path_length);
+      table_->path_pool[path_pool_used_ + path_length] = '\0';
+      module->path_offset = path_pool_used_;
+      path_pool_used_ += path_length + 1;  // +1 for '\0'.
+      memcpy(table_->path_pool + path_pool_used_, build_id, build_id_size);
+      module->build_id_offset = path_pool_used_;
+      module->build_id_size = build_id_size;
+      path_pool_used_ += build_id_size;
+    }
+    ++num_modules_;
+    return true;
   }
-  buffer[0] = '\0';
 
-  int object_file_fd = FindAndOpenObjectFileWithProgramCounter(
-      reinterpret_cast<uint64_t>(address), &start_addr, &base_addr, buffer + 1,
-      buffer_size - 1);
+  // Sort the modules by address, as required by FindModuleInTable().
+  void SortModules() {
+    std::sort(table_->modules, table_->modules + num_modules_,
+              [](const Module& a, const Module& b) {
+                return a.start_address < b.start_address;
+              });
+  }
 
-  if (object_file_fd < 0) {
-    // The object file containing PC was determined successfully however not
-    // opened. This is still considered success and we write the instruction
-    // address.
-    WriteAddressNumber(address, base_addr, buffer, buffer_size);
-    return true;
+  // Publish the modules added so far.
+  void Publish() {
+    table_->num_modules.store(num_modules_, std::memory_order_release);
   }
 
-  FileDescriptor wrapped_object_fd(object_file_fd);
-  int elf_type = FileGetElfType(wrapped_object_fd.get());
-  if (elf_type == -1) {
+ private:
+  ModuleTable* const table_;
+  int num_modules_;
+  int path_pool_used_;
+};
+
+// Record the "r*x" maps in /proc/self/maps into the module table. Returns
+// false if /proc/self/maps cannot be read or the table is full; the modules
+// recorded so far are still published.
+static bool FillModuleTableFromProcMaps() {
+  ModuleTableBuilder builder;
+
+  int maps_fd;
+  NO_INTR(maps_fd = open("/proc/self/maps", O_RDONLY));
+  FileDescriptor wrapped_maps_fd(maps_fd);
+  if (wrapped_maps_fd.get() < 0) {
     return false;
   }
 
-  bool got_symbol = GetSymbolFromObjectFile(wrapped_object_fd.get(),
-                                            reinterpret_cast<uint64_t>(address),
-                                            buffer, buffer_size, base_addr);
-  buffer[buffer_size - 1] = '\0';  // Make sure it is always '\0'-terminated.
+  int mem_fd;
+  NO_INTR(mem_fd = open("/proc/self/mem", O_RDONLY));
+  FileDescriptor wrapped_mem_fd(mem_fd);
+  if (wrapped_mem_fd.get() < 0) {
+    return false;
+  }
 
-  if (!got_symbol) {
-    // The object file containing PC was opened successfully however the
-    // symbol was not found. The object may have been stripped, but this is
-    // still considered success and we write the instruction address.
-    WriteAddressNumber(address, base_addr, buffer, buffer_size);
+  // The maps are sorted by address, so there is no need to sort the modules.
+  char buf[1024];  // Big enough for line of sane /proc/self/maps
+  LineReader reader(wrapped_maps_fd.get(), buf, sizeof(buf), 0);
+  uint64_t base_address = 0;
+  uint64_t eh_frame_hdr = 0;
+  uint8_t build_id[kMaxBuildIdSize];
+  int build_id_size = -1;
+  // The path of the module whose ELF header was seen most recently. A later
+  // mapping with another path, e.g. anonymous JIT code, is not part of it.
+  char module_path[sizeof(buf)];
+  module_path[0] = '\0';
+  bool ok = true;
+  const char* cursor;
+  const char* eol;
+  while (reader.ReadLine(&cursor, &eol)) {
+    MapsLine map;
+    if (!ParseMapsLine(cursor, eol, &map)) {
+      ok = false;  // Malformed line.
+      break;
+    }
+    const size_t path_length = eol - map.path;
+    if (MaybeUpdateBaseAddress(mem_fd, map, &base_address, &eh_frame_hdr,
+                               build_id, &build_id_size)) {
+      memcpy(module_path, map.path, path_length);
+      module_path[path_length] = '\0';
+    } else if (strncmp(module_path, map.path, path_length) != 0 ||
+               module_path[path_length] != '\0') {
+      base_address = 0;
+      eh_frame_hdr = 0;
+      build_id_size = -1;
+      module_path[0] = '\0';
+    }
+    // We are only interested in "r*x" maps.
+    if (map.flags[0] != 'r' || map.flags[2] != 'x') {
+      continue;
+    }
+    if (!builder.AddModule(map.start_address, map.end_address, base_address,
+                           eh_frame_hdr, map.path, path_length, build_id,
+                           build_id_size)) {
+      ok = false;
+      break;
+    }
   }
 
-  return true;
+  builder.Publish();
+  return ok;
+}
+
+// Get the path of the main executable into "buffer". dl_iterate_phdr()
+// gives an empty name for it. Returns the length of the path, or -1 on
+// failure.
+static int GetExecutablePath(char* buffer, int buffer_size) {
+  const ssize_t len = readlink("/proc/self/exe", buffer, buffer_size);
+  if (len > 0 && len < buffer_size) {
+    return len;
+  }
+  // Fall back to the path passed to execve(), in case /proc is masked. It
+  // may be relative to the initial working directory.
+  const char* path = reinterpret_cast<const char*>(getauxval(AT_EXECFN));
+  if (path == NULL || strlen(path) >= static_cast<size_t>(buffer_size)) {
+    return -1;
+  }
+  strncpy(buffer, path, buffer_size);
+  return strlen(buffer);
+}
+
+// Called by dl_iterate_phdr() for each loaded object to record its
+// executable PT_LOAD segments into the module table. Returns non-zero to
+// stop the iteration.
+static int AddModulesOfLoadedObject(struct dl_phdr_info* info,
+                                    size_t /*size*/,
+                                    void* data) {
+  ModuleTableBuilder* builder = reinterpret_cast<ModuleTableBuilder*>(data);
+  const char* path = info->dlpi_name;
+  int path_length = strlen(path);
+  char executable_path[PATH_MAX];
+  if (path_length == 0) {
+    path_length = GetExecutablePath(executable_path, sizeof(executable_path));
+    path = executable_path;
+    if (path_length < 0) {
+      path_length = 0;
+    }
+  }
+  uint64_t eh_frame_hdr = 0;
+  uint8_t build_id[kMaxBuildIdSize];
+  int build_id_size = -1;
+  for (int i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+    if (phdr.p_type == PT_GNU_EH_FRAME) {
+      eh_frame_hdr = info->dlpi_addr + phdr.p_vaddr;
+    } else if (phdr.p_type == PT_NOTE && build_id_size < 0) {
+      // The notes are loaded, so they are read in place.
+      build_id_size = FindBuildIdInNotes(
+          reinterpret_cast<const char*>(info->dlpi_addr + phdr.p_vaddr),
+          phdr.p_memsz, build_id);
+    }
+  }
+  for (int i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+    if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_X)) {
+      continue;
+    }
+    // The load bias is the module base address: it is 0 for ET_EXEC, and
+    // for ET_DYN it is where the segment of file offset 0 is mapped minus
+    // its virtual address.
+    const uint64_t start_address = info->dlpi_addr + phdr.p_vaddr;
+    if (!builder->AddModule(start_address, start_address + phdr.p_memsz,
+                            info->dlpi_addr, eh_frame_hdr, path, path_length,
+                            build_id, build_id_size)) {
+      return 1;  // The table is full.
+    }
+  }
+  return 0;
+}
+
+// Record the executable segments of the loaded objects reported by
+// dl_iterate_phdr() into the module table. Returns false if the table is
+// full; the modules recorded so far are still published.
+static bool FillModuleTableWithDlIteratePhdr() {
+  ModuleTableBuilder builder;
+  const bool ok = dl_iterate_phdr(AddModulesOfLoadedObject, &builder) == 0;
+  builder.SortModules();
+  builder.Publish();
+  return ok;
+}
+
+// Find the symbol table section of "type" (SHT_SYMTAB or SHT_DYNSYM) and
+// its string table section in the ELF binary. Returns true on success.
+static bool GetSymbolTable(const ObjectFileReader& reader,
+                           const ElfW(Ehdr) & elf_header,
+                           ElfW(Word) type,
+                           ElfW(Shdr) * symtab,
+                           ElfW(Shdr) * strtab) {
+  return GetSectionHeaderByType(reader, elf_header.e_shnum,
+                                elf_header.e_shoff, type, symtab) &&
+         reader.ReadExact(
+             strtab, sizeof(*strtab),
+             elf_header.e_shoff + symtab->sh_link * sizeof(*symtab));
+}
+
+// Read the GNU build ID of the object file from its note sections into
+// "build_id", which has room for kMaxBuildIdSize bytes. Returns its size, or
+// -1 if not found.
+static int ReadBuildId(const ObjectFileReader& reader,
+                       const ElfW(Ehdr) & elf_header,
+                       uint8_t* build_id) {
+  for (int i = 0; i < elf_header.e_shnum; ++i) {
+    ElfW(Shdr) section;
+    if (!reader.ReadExact(&section, sizeof(section),
+                          elf_header.e_shoff + i * sizeof(section))) {
+      return -1;
+    }
+    if (section.sh_type != SHT_NOTE) {
+      continue;
+    }
+    char notes[1024];
+    const size_t notes_size = std::min<size_t>(section.sh_size, sizeof(notes));
+    if (!reader.ReadExact(notes, notes_size, section.sh_offset)) {
+      continue;
+    }
+    const int build_id_size = FindBuildIdInNotes(notes, notes_size, build_id);
+    if (build_id_size > 0) {
+      return build_id_size;
+    }
+  }
+  return -1;
+}
+
+// Returns the number of symbols in the symbol table section "symtab".
+static int GetNumSymbols(const ElfW(Shdr) & symtab) {
+  return symtab.sh_entsize == 0 ? 0 : symtab.sh_size / symtab.sh_entsize;
+}
+
+// Append the symbols in the symbol table "symtab" that may contain a pc to
+// "entries", which has room for "capacity" entries. Returns the number of
+// entries appended, or -1 on failure.
+static int AppendSymbolIndexEntries(const int fd,
+                                    const ElfW(Shdr) & symtab,
+                                    const ElfW(Shdr) & strtab,
+                                    SymbolIndexEntry* entries,
+                                    int capacity) {
+  const int num_symbols = GetNumSymbols(symtab);
+  int num_entries = 0;
+  for (int i = 0; i < num_symbols;) {
+    ElfW(Sym) buf[NUM_SYMBOLS];
+    int num_symbols_to_read = std::min(NUM_SYMBOLS, num_symbols - i);
+    const ssize_t len =
+        ReadFromOffset(fd, &buf, sizeof(buf[0]) * num_symbols_to_read,
+                       symtab.sh_offset + i * symtab.sh_entsize);
+    const ssize_t num_symbols_in_buf = len / sizeof(buf[0]);
+    if (len < 0 || num_symbols_in_buf == 0) {
+      return -1;
+    }
+    for (int j = 0; j < num_symbols_in_buf; ++j) {
+      const ElfW(Sym)& symbol = buf[j];
+      if (symbol.st_value == 0 ||  // Skip null value symbols.
+          symbol.st_shndx == 0 ||  // Skip undefined symbols.
+          symbol.st_size == 0) {  // Skip symbols that contain nothing.
+        continue;
+      }
+      const uint64_t name_offset = strtab.sh_offset + symbol.st_name;
+      if (num_entries == capacity ||
+          symbol.st_size > std::numeric_limits<uint32_t>::max() ||
+          name_offset > std::numeric_limits<uint32_t>::max()) {
+        return -1;
+      }
+      SymbolIndexEntry* entry = &entries[num_entries++];
+      entry->address = symbol.st_value;
+      entry->size = symbol.st_size;
+      entry->name_offset = name_offset;
+    }
+    i += num_symbols_in_buf;
+  }
+  return num_entries;
+}
+
+// Returns the number of symbols in the regular and dynamic symbol tables of
+// the object file "path", which is the maximum size of its symbol index.
+static int GetMaxSymbolIndexSize(const char* path) {
+  int fd;
+  NO_INTR(fd = open(path, O_RDONLY));
+  FileDescriptor wrapped_fd(fd);
+  ElfW(Ehdr) elf_header;
+  if (wrapped_fd.get() < 0 || FileGetElfType(wrapped_fd.get()) == -1 ||
+      !ReadFromOffsetExact(fd, &elf_header, sizeof(elf_header), 0)) {
+    return 0;
+  }
+  ObjectFileReader reader(fd, NULL);
+  int num_symbols = 0;
+  ElfW(Shdr) symtab, strtab;
+  if (GetSymbolTable(reader, elf_header, SHT_SYMTAB, &symtab, &strtab)) {
+    num_symbols += GetNumSymbols(symtab);
+  }
+  if (GetSymbolTable(reader, elf_header, SHT_DYNSYM, &symtab, &strtab)) {
+    num_symbols += GetNumSymbols(symtab);
+  }
+  return num_symbols;
+}
+
+// Build the symbol index of the object file "path" into "entries", which
+// has room for "capacity" entries. The entries are numbered in the order of
+// the regular symbol table then the dynamic symbol table, so that a lookup
+// prefers the same symbol as FindSymbols() does.
+// Returns the number of entries, or -1 on failure.
+static int BuildSymbolIndexOfObjectFile(const char* path,
+                                        SymbolIndexEntry* entries,
+                                        int capacity) {
+  int fd;
+  NO_INTR(fd = open(path, O_RDONLY));
+  FileDescriptor wrapped_fd(fd);
+  ElfW(Ehdr) elf_header;
+  if (wrapped_fd.get() < 0 || FileGetElfType(wrapped_fd.get()) == -1 ||
+      !ReadFromOffsetExact(fd, &elf_header, sizeof(elf_header), 0)) {
+    return -1;
+  }
+  ObjectFileReader reader(fd, NULL);
+  int num_entries = 0;
+  const ElfW(Word) types[] = {SHT_SYMTAB, SHT_DYNSYM};
+  for (ElfW(Word) type : types) {
+    ElfW(Shdr) symtab, strtab;
+    if (!GetSymbolTable(reader, elf_header, type, &symtab, &strtab)) {
+      continue;
+    }
+    const int num_appended =
+        AppendSymbolIndexEntries(fd, symtab, strtab, entries + num_entries,
+                                 capacity - num_entries);
+    if (num_appended < 0) {
+      return -1;
+    }
+    num_entries += num_appended;
+  }
+  for (int i = 0; i < num_entries; ++i) {
+    entries[i].order = i;
+  }
+  // This runs outside of signal handlers, so the temporary buffer that
+  // std::stable_sort() may allocate is fine.
+  std::stable_sort(entries, entries + num_entries,
+                   [](const SymbolIndexEntry& a, const SymbolIndexEntry& b) {
+                     return a.address < b.address;
+                   });
+  uint64_t end_address = 0;
+  for (int i = 0; i < num_entries; ++i) {
+    end_address = std::max(end_address, entries[i].address + entries[i].size);
+    entries[i].reach = end_address - entries[i].address;
+  }
+  return num_entries;
+}
+
+// Get the symbol names of the pcs in batch->pcs[begin, end) from the
+// object file. Process both regular and dynamic symbol tables if
+// necessary. The pcs whose symbol is found are marked as done.
+static void GetSymbolsFromObjectFile(const ObjectFileReader& reader,
+                                     PcBatch* batch,
+                                     int begin,
+                                     int end,
+                                     uint64_t base_address) {
+  // Read the ELF header.
+  ElfW(Ehdr) elf_header;
+  if (!reader.ReadExact(&elf_header, sizeof(elf_header), 0)) {
+    return;
+  }
+
+  ElfW(Shdr) symtab, strtab;
+
+  // Consult a regular symbol table first.
+  if (GetSymbolTable(reader, elf_header, SHT_SYMTAB, &symtab, &strtab) &&
+      FindSymbols(reader, base_address, &strtab, &symtab, batch, begin,
+                  end)) {
+    return;  // Found all symbols in a regular symbol table.
+  }
+
+  // If some symbols are not found, then consult a dynamic symbol table.
+  if (GetSymbolTable(reader, elf_header, SHT_DYNSYM, &symtab, &strtab)) {
+    FindSymbols(reader, base_address, &strtab, &symtab, batch, begin, end);
+  }
+}
+
+// Get the symbol names of the pcs in batch->pcs[begin, end) from the
+// object file, looking them up in the symbol index of "module". The pcs
+// whose symbol is found are marked as done.
+static void GetSymbolsFromSymbolIndex(const ObjectFileReader& reader,
+                                      const Module* module,
+                                      PcBatch* batch,
+                                      int begin,
+                                      int end) {
+  for (int k = begin; k < end; ++k) {
+    if (batch->done[k]) {
+      continue;
+    }
+    const SymbolIndexEntry* entry =
+        FindSymbolInIndex(module, batch->pcs[k] - module->base_address);
+    if (entry == NULL) {
+      continue;
+    }
+    off_t name_offset = entry->name_offset;
+    bool demangle = batch->demangle;
+    const SymbolIndexFile* index_file = module->symbol_index_file;
+    if (demangle && index_file != NULL && index_file->has_demangled_names) {
+      // The demangled name follows the symbol, and is empty if the symbol
+      // cannot be demangled. The string table ends with '\0'.
+      size_t size;
+      const char* name = reader.GetMapped(name_offset, &size);
+      const char* demangled_name =
+          name != NULL ? name + strlen(name) + 1 : NULL;
+      if (demangled_name != NULL &&
+          demangled_name < index_file->strings_end &&
+          demangled_name[0] != '\0') {
+        name_offset += demangled_name - name;
+        demangle = false;
+      }
+    }
+    if (WriteSymbolName(reader, name_offset, demangle, batch, k)) {
+      batch->done[k] = true;  // Obtained the symbol name.
+    }
+  }
+}
+
+// Write the instruction address of batch->pcs[k], relative to the module
+// base address, and mark it as done.
+static void WriteAddressNumberInBatch(PcBatch* batch,
+                                      int k,
+                                      uint64_t base_address) {
+  char* buffer = batch->buffers[k];
+  buffer[0] = '\0';
+  WriteAddressNumber(reinterpret_cast<void*>(batch->pcs[k]), base_address,
+                     buffer, batch->buffer_size);
+  if (batch->required_sizes[k] != NULL || batch->sink != NULL) {
+    char number[20] = {'\0'};  // "+0x" and up to 16 hex digits.
+    WriteAddressNumber(reinterpret_cast<void*>(batch->pcs[k]), base_address,
+                       number, sizeof(number));
+    if (batch->required_sizes[k] != NULL) {
+      *batch->required_sizes[k] = strlen(number) + 1;
+    }
+    if (batch->sink != NULL) {
+      SinkToBatch(number, strlen(number), batch);
+    }
+  }
+  batch->done[k] = true;
+}
+
+// Symbolize the pending pcs in batch->pcs[begin, end), which are all in the
+// same mapping of the object file "path" whose module base address is
+// "base_address". The object file is opened only once for all of them.
+// If "module" is not NULL and has a symbol index, the index is used instead
+// of walking the symbol tables; if its object file is mapped, it is read
+// from memory without being opened, or if it is pre-opened, it is read from
+// the pre-opened descriptor.
+static void SymbolizeInObjectFile(const char* path,
+                                  uint64_t base_address,
+                                  const Module* module,
+                                  PcBatch* batch,
+                                  int begin,
+                                  int end) {
+  bool has_pending = false;
+  for (int k = begin; k < end; ++k) {
+    has_pending |= !batch->done[k];
+  }
+  if (!has_pending) {
+    return;
+  }
+
+  const bool has_symbol_index = module != NULL && module->symbol_index != NULL;
+  if (has_symbol_index && module->symbol_index_file != NULL) {
+    // The names are in the string table of the symbol index file, so the
+    // object file is not read at all.
+    ObjectFileReader reader(-1, &module->symbol_index_file->strings);
+    GetSymbolsFromSymbolIndex(reader, module, batch, begin, end);
+  } else if (module != NULL && module->mapped_file != NULL) {
+    // The object file was verified when it was mapped.
+    ObjectFileReader reader(-1, module->mapped_file);
+    if (has_symbol_index) {
+      GetSymbolsFromSymbolIndex(reader, module, batch, begin, end);
+    } else {
+      GetSymbolsFromObjectFile(reader, batch, begin, end, base_address);
+    }
+  } else {
+    int object_file_fd = -1;
+    int opened_fd = -1;
+    if (module != NULL && module->fd >= 0) {
+      object_file_fd = module->fd;
+    } else {
+      NO_INTR(opened_fd = open(path, O_RDONLY));
+      object_file_fd = opened_fd;
+    }
+    FileDescriptor wrapped_opened_fd(opened_fd);
+    if (object_file_fd < 0) {
+      // The object file containing PC was determined successfully however
+      // not opened. This is still considered success and we write the
+      // instruction address.
+      for (int k = begin; k < end; ++k) {
+        if (!batch->done[k]) {
+          WriteAddressNumberInBatch(batch, k, base_address);
+        }
+      }
+      return;
+    }
+
+    ObjectFileReader reader(object_file_fd, NULL);
+    if (has_symbol_index) {
+      // The object file was verified when the index was built.
+      GetSymbolsFromSymbolIndex(reader, module, batch, begin, end);
+    } else {
+      // A pre-opened object file was verified when it was opened.
+      int elf_type = opened_fd < 0 ? ET_NONE : FileGetElfType(opened_fd);
+      if (elf_type == -1) {
+        // Give up, the buffers are left empty.
+        for (int k = begin; k < end; ++k) {
+          batch->done[k] = true;
+        }
+        return;
+      }
+      GetSymbolsFromObjectFile(reader, batch, begin, end, base_address);
+    }
+  }
+
+  for (int k = begin; k < end; ++k) {
+    if (!batch->done[k]) {
+      // The object file containing PC was opened successfully however the
+      // symbol was not found. The object may have been stripped, but this is
+      // still considered success and we write the instruction address.
+      WriteAddressNumberInBatch(batch, k, base_address);
+    }
+  }
+}
+
+// Symbolize the pending pcs in the batch that are covered by the module
+// table, grouping them by module.
+static void SymbolizeWithModuleTable(PcBatch* batch) {
+  for (int begin = 0; begin < batch->size;) {
+    const Module* module = FindModuleInTable(batch->pcs[begin]);
+    if (module == NULL) {
+      ++begin;
+      continue;
+    }
+    const int end =
+        LowerBound(batch, begin, batch->size, module->end_address);
+    SymbolizeInObjectFile(GetModulePath(module), module->base_address,
+                          module, batch, begin, end);
+    begin = end;
+  }
+}
+
+// Symbolize the pending pcs in the batch by walking /proc/self/maps once.
+// See http://man7.org/linux/man-pages/man5/proc.5.html for introduction.
+static void SymbolizeWithProcMaps(PcBatch* batch) {
+  int maps_fd;
+  NO_INTR(maps_fd = open("/proc/self/maps", O_RDONLY));
+  FileDescriptor wrapped_maps_fd(maps_fd);
+  if (wrapped_maps_fd.get() < 0) {
+    return;
+  }
+
+  int mem_fd;
+  NO_INTR(mem_fd = open("/proc/self/mem", O_RDONLY));
+  FileDescriptor wrapped_mem_fd(mem_fd);
+  if (wrapped_mem_fd.get() < 0) {
+    return;
+  }
+
+  // Iterate over maps and look for the maps containing the pcs.  Then
+  // look into the symbol tables inside.
+  char buf[1024];  // Big enough for line of sane /proc/self/maps
+  LineReader reader(wrapped_maps_fd.get(), buf, sizeof(buf), 0);
+  uint64_t base_address = 0;
+  const char* cursor;
+  const char* eol;
+  while (reader.ReadLine(&cursor, &eol)) {  // Until EOF or malformed line.
+    MapsLine map;
+    if (!ParseMapsLine(cursor, eol, &map)) {
+      return;  // Malformed line.
+    }
+
+    // Determine the base address by reading ELF headers in process memory.
+    MaybeUpdateBaseAddress(mem_fd, map, &base_address);
+
+    // Check flags.  We are only interested in "r*x" maps with an object
+    // file.
+    if (map.flags[0] != 'r' || map.flags[2] != 'x' || map.path == eol) {
+      continue;  // We skip this map.
+    }
+
+    // Check start and end addresses.
+    const int begin = LowerBound(batch, 0, batch->size, map.start_address);
+    const int end = LowerBound(batch, begin, batch->size, map.end_address);
+    if (begin == end) {
+      continue;  // We skip this map.  No pc is in this map.
+    }
+
+    SymbolizeInObjectFile(map.path, base_address, NULL, batch, begin, end);
+  }
+}
+
+// Symbolize the batch. The module table is consulted first, and the pcs
+// not covered by it are looked up in /proc/self/maps.
+static void SymbolizeBatchImpl(PcBatch* batch) {
+  for (int k = 0; k < batch->size; ++k) {
+    batch->buffers[k][0] = '\0';
+    batch->done[k] = false;
+    if (batch->required_sizes[k] != NULL) {
+      *batch->required_sizes[k] = 0;
+    }
+  }
+
+  SymbolizeWithModuleTable(batch);
+
+  bool has_pending = false;
+  for (int k = 0; k < batch->size; ++k) {
+    has_pending |= !batch->done[k];
+  }
+  if (has_pending) {
+    SymbolizeWithProcMaps(batch);
+  }
+
+  for (int k = 0; k < batch->size; ++k) {
+    if (!batch->done[k]) {
+      // The object file containing PC was not determined, e.g. PC is in an
+      // anonymous map or /proc/self/maps is not accessible. This is still
+      // considered success and we write the instruction address.
+      WriteAddressNumberInBatch(batch, k, 0);
+    }
+    // Make sure it is always '\0'-terminated.
+    batch->buffers[k][batch->buffer_size - 1] = '\0';
+  }
+}
+
+// Map the part of the file pointed by "fd" from "offset" of "size" bytes
+// read-only into "mapping". Returns true on success.
+static bool MapFileRange(const int fd,
+                         const off_t offset,
+                         const size_t size,
+                         FileMapping* mapping) {
+  static const off_t page_size = sysconf(_SC_PAGESIZE);
+  const off_t aligned_offset = offset - offset % page_size;
+  const size_t aligned_size = size + (offset - aligned_offset);
+  void* data =
+      mmap(NULL, aligned_size, PROT_READ, MAP_PRIVATE, fd, aligned_offset);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  mapping->data = reinterpret_cast<const char*>(data);
+  mapping->offset = aligned_offset;
+  mapping->size = aligned_size;
+  return true;
+}
+
+// Map the parts of the object file "path" that are read to symbolize into
+// "mapped_file". Returns false if it is not an ELF binary or the ELF header
+// or section headers cannot be mapped. A missing symbol table is fine.
+static bool MapObjectFile(const char* path, MappedObjectFile* mapped_file) {
+  for (FileMapping& mapping : mapped_file->mappings) {
+    mapping.data = NULL;
+  }
+  int fd;
+  NO_INTR(fd = open(path, O_RDONLY));
+  FileDescriptor wrapped_fd(fd);  // The mappings outlive the descriptor.
+  ElfW(Ehdr) elf_header;
+  if (wrapped_fd.get() < 0 || FileGetElfType(wrapped_fd.get()) == -1 ||
+      !ReadFromOffsetExact(fd, &elf_header, sizeof(elf_header), 0)) {
+    return false;
+  }
+  FileMapping* mappings = mapped_file->mappings;
+  if (!MapFileRange(fd, 0, sizeof(elf_header),
+                    &mappings[MappedObjectFile::kElfHeader]) ||
+      !MapFileRange(fd, elf_header.e_shoff,
+                    elf_header.e_shnum * sizeof(ElfW(Shdr)),
+                    &mappings[MappedObjectFile::kSectionHeaders])) {
+    return false;
+  }
+  ObjectFileReader reader(fd, mapped_file);
+  ElfW(Shdr) symtab, strtab;
+  if (GetSymbolTable(reader, elf_header, SHT_SYMTAB, &symtab, &strtab)) {
+    MapFileRange(fd, symtab.sh_offset, symtab.sh_size,
+                 &mappings[MappedObjectFile::kSymtab]);
+    MapFileRange(fd, strtab.sh_offset, strtab.sh_size,
+                 &mappings[MappedObjectFile::kStrtab]);
+  }
+  if (GetSymbolTable(reader, elf_header, SHT_DYNSYM, &symtab, &strtab)) {
+    MapFileRange(fd, symtab.sh_offset, symtab.sh_size,
+                 &mappings[MappedObjectFile::kDynsym]);
+    MapFileRange(fd, strtab.sh_offset, strtab.sh_size,
+                 &mappings[MappedObjectFile::kDynstr]);
+  }
+  return true;
+}
+
+// Write the path of the symbol index file of the build ID in "directory",
+// i.e. "<directory>/<build ID in hex>.symidx", into "path", which has room
+// for PATH_MAX bytes. Returns false if it is too long.
+static bool GetSymbolIndexFilePath(const char* directory,
+                                   const uint8_t* build_id,
+                                   int build_id_size,
+                                   char* path) {
+  static const char kSuffix[] = ".symidx";
+  const size_t directory_length = strlen(directory);
+  if (directory_length + 1 + build_id_size * 2 + sizeof(kSuffix) > PATH_MAX) {
+    return false;
+  }
+  char* cursor = path;
+  memcpy(cursor, directory, directory_length);
+  cursor += directory_length;
+  *cursor++ = '/';
+  for (int i = 0; i < build_id_size; ++i) {
+    *cursor++ = "0123456789abcdef"[build_id[i] >> 4];
+    *cursor++ = "0123456789abcdef"[build_id[i] & 0xf];
+  }
+  memcpy(cursor, kSuffix, sizeof(kSuffix));
+  return true;
+}
+
+// Read the ELF header and the build ID of the object file "fd" into
+// "elf_header" and "build_id", which has room for kMaxBuildIdSize bytes.
+// Returns the size of the build ID, or -1 if it is not an ELF binary or has
+// no build ID.
+static int ReadBuildIdOfObjectFile(const int fd,
+                                   ElfW(Ehdr) * elf_header,
+                                   uint8_t* build_id) {
+  if (fd < 0 || FileGetElfType(fd) == -1 ||
+      !ReadFromOffsetExact(fd, elf_header, sizeof(*elf_header), 0)) {
+    return -1;
+  }
+  ObjectFileReader reader(fd, NULL);
+  return ReadBuildId(reader, *elf_header, build_id);
+}
+
+// Append the '\0'-terminated string at "offset" in the object file, with
+// its '\0', to "strings". Returns false if it cannot be read.
+static bool AppendString(const ObjectFileReader& reader,
+                         const off_t offset,
+                         std::vector<char>* strings) {
+  const ssize_t length = ReadStringLength(reader, offset);
+  if (length < 0) {
+    return false;
+  }
+  const size_t position = strings->size();
+  strings->resize(position + length + 1);
+  return reader.ReadExact(strings->data() + position, length + 1, offset);
+}
+
+// Append the demangled name of the '\0'-terminated symbol at "position" in
+// "strings", with its '\0', to "strings". The name is empty if the symbol
+// cannot be demangled. The name is the same as what SymbolizeAndDemangle()
+// gives, i.e. with the default flags.
+static void AppendDemangledName(size_t position, std::vector<char>* strings) {
+  size_t required_size = 0;
+  itanium::Demangle(strings->data() + position, NULL, 0, &required_size);
+  const size_t demangled_position = strings->size();
+  strings->resize(demangled_position + std::max<size_t>(required_size, 1));
+  if (required_size == 0 ||
+      !itanium::Demangle(strings->data() + position,
+                         strings->data() + demangled_position,
+                         required_size)) {
+    strings->resize(demangled_position + 1);
+    (*strings)[demangled_position] = '\0';
+  }
+}
+
+// Write the data to the file descriptor, retrying on short writes and
+// interruptions. Returns false on error.
+static bool WriteToFile(const int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t len;
+    NO_INTR(len = write(fd, data, size));
+    if (len <= 0) {
+      return false;
+    }
+    data += len;
+    size -= len;
+  }
+  return true;
+}
+
+// Map the symbol index file "path" into "index_file", and check it is of
+// the build ID. Returns false if it cannot be mapped or is malformed.
+static bool MapSymbolIndexFile(const char* path,
+                               const uint8_t* build_id,
+                               int build_id_size,
+                               SymbolIndexFile* index_file) {
+  int fd;
+  NO_INTR(fd = open(path, O_RDONLY | O_CLOEXEC));
+  FileDescriptor wrapped_fd(fd);
+  struct stat file_stat;
+  if (wrapped_fd.get() < 0 || fstat(fd, &file_stat) != 0 ||
+      file_stat.st_size < static_cast<off_t>(sizeof(SymbolIndexFileHeader))) {
+    return false;
+  }
+  // Shared, so that the processes mapping the file share its pages in the
+  // page cache.
+  const size_t size = file_stat.st_size;
+  void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  const char* file = reinterpret_cast<const char*>(data);
+  const SymbolIndexFileHeader* header =
+      reinterpret_cast<const SymbolIndexFileHeader*>(file);
+  if (memcmp(header->magic, kSymbolIndexFileMagic, sizeof(header->magic)) ||
+      header->build_id_size != static_cast<uint32_t>(build_id_size) ||
+      memcmp(header->build_id, build_id, build_id_size) ||
+      header->entries_offset % alignof(SymbolIndexEntry) != 0 ||
+      header->entries_offset > size ||
+      header->num_entries >
+          (size - header->entries_offset) / sizeof(SymbolIndexEntry) ||
+      header->num_entries >
+          static_cast<uint64_t>(std::numeric_limits<int>::max()) ||
+      header->strings_offset > size || header->strings_size == 0 ||
+      header->strings_size > size - header->strings_offset ||
+      file[header->strings_offset + header->strings_size - 1] != '\0') {
+    munmap(data, size);
+    return false;
+  }
+  index_file->file.data = file;
+  index_file->file.offset = 0;
+  index_file->file.size = size;
+  for (FileMapping& mapping : index_file->strings.mappings) {
+    mapping.data = NULL;
+  }
+  FileMapping* strings =
+      &index_file->strings.mappings[MappedObjectFile::kStrtab];
+  strings->data = file + header->strings_offset;
+  strings->offset = 0;
+  strings->size = header->strings_size;
+  index_file->strings_end = strings->data + strings->size;
+  index_file->has_demangled_names =
+      header->flags & kSymbolIndexHasDemangledNames;
+  return true;
+}
+
+bool internal::MayBeCodeAddress(uint64_t address) {
+  return g_module_table.num_modules.load(std::memory_order_acquire) == 0 ||
+         FindModuleInTable(address) != NULL;
+}
+
+uint64_t internal::FindEhFrameHdr(uint64_t address) {
+  const Module* module = FindModuleInTable(address);
+  return module != NULL ? module->eh_frame_hdr : 0;
+}
+
+EXPORT bool InitModuleTable(ModuleDiscovery discovery) {
+  switch (discovery) {
+    case kDiscoverByProcMaps:
+      return FillModuleTableFromProcMaps();
+    case kDiscoverByDlIteratePhdr:
+      return FillModuleTableWithDlIteratePhdr();
+  }
+  return false;
+}
+
+EXPORT bool MapObjectFiles() {
+  ModuleTable* table = &g_module_table;
+  const int num_modules = table->num_modules.load(std::memory_order_acquire);
+
+  // Drop the mappings made previously.
+  for (int i = 0; i < num_modules; ++i) {
+    table->modules[i].mapped_file = NULL;
+  }
+  UnmapObjectFiles();
+
+  bool ok = true;
+  for (int i = 0; i < num_modules; ++i) {
+    Module* module = &table->modules[i];
+    if (i > 0 && module->path_offset == (module - 1)->path_offset) {
+      // Same object file as the previous module, share the mappings.
+      module->mapped_file = (module - 1)->mapped_file;
+      continue;
+    }
+    if (g_num_mapped_object_files == kMaxMappedObjectFiles) {
+      ok = false;
+      break;
+    }
+    MappedObjectFile* mapped_file =
+        &g_mapped_object_files[g_num_mapped_object_files];
+    if (!MapObjectFile(GetModulePath(module), mapped_file)) {
+      ok = false;  // This module is read with pread().
+      continue;
+    }
+    ++g_num_mapped_object_files;
+    module->mapped_file = mapped_file;
+  }
+  return ok;
+}
+
+EXPORT bool OpenObjectFiles() {
+  ModuleTable* table = &g_module_table;
+  const int num_modules = table->num_modules.load(std::memory_order_acquire);
+
+  // Drop the descriptors opened previously.
+  for (int i = 0; i < num_modules; ++i) {
+    table->modules[i].fd = -1;
+  }
+  CloseObjectFiles();
+
+  bool ok = true;
+  for (int i = 0; i < num_modules; ++i) {
+    Module* module = &table->modules[i];
+    if (i > 0 && module->path_offset == (module - 1)->path_offset) {
+      // Same object file as the previous module, share the descriptor.
+      module->fd = (module - 1)->fd;
+      continue;
+    }
+    if (g_num_object_file_fds == kMaxOpenObjectFiles) {
+      ok = false;
+      break;
+    }
+    int fd;
+    NO_INTR(fd = open(GetModulePath(module), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+      ok = false;  // This module is opened on lookup.
+      continue;
+    }
+    if (FileGetElfType(fd) == -1) {
+      close(fd);
+      ok = false;
+      continue;
+    }
+    g_object_file_fds[g_num_object_file_fds++] = fd;
+    module->fd = fd;
+  }
+  return ok;
+}
+
+EXPORT bool BuildSymbolIndex(void* memory, size_t memory_size) {
+  ModuleTable* table = &g_module_table;
+  const int num_modules = table->num_modules.load(std::memory_order_acquire);
+
+  // Drop the indices built previously, as their memory may be reused. The
+  // indices loaded from files are kept.
+  for (int i = 0; i < num_modules; ++i) {
+    if (table->modules[i].symbol_index_file == NULL) {
+      table->modules[i].symbol_index = NULL;
+      table->modules[i].symbol_index_size = 0;
+    }
+  }
+  UnmapSymbolIndex();
+
+  if (memory == NULL) {
+    memory_size = 0;
+    for (int i = 0; i < num_modules; ++i) {
+      const Module* module = &table->modules[i];
+      if ((i > 0 && module->path_offset == (module - 1)->path_offset) ||
+          module->symbol_index_file != NULL) {
+        continue;  // Same object file as the previous module, or indexed.
+      }
+      memory_size += GetMaxSymbolIndexSize(GetModulePath(module)) *
+                     sizeof(SymbolIndexEntry);
+    }
+    if (memory_size == 0) {
+      return true;  // Nothing to index.
+    }
+    memory = mmap(NULL, memory_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      return false;
+    }
+    g_symbol_index_mapping = memory;
+    g_symbol_index_mapping_size = memory_size;
+  }
+
+  // Align the entries.
+  const uintptr_t misalignment =
+      reinterpret_cast<uintptr_t>(memory) % alignof(SymbolIndexEntry);
+  const size_t padding =
+      misalignment ? alignof(SymbolIndexEntry) - misalignment : 0;
+  if (memory_size < padding) {
+    return false;
+  }
+  SymbolIndexEntry* entries = reinterpret_cast<SymbolIndexEntry*>(
+      reinterpret_cast<char*>(memory) + padding);
+  size_t capacity =
+      std::min<size_t>((memory_size - padding) / sizeof(SymbolIndexEntry),
+                       std::numeric_limits<int>::max());
+
+  bool ok = true;
+  for (int i = 0; i < num_modules; ++i) {
+    Module* module = &table->modules[i];
+    if (module->symbol_index_file != NULL) {
+      continue;  // Indexed by a file.
+    }
+    if (i > 0 && module->path_offset == (module - 1)->path_offset) {
+      // Same object file as the previous module, share the index.
+      module->symbol_index = (module - 1)->symbol_index;
+      module->symbol_index_size = (module - 1)->symbol_index_size;
+      continue;
+    }
+    const int num_entries =
+        BuildSymbolIndexOfObjectFile(GetModulePath(module), entries, capacity);
+    if (num_entries < 0) {
+      ok = false;  // Symbols in this module are looked up linearly.
+      continue;
+    }
+    module->symbol_index = entries;
+    module->symbol_index_size = num_entries;
+    entries += num_entries;
+    capacity -= num_entries;
+  }
+  return ok;
+}
+
+EXPORT bool WriteSymbolIndexFile(const char* object_file,
+                                 const char* directory,
+                                 bool demangle) {
+  int fd;
+  NO_INTR(fd = open(object_file, O_RDONLY));
+  FileDescriptor wrapped_fd(fd);
+  ElfW(Ehdr) elf_header;
+  SymbolIndexFileHeader header;
+  memset(&header, 0, sizeof(header));
+  const int build_id_size =
+      ReadBuildIdOfObjectFile(wrapped_fd.get(), &elf_header, header.build_id);
+  char path[PATH_MAX];
+  if (build_id_size < 0 ||
+      !GetSymbolIndexFilePath(directory, header.build_id, build_id_size,
+                              path)) {
+    return false;
+  }
+
+  std::vector<SymbolIndexEntry> entries(GetMaxSymbolIndexSize(object_file));
+  const int num_entries =
+      BuildSymbolIndexOfObjectFile(object_file, entries.data(), entries.size());
+  if (num_entries < 0) {
+    return false;
+  }
+  entries.resize(num_entries);
+
+  // Copy the names to the string table of the index, reading them from the
+  // mapped string tables of the object file if it can be mapped.
+  MappedObjectFile mapped_file;
+  const bool mapped = MapObjectFile(object_file, &mapped_file);
+  ObjectFileReader reader(fd, mapped ? &mapped_file : NULL);
+  std::vector<char> strings;
+  bool ok = true;
+  for (SymbolIndexEntry& entry : entries) {
+    const size_t position = strings.size();
+    if (!AppendString(reader, entry.name_offset, &strings)) {
+      ok = false;
+      break;
+    }
+    if (demangle) {
+      AppendDemangledName(position, &strings);
+    }
+    entry.name_offset = position;
+  }
+  if (mapped) {
+    UnmapObjectFile(&mapped_file);
+  }
+  if (!ok || strings.size() > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+  if (strings.empty()) {
+    strings.push_back('\0');  // The string table ends with '\0'.
+  }
+
+  memcpy(header.magic, kSymbolIndexFileMagic, sizeof(header.magic));
+  header.flags = demangle ? kSymbolIndexHasDemangledNames : 0;
+  header.build_id_size = build_id_size;
+  header.num_entries = entries.size();
+  header.entries_offset = sizeof(header);
+  header.strings_offset =
+      header.entries_offset + entries.size() * sizeof(SymbolIndexEntry);
+  header.strings_size = strings.size();
+
+  // Write to a temporary file and rename it, so that a process never maps
+  // a partially written file, and those that mapped the file replaced keep
+  // it.
+  char temp_path[PATH_MAX + 8];
+  memcpy(temp_path, path, strlen(path));
+  memcpy(temp_path + strlen(path), ".XXXXXX", sizeof(".XXXXXX"));
+  const int temp_fd = mkstemp(temp_path);
+  if (temp_fd < 0) {
+    return false;
+  }
+  ok = fchmod(temp_fd, 0644) == 0 &&
+       WriteToFile(temp_fd, reinterpret_cast<const char*>(&header),
+                   sizeof(header)) &&
+       WriteToFile(temp_fd, reinterpret_cast<const char*>(entries.data()),
+                   entries.size() * sizeof(SymbolIndexEntry)) &&
+       WriteToFile(temp_fd, strings.data(), strings.size());
+  ok = close(temp_fd) == 0 && ok && rename(temp_path, path) == 0;
+  if (!ok) {
+    unlink(temp_path);
+  }
+  return ok;
+}
+
+EXPORT int LoadSymbolIndexFiles(const char* directory) {
+  ModuleTable* table = &g_module_table;
+  const int num_modules = table->num_modules.load(std::memory_order_acquire);
+
+  // Drop the files loaded previously.
+  for (int i = 0; i < num_modules; ++i) {
+    Module* module = &table->modules[i];
+    if (module->symbol_index_file != NULL) {
+      module->symbol_index = NULL;
+      module->symbol_index_size = 0;
+      module->symbol_index_file = NULL;
+    }
+  }
+  UnmapSymbolIndexFiles();
+
+  for (int i = 0; i < num_modules; ++i) {
+    Module* module = &table->modules[i];
+    if (i > 0 && module->path_offset == (module - 1)->path_offset) {
+      // Same object file as the previous module, share the file.
+      if ((module - 1)->symbol_index_file != NULL) {
+        module->symbol_index = (module - 1)->symbol_index;
+        module->symbol_index_size = (module - 1)->symbol_index_size;
+        module->symbol_index_file = (module - 1)->symbol_index_file;
+      }
+      continue;
+    }
+    if (g_num_symbol_index_files == kMaxSymbolIndexFiles) {
+      break;
+    }
+    int fd;
+    NO_INTR(fd = open(GetModulePath(module), O_RDONLY | O_CLOEXEC));
+    FileDescriptor wrapped_fd(fd);
+    ElfW(Ehdr) elf_header;
+    uint8_t build_id[kMaxBuildIdSize];
+    const int build_id_size =
+        ReadBuildIdOfObjectFile(wrapped_fd.get(), &elf_header, build_id);
+    char path[PATH_MAX];
+    SymbolIndexFile* index_file =
+        &g_symbol_index_files[g_num_symbol_index_files];
+    if (build_id_size < 0 ||
+        !GetSymbolIndexFilePath(directory, build_id, build_id_size, path) ||
+        !MapSymbolIndexFile(path, build_id, build_id_size, index_file)) {
+      continue;  // This module keeps its symbol index, if any.
+    }
+    ++g_num_symbol_index_files;
+    const SymbolIndexFileHeader* header =
+        reinterpret_cast<const SymbolIndexFileHeader*>(index_file->file.data);
+    module->symbol_index = reinterpret_cast<const SymbolIndexEntry*>(
+        index_file->file.data + header->entries_offset);
+    module->symbol_index_size = header->num_entries;
+    module->symbol_index_file = index_file;
+  }
+  return g_num_symbol_index_files;
+}
+
+// Symbolizes one address. If "required_size" is not NULL, a buffer smaller
+// than 5 bytes is allowed: the result is written to a small buffer first
+// and then truncated.
+static bool SymbolizeAddress(void* address,
+                             char* buffer,
+                             size_t buffer_size,
+                             size_t* required_size,
+                             bool demangle) {
+  char small_buffer[5];
+  char* output = buffer;
+  if (buffer_size < sizeof(small_buffer)) {
+    if (required_size == NULL) {
+      return false;
+    }
+    output = small_buffer;
+  }
+
+  PcBatch batch;
+  batch.pcs[0] = reinterpret_cast<uint64_t>(address);
+  batch.buffers[0] = output;
+  batch.required_sizes[0] = required_size;
+  batch.size = 1;
+  batch.buffer_size = output == buffer
+                          ? std::min<size_t>(buffer_size,
+                                             std::numeric_limits<int>::max())
+                          : sizeof(small_buffer);
+  batch.demangle = demangle;
+  batch.sink = NULL;
+  SymbolizeBatchImpl(&batch);
+  if (output != buffer && buffer_size > 0) {
+    memcpy(buffer, small_buffer, buffer_size);
+    buffer[buffer_size - 1] = '\0';
+  }
+  return output[0] != '\0';
+}
+
+// Symbolizes one address, giving the name to the sink.
+static bool SymbolizeAddressToSink(void* address,
+                                   OutputSink sink,
+                                   void* sink_context,
+                                   bool demangle) {
+  // Receives what is written to the buffer, which is not used.
+  char unused_buffer[5];
+
+  PcBatch batch;
+  batch.pcs[0] = reinterpret_cast<uint64_t>(address);
+  batch.buffers[0] = unused_buffer;
+  batch.required_sizes[0] = NULL;
+  batch.size = 1;
+  batch.buffer_size = sizeof(unused_buffer);
+  batch.demangle = demangle;
+  batch.sink = sink;
+  batch.sink_context = sink_context;
+  batch.sink_size = 0;
+  SymbolizeBatchImpl(&batch);
+  return batch.sink_size > 0;
 }
 
-#elif defined(OS_MACOS)
-
 EXPORT bool Symbolize(void* address, char* buffer, size_t buffer_size) {
+  return SymbolizeAddress(address, buffer, buffer_size, NULL, false);
+}
+
+EXPORT bool Symbolize(void* address, OutputSink sink, void* sink_context) {
+  return SymbolizeAddressToSink(address, sink, sink_context, false);
+}
+
+EXPORT bool Symbolize(void* address,
+                      char* buffer,
+                      size_t buffer_size,
+                      size_t* required_size) {
+  return SymbolizeAddress(address, buffer, buffer_size, required_size, false);
+}
+
+EXPORT bool SymbolizeAndDemangle(void* address,
+                                 char* buffer,
+                                 size_t buffer_size) {
+  return SymbolizeAddress(address, buffer, buffer_size, NULL, true);
+}
+
+EXPORT bool SymbolizeAndDemangle(void* address,
+                                 char* buffer,
+                                 size_t buffer_size,
+                                 size_t* required_size) {
+  return SymbolizeAddress(address, buffer, buffer_size, required_size, true);
+}
+
+EXPORT bool SymbolizeAndDemangle(void* address,
+                                 OutputSink sink,
+                                 void* sink_context) {
+  return SymbolizeAddressToSink(address, sink, sink_context, true);
+}
+
+EXPORT size_t SymbolizeBatch(void* const* addresses,
+                             size_t n,
+                             char* buffers,
+                             size_t buffer_size) {
+  if (buffer_size < 5) {
+    return 0;
+  }
+
+  size_t num_symbolized = 0;
+  for (size_t offset = 0; offset < n; offset += kMaxBatchSize) {
+    PcBatch batch;
+    batch.size = std::min<size_t>(n - offset, kMaxBatchSize);
+    batch.buffer_size = std::min<size_t>(buffer_size,
+                                         std::numeric_limits<int>::max());
+    batch.demangle = false;
+    batch.sink = NULL;
+    // Insertion sort, as the batch is small.
+    for (int k = 0; k < batch.size; ++k) {
+      const uint64_t pc = reinterpret_cast<uint64_t>(addresses[offset + k]);
+      char* const buffer = buffers + (offset + k) * buffer_size;
+      int i = k;
+      for (; i > 0 && batch.pcs[i - 1] > pc; --i) {
+        batch.pcs[i] = batch.pcs[i - 1];
+        batch.buffers[i] = batch.buffers[i - 1];
+      }
+      batch.pcs[i] = pc;
+      batch.buffers[i] = buffer;
+      batch.required_sizes[k] = NULL;
+    }
+    SymbolizeBatchImpl(&batch);
+    for (int k = 0; k < batch.size; ++k) {
+      num_symbolized += batch.buffers[k][0] != '\0';
+    }
+  }
+  return num_symbolized;
+}
+
+EXPORT size_t RecordRawTrace(void* const* addresses,
+                             size_t n,
+                             void* buffer,
+                             size_t buffer_size) {
+  char* const out = static_cast<char*>(buffer);
+  if (n >= kRawTraceNoModule || buffer_size < kRawTraceHeaderSize ||
+      (buffer_size - kRawTraceHeaderSize) / kRawTraceFrameSize < n) {
+    return 0;
+  }
+  char* const frames = out + kRawTraceHeaderSize;
+  size_t size = kRawTraceHeaderSize + n * kRawTraceFrameSize;
+  uint32_t num_modules = 0;
+  // The index in the module table of the first module found of each module
+  // in the trace.
+  uint16_t trace_modules[kMaxModules];
+  for (size_t i = 0; i < n; ++i) {
+    const uint64_t pc = reinterpret_cast<uint64_t>(addresses[i]);
+    const Module* module = FindModuleInTable(pc);
+    uint64_t offset = pc;
+    uint32_t module_index = kRawTraceNoModule;
+    // Code without an object file, e.g. JIT code, can not be symbolized
+    // offline, so its address is recorded as it is.
+    if (module != NULL && GetModulePath(module)[0] != '\0') {
+      offset = pc - module->base_address;
+      // Look for the module among those already in the trace, which are
+      // few. The modules of an object file share the path, and are one
+      // module in the trace.
+      for (uint32_t k = 0; k < num_modules; ++k) {
+        const Module* other = &g_module_table.modules[trace_modules[k]];
+        if (other->path_offset == module->path_offset &&
+            other->base_address == module->base_address) {
+          module_index = k;
+          break;
+        }
+      }
+      if (module_index == kRawTraceNoModule) {
+        const size_t module_size =
+            kRawTraceModuleHeaderSize + module->build_id_size;
+        if (buffer_size - size < module_size) {
+          return 0;
+        }
+        memcpy(out + size, &module->base_address, sizeof(uint64_t));
+        out[size + 8] = static_cast<char>(module->build_id_size);
+        memcpy(out + size + kRawTraceModuleHeaderSize,
+               g_module_table.path_pool + module->build_id_offset,
+               module->build_id_size);
+        size += module_size;
+        trace_modules[num_modules] = module - g_module_table.modules;
+        module_index = num_modules++;
+      }
+    }
+    memcpy(frames + i * kRawTraceFrameSize, &offset, sizeof(offset));
+    memcpy(frames + i * kRawTraceFrameSize + 8, &module_index,
+           sizeof(module_index));
+  }
+  const uint32_t num_frames = n;
+  memcpy(out, kRawTraceMagic, sizeof(kRawTraceMagic));
+  memcpy(out + 8, &num_frames, sizeof(num_frames));
+  memcpy(out + 12, &num_modules, sizeof(num_modules));
+  return size;
+}
+
+EXPORT int GetBuildId(const char* object_file, uint8_t* build_id) {
+  int fd;
+  NO_INTR(fd = open(object_file, O_RDONLY));
+  FileDescriptor wrapped_fd(fd);
+  ElfW(Ehdr) elf_header;
+  return ReadBuildIdOfObjectFile(wrapped_fd.get(), &elf_header, build_id);
+}
+
+EXPORT size_t SymbolizeOffsets(const char* object_file,
+                               const uint64_t* offsets,
+                               size_t n,
+                               char* buffers,
+                               size_t buffer_size,
+                               bool demangle) {
+  if (buffer_size < 5) {
+    return 0;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    buffers[i * buffer_size] = '\0';
+  }
+  std::vector<SymbolIndexEntry> entries(GetMaxSymbolIndexSize(object_file));
+  const int num_entries =
+      BuildSymbolIndexOfObjectFile(object_file, entries.data(), entries.size());
+  if (num_entries < 0) {
+    return 0;
+  }
+
+  // A module of the object file with base address 0, so that the offsets
+  // are looked up in the symbol index as they are.
+  Module module;
+  memset(&module, 0, sizeof(module));
+  module.symbol_index = entries.data();
+  module.symbol_index_size = num_entries;
+  module.fd = -1;
+  int fd;
+  NO_INTR(fd = open(object_file, O_RDONLY));
+  FileDescriptor wrapped_fd(fd);
+  MappedObjectFile mapped_file;
+  const bool mapped = MapObjectFile(object_file, &mapped_file);
+  ObjectFileReader reader(wrapped_fd.get(), mapped ? &mapped_file : NULL);
+
+  size_t num_symbolized = 0;
+  for (size_t first = 0; first < n; first += kMaxBatchSize) {
+    PcBatch batch;
+    batch.size = std::min<size_t>(n - first, kMaxBatchSize);
+    batch.buffer_size = std::min<size_t>(buffer_size,
+                                         std::numeric_limits<int>::max());
+    batch.demangle = demangle;
+    batch.sink = NULL;
+    // The symbol index does not need the pcs to be sorted.
+    for (int k = 0; k < batch.size; ++k) {
+      batch.pcs[k] = offsets[first + k];
+      batch.buffers[k] = buffers + (first + k) * buffer_size;
+      batch.required_sizes[k] = NULL;
+      batch.done[k] = false;
+    }
+    GetSymbolsFromSymbolIndex(reader, &module, &batch, 0, batch.size);
+    for (int k = 0; k < batch.size; ++k) {
+      if (!batch.done[k]) {
+        WriteAddressNumberInBatch(&batch, k, /*base_address=*/0);
+      }
+      num_symbolized += batch.buffers[k][0] != '\0';
+    }
+  }
+  if (mapped) {
+    UnmapObjectFile(&mapped_file);
+  }
+  return num_symbolized;
+}
+
+#elif defined(OS_MACOS)
+
+EXPORT bool InitModuleTable(ModuleDiscovery discovery) {
+  return true;  // dladdr() does not need a module table.
+}
+
+EXPORT bool BuildSymbolIndex(void* memory, size_t memory_size) {
+  return true;  // dladdr() does not use a symbol index.
+}
+
+EXPORT bool MapObjectFiles() {
+  return true;  // dladdr() does not read object files.
+}
+
+EXPORT bool WriteSymbolIndexFile(const char* object_file,
+                                 const char* directory,
+                                 bool demangle) {
+  return false;  // dladdr() does not use a symbol index.
+}
+
+EXPORT int LoadSymbolIndexFiles(const char* directory) {
+  return 0;  // dladdr() does not use a symbol index.
+}
+
+EXPORT bool OpenObjectFiles() {
+  return true;  // dladdr() does not open object files.
+}
+
+EXPORT size_t RecordRawTrace(void* const* addresses,
+                             size_t n,
+                             void* buffer,
+                             size_t buffer_size) {
+  return 0;  // There is no module table.
+}
+
+EXPORT int GetBuildId(const char* object_file, uint8_t* build_id) {
+  return -1;  // Mach-O binaries have a UUID instead.
+}
+
+EXPORT size_t SymbolizeOffsets(const char* object_file,
+                               const uint64_t* offsets,
+                               size_t n,
+                               char* buffers,
+                               size_t buffer_size,
+                               bool demangle) {
+  return 0;  // dladdr() only looks up loaded images.
+}
+
+static unsigned GetModuleTableGeneration() {
+  return 0;  // There is no module table.
+}
+
+EXPORT bool Symbolize(void* address,
+                      char* buffer,
+                      size_t buffer_size,
+                      size_t* required_size) {
   Dl_info info;
+  if (required_size != NULL) {
+    *required_size = 0;
+  }
   // If an image containing addr cannot be found, dladdr() returns 0. On success
   // it returns a non-zero value.
   // https://developer.apple.com/library/archive/documentation/System/Conceptual/ManPages_iPhoneOS/man3/dladdr.3.html
   if (dladdr(address, &info) && info.dli_sname) {
     // If the buffer is not large enough, we still copy the symbol to it, though
     // the copied content would be incomplete and would be not demangle-able.
-    memcpy(buffer, info.dli_sname, buffer_size);
-    buffer[buffer_size - 1] = '\0';
+    const size_t size = strlen(info.dli_sname) + 1;
+    if (required_size != NULL) {
+      *required_size = size;
+    }
+    if (buffer_size > 0) {
+      memcpy(buffer, info.dli_sname, std::min(size, buffer_size));
+      buffer[buffer_size - 1] = '\0';
+    }
+    return true;
+  }
+  return false;
+}
+
+EXPORT bool Symbolize(void* address, char* buffer, size_t buffer_size) {
+  return Symbolize(address, buffer, buffer_size, NULL);
+}
+
+EXPORT bool SymbolizeAndDemangle(void* address,
+                                 char* buffer,
+                                 size_t buffer_size,
+                                 size_t* required_size) {
+  Dl_info info;
+  if (required_size != NULL) {
+    *required_size = 0;
+  }
+  if (dladdr(address, &info) && info.dli_sname) {
+    if (!itanium::Demangle(info.dli_sname, buffer, buffer_size,
+                           required_size)) {
+      // Not a mangled name, or too long to demangle into the buffer.
+      if (required_size != NULL && *required_size == 0) {
+        *required_size = strlen(info.dli_sname) + 1;
+      }
+      if (buffer_size > 0) {
+        strncpy(buffer, info.dli_sname, buffer_size);
+        buffer[buffer_size - 1] = '\0';
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+EXPORT bool SymbolizeAndDemangle(void* address,
+                                 char* buffer,
+                                 size_t buffer_size) {
+  return SymbolizeAndDemangle(address, buffer, buffer_size, NULL);
+}
+
+EXPORT bool Symbolize(void* address, OutputSink sink, void* sink_context) {
+  Dl_info info;
+  if (dladdr(address, &info) && info.dli_sname && info.dli_sname[0]) {
+    sink(info.dli_sname, strlen(info.dli_sname), sink_context);
     return true;
   }
   return false;
 }
 
+EXPORT bool SymbolizeAndDemangle(void* address,
+                                 OutputSink sink,
+                                 void* sink_context) {
+  Dl_info info;
+  if (dladdr(address, &info) && info.dli_sname && info.dli_sname[0]) {
+    if (!itanium::Demangle(info.dli_sname, sink, sink_context)) {
+      sink(info.dli_sname, strlen(info.dli_sname), sink_context);
+    }
+    return true;
+  }
+  return false;
+}
+
+EXPORT size_t SymbolizeBatch(void* const* addresses,
+                             size_t n,
+                             char* buffers,
+                             size_t buffer_size) {
+  size_t num_symbolized = 0;
+  for (size_t i = 0; i < n; ++i) {
+    char* const buffer = buffers + i * buffer_size;
+    if (Symbolize(addresses[i], buffer, buffer_size)) {
+      ++num_symbolized;
+    } else if (buffer_size > 0) {
+      buffer[0] = '\0';
+    }
+  }
+  return num_symbolized;
+}
+
 #endif
 
+EXPORT size_t DecodeRawTrace(const void* data,
+                             size_t size,
+                             RawTraceFrame* frames,
+                             size_t max_frames,
+                             size_t* num_frames) {
+  const char* const in = static_cast<const char*>(data);
+  uint32_t num_trace_frames, num_modules;
+  if (size < kRawTraceHeaderSize ||
+      memcmp(in, kRawTraceMagic, sizeof(kRawTraceMagic)) != 0) {
+    return 0;
+  }
+  memcpy(&num_trace_frames, in + 8, sizeof(num_trace_frames));
+  memcpy(&num_modules, in + 12, sizeof(num_modules));
+  if ((size - kRawTraceHeaderSize) / kRawTraceFrameSize < num_trace_frames) {
+    return 0;
+  }
+  const char* const trace_frames = in + kRawTraceHeaderSize;
+  const size_t num_decoded = std::min<size_t>(num_trace_frames, max_frames);
+  for (size_t i = 0; i < num_decoded; ++i) {
+    uint32_t module_index;
+    memcpy(&frames[i].offset, trace_frames + i * kRawTraceFrameSize,
+           sizeof(uint64_t));
+    memcpy(&module_index, trace_frames + i * kRawTraceFrameSize + 8,
+           sizeof(module_index));
+    if (module_index != kRawTraceNoModule && module_index >= num_modules) {
+      return 0;
+    }
+    frames[i].load_bias = 0;
+    frames[i].build_id = NULL;
+    frames[i].build_id_size = 0;
+  }
+
+  // Give each module to its frames. A trace has few modules and frames.
+  size_t position = kRawTraceHeaderSize + num_trace_frames * kRawTraceFrameSize;
+  for (uint32_t k = 0; k < num_modules; ++k) {
+    if (size - position < kRawTraceModuleHeaderSize) {
+      return 0;
+    }
+    uint64_t load_bias;
+    memcpy(&load_bias, in + position, sizeof(load_bias));
+    const size_t build_id_size = static_cast<uint8_t>(in[position + 8]);
+    position += kRawTraceModuleHeaderSize;
+    if (size - position < build_id_size) {
+      return 0;
+    }
+    for (size_t i = 0; i < num_decoded; ++i) {
+      uint32_t module_index;
+      memcpy(&module_index, trace_frames + i * kRawTraceFrameSize + 8,
+             sizeof(module_index));
+      if (module_index == k) {
+        frames[i].load_bias = load_bias;
+        if (build_id_size > 0) {
+          frames[i].build_id = reinterpret_cast<const uint8_t*>(in + position);
+          frames[i].build_id_size = build_id_size;
+        }
+      }
+    }
+    position += build_id_size;
+  }
+  *num_frames = num_trace_frames;
+  return position;
+}
+
+// Get the entry of "address" in the cache. Return addresses of nearby call
+// sites differ only in the low bits, so they are mixed into the high bits
+// by Fibonacci hashing.
+static SymbolCache::Entry* GetSymbolCacheEntry(SymbolCache* cache,
+                                               void* address) {
+  const uint64_t hash =
+      reinterpret_cast<uintptr_t>(address) * 0x9E3779B97F4A7C15ull;
+  return &cache->entries[(hash >> 32) % SymbolCache::kNumEntries];
+}
+
+static void ClearSymbolCacheEntries(SymbolCache* cache) {
+  for (SymbolCache::Entry& entry : cache->entries) {
+    entry.address = NULL;
+  }
+  cache->generation = GetModuleTableGeneration();
+}
+
+EXPORT void ClearSymbolCache(SymbolCache* cache) {
+  ClearSymbolCacheEntries(cache);
+  cache->busy = 0;
+  cache->hits = 0;
+  cache->misses = 0;
+}
+
+EXPORT bool SymbolizeCached(SymbolCache* cache,
+                            void* address,
+                            char* buffer,
+                            size_t buffer_size) {
+  if (cache->busy) {
+    // We interrupted a lookup on this thread, which may be half way through
+    // updating an entry.
+    return Symbolize(address, buffer, buffer_size);
+  }
+  if (buffer_size < 5) {
+    // Too small for any symbol; Symbolize() fails alike on a hit or a miss.
+    return Symbolize(address, buffer, buffer_size);
+  }
+  cache->busy = 1;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+
+  if (cache->generation != GetModuleTableGeneration()) {
+    ClearSymbolCacheEntries(cache);
+  }
+  SymbolCache::Entry* entry = GetSymbolCacheEntry(cache, address);
+  bool ok = true;
+  if (address != NULL && entry->address == address) {
+    ++cache->hits;
+    // Truncate the symbol as Symbolize() does if the buffer is too small.
+    const size_t length =
+        std::min(strlen(entry->symbol), buffer_size - 1);
+    memcpy(buffer, entry->symbol, length);
+    buffer[length] = '\0';
+  } else {
+    ++cache->misses;
+    ok = Symbolize(address, buffer, buffer_size);
+    const size_t length = strnlen(buffer, buffer_size);
+    // Do not cache a symbol that may have been truncated.
+    if (ok && length + 1 < buffer_size &&
+        length < static_cast<size_t>(SymbolCache::kMaxSymbolSize)) {
+      memcpy(entry->symbol, buffer, length + 1);
+      entry->address = address;
+    }
+  }
+
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  cache->busy = 0;
+  return ok;
+}
+
 }  // namespace posix
 }  // namespace sblz
@@ -0,0 +1,871 @@
+// Copyright (c) 2020 Leedehai. All rights reserved.
+// Use of this source code is governed under the LICENSE.txt file.
+
+#include <stdint.h>  // uintptr_t
+#include <string.h>  // memmove()
+
+#include "common.h"
+#include "sblz/sblz.h"
+
+#if defined(OS_LINUX)
+
+// System headers
+#include <errno.h>  // errno
+#include <signal.h>  // _NSIG
+#include <sys/syscall.h>  // SYS_rt_sigprocmask
+#include <ucontext.h>  // ucontext_t
+#include <unistd.h>  // syscall()
+
+#include "module_table.h"
+
+#elif defined(OS_MACOS)
+
+// System headers
+#include <execinfo.h>  // backtrace()
+
+#endif
+
+namespace sblz {
+namespace posix {
+
+#if defined(OS_LINUX)
+
+namespace {
+
+// A frame record, pushed by the function prologue and pointed to by the
+// frame pointer, on both x86-64 and AArch64.
+struct FrameRecord {
+  const FrameRecord* caller;
+  void* return_address;
+};
+
+// The largest frame accepted, to stop at a corrupt frame pointer that points
+// way up the stack or to another stack.
+const uintptr_t kMaxFrameSize = 1 << 20;
+
+const uintptr_t kPageSize = 4096;  // The smallest page size of Linux.
+
+// Returns true if the 8 bytes at "address", which must be aligned, can be
+// read without faulting. The kernel copies the new signal mask from
+// "address" before validating "how", so with an invalid "how" it fails with
+// EFAULT if "address" is not readable and with EINVAL otherwise, and the
+// signal mask is never changed.
+bool IsReadable(uintptr_t address) {
+  const int saved_errno = errno;
+  const long ret = syscall(SYS_rt_sigprocmask, ~0, address, NULL, _NSIG / 8);
+  const bool readable = ret == 0 || errno != EFAULT;
+  errno = saved_errno;
+  return readable;
+}
+
+// Same as IsReadable(), but the check is skipped if "address" is on
+// "*readable_page", the page last found readable, which is then updated.
+// This makes it one system call per page rather than per read.
+bool IsReadableCached(uintptr_t address, uintptr_t* readable_page) {
+  const uintptr_t page = address & ~(kPageSize - 1);
+  if (page == *readable_page) {
+    return true;
+  }
+  if (!IsReadable(address)) {
+    return false;
+  }
+  *readable_page = page;
+  return true;
+}
+
+// Strip the pointer authentication code from a return address signed by
+// PAC on AArch64, so that it is a plain code address. XPACLRI is in the
+// hint space, so it runs as a no-op on CPUs without PAC. Elsewhere, the
+// address is returned as it is.
+uint64_t StripPointerAuthentication(uint64_t address) {
+#if defined(__aarch64__)
+  register uint64_t x30 __asm__("x30") = address;
+  __asm__("hint #7" : "+r"(x30));  // xpaclri
+  return x30;
+#else
+  return address;
+#endif
+}
+
+// Get the program counter and frame pointer of the interrupted code from a
+// signal context. Returns false if the architecture is not supported.
+bool GetRegistersFromContext(const void* context,
+                             void** pc,
+                             const FrameRecord** fp) {
+  const ucontext_t* uc = reinterpret_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+  *pc = reinterpret_cast<void*>(uc->uc_mcontext.gregs[REG_RIP]);
+  *fp = reinterpret_cast<const FrameRecord*>(uc->uc_mcontext.gregs[REG_RBP]);
+  return true;
+#elif defined(__aarch64__)
+  *pc = reinterpret_cast<void*>(uc->uc_mcontext.pc);
+  *fp = reinterpret_cast<const FrameRecord*>(uc->uc_mcontext.regs[29]);
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace
+
+EXPORT __attribute__((noinline)) size_t
+UnwindWithFramePointers(const void* context,
+                        void** addresses,
+                        size_t max_depth) {
+  size_t depth = 0;
+  const FrameRecord* fp;
+  if (context == NULL) {
+    // Our own frame record, which holds the return address into the caller.
+    fp = reinterpret_cast<const FrameRecord*>(__builtin_frame_address(0));
+  } else {
+    void* pc;
+    if (!GetRegistersFromContext(context, &pc, &fp)) {
+      return 0;
+    }
+    if (depth < max_depth) {
+      addresses[depth++] = pc;
+    }
+  }
+
+  uintptr_t readable_page = 0;
+  while (depth < max_depth) {
+    const uintptr_t frame = reinterpret_cast<uintptr_t>(fp);
+    // Frame records are 16-byte aligned on x86-64 and AArch64, as the stack
+    // is, so a record never straddles pages and probing one word suffices.
+    if (frame == 0 || frame % sizeof(FrameRecord) != 0) {
+      break;
+    }
+    if (!IsReadableCached(frame, &readable_page)) {
+      break;
+    }
+    void* return_address = reinterpret_cast<void*>(StripPointerAuthentication(
+        reinterpret_cast<uintptr_t>(fp->return_address)));
+    // The return address of a call at the end of a function may point past
+    // the function, so look up the address of the call instruction.
+    if (return_address == NULL ||
+        !internal::MayBeCodeAddress(
+            reinterpret_cast<uintptr_t>(return_address) - 1)) {
+      break;
+    }
+    addresses[depth++] = return_address;
+    // The stack grows down, so the caller's frame must be above this one.
+    const FrameRecord* caller = fp->caller;
+    const uintptr_t caller_frame = reinterpret_cast<uintptr_t>(caller);
+    if (caller_frame <= frame || caller_frame - frame > kMaxFrameSize) {
+      break;
+    }
+    fp = caller;
+  }
+  return depth;
+}
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+namespace {
+
+// The registers tracked by the CFI unwinder, numbered as in DWARF.
+#if defined(__x86_64__)
+const int kNumRegisters = 17;  // rax, rdx, rcx, rbx, rsi, rdi, rbp, rsp,
+                               // r8-r15, and the return address.
+const int kStackPointer = 7;
+const int kFramePointer = 6;
+#elif defined(__aarch64__)
+const int kNumRegisters = 32;  // x0-x30 and sp.
+const int kStackPointer = 31;
+const int kFramePointer = 29;
+#endif
+
+// Pointer encodings in .eh_frame_hdr and .eh_frame. See
+// https://refspecs.linuxfoundation.org/LSB_5.0.0/LSB-Core-generic/LSB-Core-generic/ehframechpt.html
+enum PointerEncoding : uint8_t {
+  DW_EH_PE_absptr = 0x00,
+  DW_EH_PE_uleb128 = 0x01,
+  DW_EH_PE_udata2 = 0x02,
+  DW_EH_PE_udata4 = 0x03,
+  DW_EH_PE_udata8 = 0x04,
+  DW_EH_PE_sleb128 = 0x09,
+  DW_EH_PE_sdata2 = 0x0a,
+  DW_EH_PE_sdata4 = 0x0b,
+  DW_EH_PE_sdata8 = 0x0c,
+  DW_EH_PE_pcrel = 0x10,
+  DW_EH_PE_datarel = 0x30,
+  DW_EH_PE_indirect = 0x80,
+  DW_EH_PE_omit = 0xff,
+};
+
+// Call frame instructions. See the DWARF 5 standard, section 6.4.2.
+enum CallFrameInstruction : uint8_t {
+  DW_CFA_nop = 0x00,
+  DW_CFA_set_loc = 0x01,
+  DW_CFA_advance_loc1 = 0x02,
+  DW_CFA_advance_loc2 = 0x03,
+  DW_CFA_advance_loc4 = 0x04,
+  DW_CFA_offset_extended = 0x05,
+  DW_CFA_restore_extended = 0x06,
+  DW_CFA_undefined = 0x07,
+  DW_CFA_same_value = 0x08,
+  DW_CFA_register = 0x09,
+  DW_CFA_remember_state = 0x0a,
+  DW_CFA_restore_state = 0x0b,
+  DW_CFA_def_cfa = 0x0c,
+  DW_CFA_def_cfa_register = 0x0d,
+  DW_CFA_def_cfa_offset = 0x0e,
+  DW_CFA_def_cfa_expression = 0x0f,
+  DW_CFA_expression = 0x10,
+  DW_CFA_offset_extended_sf = 0x11,
+  DW_CFA_def_cfa_sf = 0x12,
+  DW_CFA_def_cfa_offset_sf = 0x13,
+  DW_CFA_val_offset = 0x14,
+  DW_CFA_val_offset_sf = 0x15,
+  DW_CFA_val_expression = 0x16,
+  DW_CFA_AARCH64_negate_ra_state = 0x2d,
+  DW_CFA_GNU_args_size = 0x2e,
+  DW_CFA_GNU_negative_offset_extended = 0x2f,
+  // The high 2 bits of these carry the opcode, and the low 6 bits an operand.
+  DW_CFA_advance_loc = 0x40,
+  DW_CFA_offset = 0x80,
+  DW_CFA_restore = 0xc0,
+};
+
+// A cursor over the DWARF data of a loaded module, which is in memory as
+// long as the module is loaded. A read past "end" fails the reader.
+class DwarfReader {
+ public:
+  DwarfReader(uintptr_t cursor, uintptr_t end)
+      : cursor_(cursor), end_(end), ok_(true) {}
+
+  bool ok() const { return ok_; }
+  uintptr_t cursor() const { return cursor_; }
+  void set_cursor(uintptr_t cursor) { cursor_ = cursor; }
+  bool AtEnd() const { return !ok_ || cursor_ >= end_; }
+
+  template <typename T>
+  T Read() {
+    T value = 0;
+    if (!ok_ || cursor_ > end_ || end_ - cursor_ < sizeof(T)) {
+      ok_ = false;
+      return value;
+    }
+    memcpy(&value, reinterpret_cast<const void*>(cursor_), sizeof(T));
+    cursor_ += sizeof(T);
+    return value;
+  }
+
+  uint64_t ReadUleb128() {
+    uint64_t value = 0;
+    for (int shift = 0; ok_; shift += 7) {
+      const uint8_t byte = Read<uint8_t>();
+      if (shift < 64) {
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      }
+      if ((byte & 0x80) == 0) {
+        break;
+      }
+    }
+    return value;
+  }
+
+  int64_t ReadSleb128() {
+    uint64_t value = 0;
+    int shift = 0;
+    uint8_t byte = 0;
+    do {
+      byte = Read<uint8_t>();
+      if (shift < 64) {
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      }
+      shift += 7;
+    } while (ok_ && (byte & 0x80) != 0);
+    if (shift < 64 && (byte & 0x40) != 0) {
+      value |= ~static_cast<uint64_t>(0) << shift;  // Sign extend.
+    }
+    return static_cast<int64_t>(value);
+  }
+
+  // Read a pointer of "encoding". "data_base" is the base address of
+  // DW_EH_PE_datarel. Returns false if the encoding is not supported.
+  bool ReadEncoded(uint8_t encoding, uintptr_t data_base, uint64_t* value) {
+    const uintptr_t field = cursor_;
+    switch (encoding & 0x0f) {
+      case DW_EH_PE_absptr:
+        *value = Read<uintptr_t>();
+        break;
+      case DW_EH_PE_uleb128:
+        *value = ReadUleb128();
+        break;
+      case DW_EH_PE_udata2:
+        *value = Read<uint16_t>();
+        break;
+      case DW_EH_PE_udata4:
+        *value = Read<uint32_t>();
+        break;
+      case DW_EH_PE_udata8:
+        *value = Read<uint64_t>();
+        break;
+      case DW_EH_PE_sleb128:
+        *value = ReadSleb128();
+        break;
+      case DW_EH_PE_sdata2:
+        *value = Read<int16_t>();
+        break;
+      case DW_EH_PE_sdata4:
+        *value = Read<int32_t>();
+        break;
+      case DW_EH_PE_sdata8:
+        *value = Read<int64_t>();
+        break;
+      default:
+        return false;
+    }
+    switch (encoding & 0x70) {
+      case DW_EH_PE_absptr:
+        break;
+      case DW_EH_PE_pcrel:
+        *value += field;
+        break;
+      case DW_EH_PE_datarel:
+        *value += data_base;
+        break;
+      default:
+        return false;  // Not used in .eh_frame.
+    }
+    if (encoding & DW_EH_PE_indirect) {
+      *value = *reinterpret_cast<const uintptr_t*>(*value);
+    }
+    return ok_;
+  }
+
+ private:
+  uintptr_t cursor_;
+  const uintptr_t end_;
+  bool ok_;
+};
+
+// How to recover a register of the caller.
+struct RegisterRule {
+  enum Type : uint8_t {
+    kSameValue,  // Not changed by the callee, also the default.
+    kUndefined,  // Not recoverable.
+    kOffset,  // Saved at CFA + offset.
+    kValOffset,  // The value is CFA + offset.
+    kRegister,  // Saved in register "offset".
+  };
+  Type type;
+  int32_t offset;
+};
+
+// A row of the call frame information table: how to compute the canonical
+// frame address (CFA), i.e. the stack pointer before the call, and how to
+// recover the registers of the caller.
+struct CfiRow {
+  int cfa_register;
+  int64_t cfa_offset;
+  RegisterRule rules[kNumRegisters];
+  // True if the return address is signed by PAC on AArch64, toggled by
+  // DW_CFA_AARCH64_negate_ra_state.
+  bool return_address_signed;
+};
+
+// Depth of DW_CFA_remember_state, which is rarely more than 1.
+const int kMaxRememberedRows = 4;
+
+// The common information entry shared by frame description entries.
+struct Cie {
+  uint64_t code_alignment;
+  int64_t data_alignment;
+  uint64_t return_address_register;
+  uint8_t fde_encoding;
+  bool has_augmentation_data;  // The FDEs have augmentation data.
+  uintptr_t instructions;
+  uintptr_t end;
+};
+
+// Read the length of a CIE or FDE at "reader", and set "end" to the end of
+// the entry. Returns false on a terminator or a malformed length.
+bool ReadEntryLength(DwarfReader* reader, uintptr_t* end) {
+  uint64_t length = reader->Read<uint32_t>();
+  if (length == 0xffffffff) {
+    length = reader->Read<uint64_t>();  // 64-bit DWARF.
+  }
+  *end = reader->cursor() + length;
+  return reader->ok() && length != 0 && *end > reader->cursor();
+}
+
+// Parse the CIE at "address".
+bool ParseCie(uintptr_t address, Cie* cie) {
+  DwarfReader reader(address, UINTPTR_MAX);
+  if (!ReadEntryLength(&reader, &cie->end) || reader.Read<uint32_t>() != 0) {
+    return false;  // Not a CIE.
+  }
+  const uint8_t version = reader.Read<uint8_t>();
+  const char* augmentation = reinterpret_cast<const char*>(reader.cursor());
+  while (reader.Read<uint8_t>() != '\0' && reader.ok()) {
+  }
+  if (version == 4) {
+    reader.Read<uint8_t>();  // address_size
+    reader.Read<uint8_t>();  // segment_selector_size
+  }
+  cie->code_alignment = reader.ReadUleb128();
+  cie->data_alignment = reader.ReadSleb128();
+  cie->return_address_register =
+      version == 1 ? reader.Read<uint8_t>() : reader.ReadUleb128();
+  cie->fde_encoding = DW_EH_PE_absptr;
+  cie->has_augmentation_data = augmentation[0] == 'z';
+  if (cie->has_augmentation_data) {
+    const uint64_t augmentation_length = reader.ReadUleb128();
+    const uintptr_t augmentation_end = reader.cursor() + augmentation_length;
+    for (const char* c = augmentation + 1; *c != '\0'; ++c) {
+      if (*c == 'R') {
+        cie->fde_encoding = reader.Read<uint8_t>();
+      } else if (*c == 'P') {
+        uint64_t personality;
+        if (!reader.ReadEncoded(reader.Read<uint8_t>(), 0, &personality)) {
+          return false;
+        }
+      } else if (*c == 'L') {
+        reader.Read<uint8_t>();  // LSDA encoding
+      } else if (*c != 'S' && *c != 'B') {
+        return false;  // Unknown augmentation, cannot skip it.
+      }
+    }
+    reader.set_cursor(augmentation_end);
+  } else if (augmentation[0] != '\0') {
+    return false;
+  }
+  cie->instructions = reader.cursor();
+  return reader.ok() && cie->instructions <= cie->end &&
+         cie->return_address_register < kNumRegisters;
+}
+
+// Execute the call frame instructions in [begin, end) of the FDE starting
+// at "pc_begin", until the location passes "pc". "initial_row" is the row
+// after the CIE instructions, for DW_CFA_restore, or NULL when executing
+// the CIE instructions. Returns false on an unsupported instruction.
+bool ExecuteCallFrameInstructions(const Cie& cie,
+                                  uintptr_t begin,
+                                  uintptr_t end,
+                                  uint64_t pc_begin,
+                                  uint64_t pc,
+                                  const CfiRow* initial_row,
+                                  CfiRow* row) {
+  CfiRow remembered_rows[kMaxRememberedRows];
+  int num_remembered_rows = 0;
+  uint64_t location = pc_begin;
+  DwarfReader reader(begin, end);
+  while (!reader.AtEnd()) {
+    const uint8_t instruction = reader.Read<uint8_t>();
+    const uint8_t operand = instruction & 0x3f;
+    uint64_t reg = 0;
+    int64_t offset = 0;
+    uint64_t advance = 0;
+    RegisterRule::Type type = RegisterRule::kSameValue;
+    switch (instruction & 0xc0) {
+      case DW_CFA_advance_loc:
+        advance = operand;
+        break;
+      case DW_CFA_offset:
+        reg = operand;
+        offset = reader.ReadUleb128() * cie.data_alignment;
+        type = RegisterRule::kOffset;
+        break;
+      case DW_CFA_restore:
+        reg = operand;
+        if (initial_row == NULL) {
+          return false;
+        }
+        if (reg < kNumRegisters) {
+          row->rules[reg] = initial_row->rules[reg];
+        }
+        continue;
+      default:
+        switch (instruction) {
+          case DW_CFA_nop:
+            continue;
+          case DW_CFA_AARCH64_negate_ra_state:
+            row->return_address_signed = !row->return_address_signed;
+            continue;
+          case DW_CFA_set_loc:
+            if (!reader.ReadEncoded(cie.fde_encoding, 0, &location)) {
+              return false;
+            }
+            if (location > pc) {
+              return reader.ok();
+            }
+            continue;
+          case DW_CFA_advance_loc1:
+            advance = reader.Read<uint8_t>();
+            break;
+          case DW_CFA_advance_loc2:
+            advance = reader.Read<uint16_t>();
+            break;
+          case DW_CFA_advance_loc4:
+            advance = reader.Read<uint32_t>();
+            break;
+          case DW_CFA_offset_extended:
+            reg = reader.ReadUleb128();
+            offset = reader.ReadUleb128() * cie.data_alignment;
+            type = RegisterRule::kOffset;
+            break;
+          case DW_CFA_offset_extended_sf:
+            reg = reader.ReadUleb128();
+            offset = reader.ReadSleb128() * cie.data_alignment;
+            type = RegisterRule::kOffset;
+            break;
+          case DW_CFA_GNU_negative_offset_extended:
+            reg = reader.ReadUleb128();
+            offset = -static_cast<int64_t>(reader.ReadUleb128()) *
+                     cie.data_alignment;
+            type = RegisterRule::kOffset;
+            break;
+          case DW_CFA_val_offset:
+            reg = reader.ReadUleb128();
+            offset = reader.ReadUleb128() * cie.data_alignment;
+            type = RegisterRule::kValOffset;
+            break;
+          case DW_CFA_val_offset_sf:
+            reg = reader.ReadUleb128();
+            offset = reader.ReadSleb128() * cie.data_alignment;
+            type = RegisterRule::kValOffset;
+            break;
+          case DW_CFA_restore_extended:
+            reg = reader.ReadUleb128();
+            if (initial_row == NULL) {
+              return false;
+            }
+            if (reg < kNumRegisters) {
+              row->rules[reg] = initial_row->rules[reg];
+            }
+            continue;
+          case DW_CFA_undefined:
+            reg = reader.ReadUleb128();
+            type = RegisterRule::kUndefined;
+            break;
+          case DW_CFA_same_value:
+            reg = reader.ReadUleb128();
+            type = RegisterRule::kSameValue;
+            break;
+          case DW_CFA_register:
+            reg = reader.ReadUleb128();
+            offset = reader.ReadUleb128();
+            type = RegisterRule::kRegister;
+            break;
+          case DW_CFA_expression:
+          case DW_CFA_val_expression:
+            // DWARF expressions are not supported. The register becomes
+            // unrecoverable, which is fine unless the unwinding needs it.
+            reg = reader.ReadUleb128();
+            reader.set_cursor(reader.cursor() + reader.ReadUleb128());
+            type = RegisterRule::kUndefined;
+            break;
+          case DW_CFA_remember_state:
+            if (num_remembered_rows == kMaxRememberedRows) {
+              return false;
+            }
+            remembered_rows[num_remembered_rows++] = *row;
+            continue;
+          case DW_CFA_restore_state:
+            if (num_remembered_rows == 0) {
+              return false;
+            }
+            *row = remembered_rows[--num_remembered_rows];
+            continue;
+          case DW_CFA_def_cfa:
+            row->cfa_register = reader.ReadUleb128();
+            row->cfa_offset = reader.ReadUleb128();
+            continue;
+          case DW_CFA_def_cfa_sf:
+            row->cfa_register = reader.ReadUleb128();
+            row->cfa_offset = reader.ReadSleb128() * cie.data_alignment;
+            continue;
+          case DW_CFA_def_cfa_register:
+            row->cfa_register = reader.ReadUleb128();
+            continue;
+          case DW_CFA_def_cfa_offset:
+            row->cfa_offset = reader.ReadUleb128();
+            continue;
+          case DW_CFA_def_cfa_offset_sf:
+            row->cfa_offset = reader.ReadSleb128() * cie.data_alignment;
+            continue;
+          case DW_CFA_GNU_args_size:
+            reader.ReadUleb128();
+            continue;
+          case DW_CFA_def_cfa_expression:
+          default:
+            return false;
+        }
+    }
+    if (advance != 0) {
+      location += advance * cie.code_alignment;
+      if (location > pc) {
+        return reader.ok();  // The row of "pc" is complete.
+      }
+      continue;
+    }
+    if (reg < kNumRegisters) {
+      row->rules[reg].type = type;
+      row->rules[reg].offset = static_cast<int32_t>(offset);
+    }
+  }
+  return reader.ok();
+}
+
+// Find the FDE covering "pc" in the binary search table of .eh_frame_hdr at
+// "eh_frame_hdr", and compute the CFI row of "pc" into "row".
+bool FindCfiRow(uintptr_t eh_frame_hdr, uint64_t pc, Cie* cie, CfiRow* row) {
+  DwarfReader header(eh_frame_hdr, UINTPTR_MAX);
+  const uint8_t version = header.Read<uint8_t>();
+  const uint8_t eh_frame_ptr_encoding = header.Read<uint8_t>();
+  const uint8_t fde_count_encoding = header.Read<uint8_t>();
+  const uint8_t table_encoding = header.Read<uint8_t>();
+  uint64_t eh_frame_ptr, fde_count;
+  // The table is searchable only with fixed-size entries, which is what the
+  // linkers always emit.
+  if (version != 1 || table_encoding != (DW_EH_PE_datarel | DW_EH_PE_sdata4) ||
+      !header.ReadEncoded(eh_frame_ptr_encoding, eh_frame_hdr,
+                          &eh_frame_ptr) ||
+      fde_count_encoding == DW_EH_PE_omit ||
+      !header.ReadEncoded(fde_count_encoding, eh_frame_hdr, &fde_count)) {
+    return false;
+  }
+
+  // Find the last entry with an initial location not after "pc".
+  struct TableEntry {
+    int32_t initial_location;
+    int32_t fde_offset;
+  };
+  const TableEntry* table =
+      reinterpret_cast<const TableEntry*>(header.cursor());
+  uint64_t low = 0;
+  uint64_t high = fde_count;
+  while (low < high) {
+    const uint64_t mid = low + (high - low) / 2;
+    if (eh_frame_hdr + table[mid].initial_location <= pc) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0) {
+    return false;
+  }
+  const uintptr_t fde = eh_frame_hdr + table[low - 1].fde_offset;
+
+  // Parse the FDE and its CIE.
+  DwarfReader reader(fde, UINTPTR_MAX);
+  uintptr_t fde_end;
+  if (!ReadEntryLength(&reader, &fde_end)) {
+    return false;
+  }
+  const uintptr_t cie_pointer = reader.cursor();
+  const uint32_t cie_offset = reader.Read<uint32_t>();
+  if (cie_offset == 0 || !ParseCie(cie_pointer - cie_offset, cie)) {
+    return false;
+  }
+  uint64_t pc_begin, pc_range;
+  if (!reader.ReadEncoded(cie->fde_encoding, 0, &pc_begin) ||
+      !reader.ReadEncoded(cie->fde_encoding & 0x0f, 0, &pc_range) ||
+      pc < pc_begin || pc - pc_begin >= pc_range) {
+    return false;  // No FDE covers "pc".
+  }
+  if (cie->has_augmentation_data) {
+    reader.set_cursor(reader.cursor() + reader.ReadUleb128());
+  }
+
+  row->cfa_register = -1;
+  row->cfa_offset = 0;
+  row->return_address_signed = false;
+  for (RegisterRule& rule : row->rules) {
+    rule.type = RegisterRule::kSameValue;
+    rule.offset = 0;
+  }
+  if (!ExecuteCallFrameInstructions(*cie, cie->instructions, cie->end,
+                                    pc_begin, UINT64_MAX, NULL, row)) {
+    return false;
+  }
+  const CfiRow initial_row = *row;
+  return reader.ok() &&
+         ExecuteCallFrameInstructions(*cie, reader.cursor(), fde_end,
+                                      pc_begin, pc, &initial_row, row);
+}
+
+// The registers of a frame being unwound.
+struct UnwindState {
+  uint64_t pc;
+  uint64_t registers[kNumRegisters];
+  uint64_t valid;  // Bit i is set if registers[i] is known.
+};
+
+// Unwind "state" to the caller's frame. "pc_is_exact" is true if the pc is
+// where the code was interrupted, rather than a return address, which may
+// be past the end of the function of the call. "readable_page" is the page
+// of the stack last found readable.
+bool StepWithCfi(UnwindState* state,
+                 bool pc_is_exact,
+                 uintptr_t* readable_page) {
+  const uint64_t pc = pc_is_exact ? state->pc : state->pc - 1;
+  const uint64_t eh_frame_hdr = internal::FindEhFrameHdr(pc);
+  Cie cie;
+  CfiRow row;
+  if (eh_frame_hdr == 0 || !FindCfiRow(eh_frame_hdr, pc, &cie, &row) ||
+      row.cfa_register < 0 || row.cfa_register >= kNumRegisters ||
+      !(state->valid & (1ull << row.cfa_register))) {
+    return false;
+  }
+  const uint64_t cfa = state->registers[row.cfa_register] + row.cfa_offset;
+
+  UnwindState caller = *state;
+  for (int i = 0; i < kNumRegisters; ++i) {
+    const RegisterRule& rule = row.rules[i];
+    switch (rule.type) {
+      case RegisterRule::kSameValue:
+        break;
+      case RegisterRule::kUndefined:
+        caller.valid &= ~(1ull << i);
+        break;
+      case RegisterRule::kOffset: {
+        const uintptr_t address = cfa + rule.offset;
+        if (address % sizeof(uint64_t) != 0 ||
+            !IsReadableCached(address, readable_page)) {
+          return false;
+        }
+        caller.registers[i] = *reinterpret_cast<const uint64_t*>(address);
+        caller.valid |= 1ull << i;
+        break;
+      }
+      case RegisterRule::kValOffset:
+        caller.registers[i] = cfa + rule.offset;
+        caller.valid |= 1ull << i;
+        break;
+      case RegisterRule::kRegister:
+        if (rule.offset < 0 || rule.offset >= kNumRegisters ||
+            !(state->valid & (1ull << rule.offset))) {
+          caller.valid &= ~(1ull << i);
+        } else {
+          caller.registers[i] = state->registers[rule.offset];
+          caller.valid |= 1ull << i;
+        }
+        break;
+    }
+  }
+  // An undefined return address marks the outermost frame.
+  if (!(caller.valid & (1ull << cie.return_address_register))) {
+    return false;
+  }
+  caller.pc = caller.registers[cie.return_address_register];
+  if (row.return_address_signed) {
+    caller.pc = StripPointerAuthentication(caller.pc);
+  }
+  // The stack grows down, so the caller's frame must be above this one.
+  if ((state->valid & (1ull << kStackPointer)) &&
+      cfa <= state->registers[kStackPointer]) {
+    return false;
+  }
+  caller.registers[kStackPointer] = cfa;
+  caller.valid |= 1ull << kStackPointer;
+  *state = caller;
+  return true;
+}
+
+// Get the registers of the interrupted code from a signal context.
+void GetUnwindStateFromContext(const void* context, UnwindState* state) {
+  const ucontext_t* uc = reinterpret_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+  static const int kGregs[kNumRegisters] = {
+      REG_RAX, REG_RDX, REG_RCX, REG_RBX, REG_RSI, REG_RDI,
+      REG_RBP, REG_RSP, REG_R8,  REG_R9,  REG_R10, REG_R11,
+      REG_R12, REG_R13, REG_R14, REG_R15, REG_RIP,
+  };
+  for (int i = 0; i < kNumRegisters; ++i) {
+    state->registers[i] = uc->uc_mcontext.gregs[kGregs[i]];
+  }
+  state->pc = uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+  for (int i = 0; i < 31; ++i) {
+    state->registers[i] = uc->uc_mcontext.regs[i];
+  }
+  state->registers[kStackPointer] = uc->uc_mcontext.sp;
+  state->pc = uc->uc_mcontext.pc;
+#endif
+  state->valid = ~0ull;
+}
+
+}  // namespace
+
+EXPORT __attribute__((noinline)) size_t UnwindWithCfi(const void* context,
+                                                      void** addresses,
+                                                      size_t max_depth) {
+  UnwindState state;
+  bool pc_is_exact = context != NULL;
+  if (context == NULL) {
+    // Start from the caller, right after we return to it: its stack pointer
+    // is our CFA, and its frame pointer is saved in our frame record. The
+    // other registers are not known, and rarely needed for unwinding.
+    const FrameRecord* fp =
+        reinterpret_cast<const FrameRecord*>(__builtin_frame_address(0));
+    state.pc = reinterpret_cast<uintptr_t>(__builtin_return_address(0));
+    state.registers[kStackPointer] =
+        reinterpret_cast<uintptr_t>(__builtin_dwarf_cfa());
+    state.registers[kFramePointer] = reinterpret_cast<uintptr_t>(fp->caller);
+    state.valid = (1ull << kStackPointer) | (1ull << kFramePointer);
+  } else {
+    GetUnwindStateFromContext(context, &state);
+  }
+
+  uintptr_t readable_page = 0;
+  size_t depth = 0;
+  while (depth < max_depth && state.pc != 0) {
+    addresses[depth++] = reinterpret_cast<void*>(state.pc);
+    if (!StepWithCfi(&state, pc_is_exact, &readable_page)) {
+      break;
+    }
+    pc_is_exact = false;
+  }
+  return depth;
+}
+
+#else
+
+EXPORT size_t UnwindWithCfi(const void* context,
+                            void** addresses,
+                            size_t max_depth) {
+  return 0;  // The architecture is not supported.
+}
+
+#endif
+
+#elif defined(OS_MACOS)
+
+// Drop the first of the "depth" addresses got by backtrace(), which is the
+// frame of our caller, i.e. the API function.
+static size_t DropFirstAddress(void** addresses, int depth) {
+  if (depth <= 1) {
+    return 0;
+  }
+  memmove(addresses, addresses + 1, (depth - 1) * sizeof(void*));
+  return depth - 1;
+}
+
+EXPORT size_t UnwindWithFramePointers(const void* context,
+                                      void** addresses,
+                                      size_t max_depth) {
+  if (context != NULL || max_depth == 0) {
+    return 0;  // Not supported.
+  }
+  return DropFirstAddress(addresses,
+                          backtrace(addresses, static_cast<int>(max_depth)));
+}
+
+EXPORT size_t UnwindWithCfi(const void* context,
+                            void** addresses,
+                            size_t max_depth) {
+  if (context != NULL || max_depth == 0) {
+    return 0;  // Not supported.
+  }
+  return DropFirstAddress(addresses,
+                          backtrace(addresses, static_cast<int>(max_depth)));
+}
+
+#endif
+
+}  // namespace posix
+}  // namespace sblz
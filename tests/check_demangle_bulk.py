@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 Leedehai. All rights reserved.
+# Use of this source code is governed under the LICENSE.txt file.
+# -----
+# Test demangle_bulk.cc.
+# How to test: see README.md.
+
+import os, sys
+import subprocess
+# My own package
+import testing_utils
+from check_demangler import load_cases
+
+THIS_DIR = os.path.dirname(__file__)
+
+PROGRAM_UNDER_TEST = os.path.relpath(
+    os.path.join(THIS_DIR, "..", "out", "example_demangle_bulk"))
+
+# A binary with a symbol table.
+ELF_FILE = os.path.relpath(
+    os.path.join(THIS_DIR, "..", "out", "example_symbolize"))
+
+
+def run_one(args: list, text: str = "") -> str:
+    try:
+        out = subprocess.check_output([PROGRAM_UNDER_TEST] + args,
+                                      input=text.encode())
+    except subprocess.CalledProcessError:
+        out = "(exit 1)"
+    return testing_utils.ensure_str(out)
+
+
+def run() -> bool:
+    """
+    Returns:
+    bool: True on success
+    """
+    all_ok = True
+    for (cases, args) in [
+        (load_cases("demangler_cases.txt", {}), []),
+        (load_cases("demangler_parameter_cases.txt", {}),
+         ["--parameter-types"]),
+    ]:
+        # Many more symbols than threads, so that the work is stolen.
+        mangled = list(cases.keys()) * 20
+        expected = "".join("%s\t%s\n" % (m, cases[m]) for m in mangled)
+        for threads in ["1", "7"]:
+            actual = run_one(args + ["--threads", threads],
+                             "\n".join(mangled) + "\n")
+            if actual != expected:
+                testing_utils.print_error(
+                    "in: %s --threads %s, unexpected out: %s" %
+                    (' '.join(args), threads, actual[:200]))
+                all_ok = False
+    # The symbol table of a binary: the result does not depend on the number
+    # of threads.
+    expected = run_one(["--threads", "1", ELF_FILE])
+    actual = run_one(["--threads", "5", ELF_FILE])
+    if actual != expected or "\tmain\n" not in expected:
+        testing_utils.print_error("in: %s, unexpected out: %s" %
+                                  (ELF_FILE, actual[:200]))
+        all_ok = False
+    return all_ok
+
+
+if __name__ == "__main__":
+    sys.exit(testing_utils.report(run()))
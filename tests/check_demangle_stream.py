@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 Leedehai. All rights reserved.
+# Use of this source code is governed under the LICENSE.txt file.
+# -----
+# Test demangle_stream.cc.
+# How to test: see README.md.
+
+import os, sys
+import random
+import re
+import subprocess
+# My own package
+import testing_utils
+from check_demangler import load_cases
+
+THIS_DIR = os.path.dirname(__file__)
+
+PROGRAM_UNDER_TEST = os.path.relpath(
+    os.path.join(THIS_DIR, "..", "out", "example_demangle_stream"))
+
+# A symbol is a word of these characters, like c++filt.
+SYMBOL_RE = re.compile(r"(?<![A-Za-z0-9_.$])_Z[A-Za-z0-9_.$]*")
+
+# Larger than the buffer of the filter, so that symbols straddle the
+# boundaries of the blocks read.
+TEXT_SIZE = 3 << 20
+
+
+def make_text(cases: dict, seed: int) -> (str, str):
+    """
+    Returns:
+    (str, str): the text, and the expected output of the filter
+    """
+    rng = random.Random(seed)
+    symbols = [m for m in cases if SYMBOL_RE.fullmatch(m)]
+    fillers = [
+        "no symbol here ", "x_ZN3Foo3BarEv ", "_Z ", "\n", "(", ") @ 0x4005d0 ",
+        "a" * 4000 + " ", "\t_ZN3Foo3 ", "_ZN3Foo3BarEv@@LIB_1.0 "
+    ]
+    text, expected, size = [], [], 0
+    while size < TEXT_SIZE:
+        if rng.random() < 0.5:
+            piece = rng.choice(fillers)
+            text.append(piece)
+        else:
+            symbol = rng.choice(symbols)
+            piece = symbol + rng.choice([" ", "\n", ",", "(", "@"])
+            text.append(piece)
+        size += len(piece)
+    text = "".join(text)
+    expected = SYMBOL_RE.sub(lambda m: cases.get(m.group(0), m.group(0)), text)
+    return (text, expected)
+
+
+def run_one(text: str, args: list = []) -> str:
+    try:
+        out = subprocess.check_output([PROGRAM_UNDER_TEST] + args,
+                                      input=text.encode())
+    except subprocess.CalledProcessError:
+        out = "(exit 1)"
+    return testing_utils.ensure_str(out)
+
+
+def run() -> bool:
+    """
+    Returns:
+    bool: True on success
+    """
+    all_ok = True
+    # Symbols in the fillers of make_text().
+    filler_cases = {"_ZN3Foo3BarEv": "Foo::Bar()", "_ZN3Foo3": "_ZN3Foo3"}
+    cases = load_cases("demangler_cases.txt", dict(filler_cases))
+    parameter_cases = load_cases("demangler_parameter_cases.txt",
+                                 dict(filler_cases))
+    for (seed, (cases, args)) in enumerate([
+        (cases, []),
+        (parameter_cases, ["--parameter-types"]),
+    ]):
+        (text, expected) = make_text(cases, seed)
+        actual = run_one(text, args)
+        if actual != expected:
+            index = next((i for i in range(min(len(actual), len(expected)))
+                          if actual[i] != expected[i]),
+                         min(len(actual), len(expected)))
+            testing_utils.print_error(
+                "in: %s, expected out: ...%s..., actual out: ...%s..." %
+                (' '.join(args), expected[index - 40:index + 40],
+                 actual[index - 40:index + 40]))
+            all_ok = False
+    # A word that is longer than the buffer is copied as it is.
+    text = "_Z" + "x" * (TEXT_SIZE // 2) + " _ZN3Foo3BarEv"
+    if run_one(text) != text[:-len("_ZN3Foo3BarEv")] + "Foo::Bar()":
+        testing_utils.print_error("in: a long word, unexpected out")
+        all_ok = False
+    return all_ok
+
+
+if __name__ == "__main__":
+    sys.exit(testing_utils.report(run()))
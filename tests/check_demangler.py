@@ -15,24 +15,131 @@ THIS_DIR = os.path.dirname(__file__)
 PROGRAM_UNDER_TEST = os.path.relpath(
     os.path.join(THIS_DIR, "..", "out", "example_demangle"))
 
-# The demangler just implements part of the demangling procedure: it doesn't
-# extract the argument types.
-MANGLED_SYMBOLS_MAP = {
+
+def load_cases(filename: str, cases: dict) -> dict:
+    with open(os.path.join(THIS_DIR, filename), 'r') as f:
+        line_iter = (l.strip() for l in f.readlines())
+        for line in line_iter:
+            if len(line) == 0 or line.startswith('#'):
+                continue
+            (mangled, demangled) = line.split(" | ")
+            cases[mangled] = demangled
+    return cases
+
+
+# By default, the demangler just implements part of the demangling procedure:
+# it doesn't extract the argument types.
+MANGLED_SYMBOLS_MAP = load_cases("demangler_cases.txt", {
     "_Z2f2f8MyStruct": "f2()",
     "_Z2f3iiiiid": "f3()",
+})
+
+# With --parameter-types, it does.
+MANGLED_SYMBOLS_WITH_PARAMETERS_MAP = load_cases(
+    "demangler_parameter_cases.txt", {})
+
+
+# With --first-word, only the first word is demangled, like a symbol in a line
+# of text.
+MANGLED_SYMBOLS_IN_TEXT_MAP = {
+    "_ZN3Foo3BarEv in libfoo.so": "Foo::Bar()",
+    "_ZN3Foo3BarEv.cold.1 +0x10": "Foo::Bar()",
+    "_ZN3Foo3BarEv@@LIB_1.0 (inlined)": "Foo::Bar()@@LIB_1.0",
+    "_ZN3Foo3 BarEv": "_ZN3Foo3 BarEv",
+}
+
+# With --components, the components of the name are printed after it.
+MANGLED_SYMBOLS_COMPONENTS_MAP = {
+    "_ZN3Foo3BarEv":
+    "Foo::Bar() | scope Foo | function Bar | parameters ()",
+    "_ZN3FooIiEC1Ev":
+    "Foo<>::Foo() | class Foo | template-args <> | ctor-dtor Foo | "
+    "parameters ()",
+    "_ZNSt6vectorIiSaIiEE9push_backERKi":
+    "std::vector<>::push_back() | namespace std | class vector | "
+    "template-args <> | function push_back | parameters ()",
+    "_ZN12_GLOBAL__N_11NlsERSoRKNS_1AE":
+    "(anonymous namespace)::N::operator<<() | "
+    "namespace (anonymous namespace) | scope N | operator operator<< | "
+    "parameters ()",
+    "_ZZN1N1fEiE1x":
+    "N::f()::x | scope N | function f | parameters () | name x",
+    "_ZN1N3varE": "N::var | scope N | name var",
+}
+
+MANGLED_SYMBOLS_WITH_PARAMETERS_COMPONENTS_MAP = {
+    "_ZN3FooIiE3BarIcEEvT_":
+    "void Foo<int>::Bar<char>(char) | class Foo | template-args <int> | "
+    "function Bar | template-args <char> | return-type void | "
+    "parameters (char)",
+    "_ZNK3Foo3getEv": "Foo::get() const | scope Foo | function get | "
+    "parameters ()",
+}
+
+# With --compact, the types are printed compactly: the std names are
+# abbreviated, and the template arguments nested in others are elided.
+MANGLED_SYMBOLS_COMPACT_MAP = {
+    "_ZNSt6vectorINSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEEESaIS5_"
+    "EE9push_backERKS5_":
+    "std::vector<std::string>::push_back(std::string const&)",
+    "_ZNKSt3mapINSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEEESt6vector"
+    "IiSaIiEESt4lessIS5_ESaISt4pairIKS5_S8_EEE2atERSC_":
+    "std::map<std::string, std::vector<...> >::at(std::string const&) const",
+    "_ZNKSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEE4sizeEv":
+    "std::string::size() const",
+    "_ZNSt10unique_ptrI3FooSt14default_deleteIS0_EED2Ev":
+    "std::unique_ptr<Foo>::~unique_ptr()",
+    "_ZNSt10filesystem14symlink_statusERKNS_7__cxx114pathE":
+    "std::filesystem::symlink_status(std::filesystem::path const&)",
+    "_ZN3FooIiE3BarIcEEvT_": "void Foo<int>::Bar<char>(char)",
+    "_ZNSolsEi": "std::ostream::operator<<(int)",
+    # Only the defaults of the arguments of known std templates are dropped.
+    "_Z1fSt4pairIiSt4lessIiEE": "f(std::pair<int, std::less<...> >)",
+    "_ZN3FooIiSt4lessIiEE3barEv": "Foo<int, std::less<...> >::bar()",
+    "_ZNSt8_Rb_treeIiiSt9_IdentityIiESt4lessIiESaIiEE5clearEv":
+    "std::_Rb_tree<int, int, std::_Identity<...>, std::less<...>, "
+    "std::allocator<...> >::clear()",
+    "_Z1fSt3mapIiiSt7greaterIiESaISt4pairIKiiEEE":
+    "f(std::map<int, int, std::greater<...> >)",
+    "_ZNSt6vectorIPFviESaIS1_EE9push_backERKS1_":
+    "std::vector<void (*)(int)>::push_back(void (* const&)(int))",
+}
+
+# With --width 40, the less important parts are dropped to fit 40
+# characters, and with --width 12, the name is cut.
+MANGLED_SYMBOLS_WIDTH_40_MAP = {
+    "_ZNSt6vectorINSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEEESaIS5_"
+    "EE9push_backERKS5_": "std::vector<...>::push_back(...)",
+    "_ZN2ns5ClassIiE8functionEPKcS3_S3_": "ns::Class<...>::function(...)",
+    "_ZNSolsEi": "std::ostream::operator<<(int)",
+}
+MANGLED_SYMBOLS_WIDTH_12_MAP = {
+    "_ZN3FooIiE3BarIcEEvT_": "Foo<>::Ba...",
+    "_ZNSolsEi": "std::ostr...",
+    "_Z3foov": "foo()",
+}
+
+# With --buffer-size N, the size of the buffer needed is printed after the
+# name, which is not demangled if it does not fit, e.g. with --buffer-size 11.
+MANGLED_SYMBOLS_BUFFER_SIZE_MAP = {
+    "_ZN3Foo3BarEv": "Foo::Bar() | size 11",
+    "_ZN3Foo4BarsEv": "_ZN3Foo4BarsEv | size 12",
+    "_ZN3FooC1Ev": "Foo::Foo() | size 11",
+    "_ZN9__gnu_cxx13new_allocatorIcED2Ev":
+    "_ZN9__gnu_cxx13new_allocatorIcED2Ev | size 49",
+    "_ZNSt6vectorIS_IiSaIiEESaIS1_EE9push_backERKS1_":
+    "_ZNSt6vectorIS_IiSaIiEESaIS1_EE9push_backERKS1_ | size 168",
+    "_ZNSt6vectorIS_IiSaIiEESaIS1_EEC2ERKS2_":
+    "_ZNSt6vectorIS_IiSaIiEESaIS1_EEC2ERKS2_ | size 182",
+    "_Z3foov": "foo() | size 6",
+    "foo": "foo | size 0",
 }
-with open(os.path.join(THIS_DIR, "demangler_cases.txt"), 'r') as f:
-    line_iter = (l.strip() for l in f.readlines())
-    for line in line_iter:
-        if len(line) == 0 or line.startswith('#'):
-            continue
-        (mangled, demangled) = line.split(" | ")
-        MANGLED_SYMBOLS_MAP[mangled] = demangled
 
 
-def run_one(demangled: str) -> str:
+def run_one(demangled: str, args: list = []) -> str:
     try:
-        out = subprocess.check_output([PROGRAM_UNDER_TEST, demangled])
+        out = subprocess.check_output([PROGRAM_UNDER_TEST] + args +
+                                      [demangled])
     except subprocess.CalledProcessError:
         out = "(exit 1)"
     return testing_utils.ensure_str(out).rstrip('\n')
@@ -44,13 +151,32 @@ def run() -> bool:
     bool: True on success
     """
     all_ok = True
-    for (mangled, expected_demangled) in MANGLED_SYMBOLS_MAP.items():
-        actual_demangled = run_one(mangled)
-        if actual_demangled != expected_demangled:
-            testing_utils.print_error(
-                "in: %s, expected out: %s, actual out: %s" %
-                (mangled, expected_demangled, actual_demangled))
-            all_ok = False
+    for (cases, args) in [
+        (MANGLED_SYMBOLS_MAP, []),
+        (MANGLED_SYMBOLS_WITH_PARAMETERS_MAP, ["--parameter-types"]),
+        (MANGLED_SYMBOLS_MAP, ["--scratch"]),
+        (MANGLED_SYMBOLS_MAP, ["--first-word"]),
+        (MANGLED_SYMBOLS_IN_TEXT_MAP, ["--first-word"]),
+        (MANGLED_SYMBOLS_COMPONENTS_MAP, ["--components"]),
+        (MANGLED_SYMBOLS_WITH_PARAMETERS_COMPONENTS_MAP,
+         ["--parameter-types", "--components"]),
+        (MANGLED_SYMBOLS_WITH_PARAMETERS_MAP,
+         ["--parameter-types", "--scratch"]),
+        (MANGLED_SYMBOLS_COMPACT_MAP, ["--compact"]),
+        (MANGLED_SYMBOLS_WIDTH_40_MAP, ["--width", "40"]),
+        (MANGLED_SYMBOLS_WIDTH_12_MAP, ["--width", "12"]),
+        (MANGLED_SYMBOLS_WITH_PARAMETERS_MAP, ["--parameter-types", "--sink"]),
+        (MANGLED_SYMBOLS_BUFFER_SIZE_MAP,
+         ["--parameter-types", "--buffer-size", "11"]),
+    ]:
+        for (mangled, expected_demangled) in cases.items():
+            actual_demangled = run_one(mangled, args)
+            if actual_demangled != expected_demangled:
+                testing_utils.print_error(
+                    "in: %s %s, expected out: %s, actual out: %s" %
+                    (' '.join(args), mangled, expected_demangled,
+                     actual_demangled))
+                all_ok = False
     return all_ok
 
 
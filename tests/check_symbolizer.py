@@ -20,6 +20,74 @@ PROGRAMS_UNDER_TEST = [
     ]
 ]
 
+# The tool that writes the symbol index files, the object files it indexes,
+# and the directory it writes to.
+SYMBOL_INDEX_TOOL, SYMBOL_INDEX_DIR = [
+    os.path.relpath(os.path.join(os.path.dirname(__file__), "..", "out", e))
+    for e in ["sblz_symbol_index", "symbol_index"]
+]
+SHARED_LIBRARY = os.path.relpath(
+    os.path.join(os.path.dirname(__file__), "..", "out", "symbolizer.so"))
+INDEXED_OBJECT_FILES = PROGRAMS_UNDER_TEST + [SHARED_LIBRARY]
+
+# The tool that symbolizes raw traces offline, and the file the raw traces
+# are appended to.
+SYMBOLIZE_TRACE_TOOL, RAW_TRACE_FILE = [
+    os.path.relpath(os.path.join(os.path.dirname(__file__), "..", "out", e))
+    for e in ["sblz_symbolize_trace", "raw_trace"]
+]
+
+# Command line arguments to run each program with.
+PROGRAM_ARGS = [
+    [],
+    ["--module-table"],
+    ["--batch"],
+    ["--module-table", "--batch"],
+    ["--module-table", "--symbol-index"],
+    ["--module-table", "--symbol-index", "--batch"],
+    ["--module-table", "--mmap"],
+    ["--module-table", "--mmap", "--symbol-index", "--batch"],
+    ["--module-table", "--dl-iterate-phdr"],
+    ["--module-table", "--dl-iterate-phdr", "--mmap", "--symbol-index"],
+    ["--module-table", "--pre-open"],
+    ["--module-table", "--pre-open", "--symbol-index", "--batch"],
+    ["--cache"],
+    ["--module-table", "--symbol-index", "--cache"],
+    ["--frame-pointers"],
+    ["--module-table", "--frame-pointers", "--batch"],
+    ["--module-table", "--cfi"],
+    ["--module-table", "--dl-iterate-phdr", "--cfi", "--batch"],
+    ["--frame-pointers", "--signal"],
+    ["--module-table", "--frame-pointers", "--signal"],
+    # Only the CFI unwinder unwinds through a function without frame pointer.
+    ["--module-table", "--cfi", "--omit-frame-pointer"],
+    ["--module-table", "--cfi", "--signal", "--omit-frame-pointer"],
+    ["--demangle"],
+    ["--module-table", "--mmap", "--demangle"],
+    ["--required-size"],
+    ["--module-table", "--mmap", "--demangle", "--required-size"],
+    ["--module-table", "--symbol-index", "--demangle", "--required-size"],
+    ["--sink"],
+    ["--module-table", "--mmap", "--sink"],
+    ["--module-table", "--symbol-index", "--demangle", "--sink"],
+    ["--module-table", "--symbol-index-files", SYMBOL_INDEX_DIR],
+    [
+        "--module-table", "--symbol-index-files", SYMBOL_INDEX_DIR,
+        "--symbol-index", "--demangle", "--batch"
+    ],
+    [
+        "--module-table", "--symbol-index-files", SYMBOL_INDEX_DIR,
+        "--demangle", "--required-size"
+    ],
+]
+
+# Command line arguments to run each program with to record a raw trace,
+# all of which are appended to the same file.
+RAW_TRACE_ARGS = [
+    ["--module-table"],
+    ["--module-table", "--dl-iterate-phdr", "--cfi"],
+]
+
 
 def find_overlapped_symbol(mangled_symbol: str,
                            function_names: List[str]) -> Optional[str]:
@@ -86,7 +154,7 @@ def validate_output(output: str) -> bool:
     return True
 
 
-def run_one(program: str) -> bool:
+def run_one(program: str, args: List[str]) -> bool:
     """
     Returns:
     bool: True on success
@@ -96,15 +164,72 @@ def run_one(program: str) -> bool:
                                   program)
         return False
     try:
-        print("run: %s" % program)
-        output = subprocess.check_output([program])
+        print("run: %s" % " ".join([program] + args))
+        output = subprocess.check_output([program] + args)
     except subprocess.CalledProcessError as e:
         testing_utils.print_error("subprocess error: %s" % str(e))
         return False
     except OSError as e:
         testing_utils.print_error(str(e))
         return False
-    return validate_output(testing_utils.ensure_str(output))
+    output = testing_utils.ensure_str(output)
+    # Unwound from the signal context, the trace starts at the faulting
+    # instruction in f7, not in the signal handler.
+    if "--signal" in args and "f7" not in output.split("\n")[0]:
+        testing_utils.print_error("not starting at f7: %s" %
+                                  output.split("\n")[0])
+        return False
+    return validate_output(output)
+
+
+def run_raw_trace(program: str) -> bool:
+    """
+    Records the raw traces of the program and symbolizes them offline.
+
+    Returns:
+    bool: True on success
+    """
+    if os.path.exists(RAW_TRACE_FILE):
+        os.remove(RAW_TRACE_FILE)
+    commands = [[program] + args + ["--raw-trace", RAW_TRACE_FILE]
+                for args in RAW_TRACE_ARGS]
+    commands += [[SYMBOLIZE_TRACE_TOOL] + args +
+                 [RAW_TRACE_FILE, program, SHARED_LIBRARY]
+                 for args in [[], ["--demangle"]]]
+    for command in commands:
+        try:
+            print("run: %s" % " ".join(command))
+            output = subprocess.check_output(command)
+        except (subprocess.CalledProcessError, OSError) as e:
+            testing_utils.print_error("subprocess error: %s" % str(e))
+            return False
+        if command[0] != SYMBOLIZE_TRACE_TOOL:
+            continue
+        traces = testing_utils.ensure_str(output).split("\n\n")
+        if len(traces) != len(RAW_TRACE_ARGS):
+            testing_utils.print_error("expect %d traces, found %d" %
+                                      (len(RAW_TRACE_ARGS), len(traces)))
+            return False
+        if not all(validate_output(trace) for trace in traces):
+            return False
+    return True
+
+
+def write_symbol_index_files() -> bool:
+    """
+    Returns:
+    bool: True on success
+    """
+    os.makedirs(SYMBOL_INDEX_DIR, exist_ok=True)
+    try:
+        subprocess.check_call(
+            [SYMBOL_INDEX_TOOL, "--demangle", SYMBOL_INDEX_DIR] +
+            INDEXED_OBJECT_FILES)
+    except (subprocess.CalledProcessError, OSError) as e:
+        testing_utils.print_error("cannot write symbol index files: %s" %
+                                  str(e))
+        return False
+    return True
 
 
 def run() -> bool:
@@ -112,9 +237,14 @@ def run() -> bool:
     Returns:
     bool: True on success
     """
+    if not write_symbol_index_files():
+        return False
     all_ok = True
     for e in PROGRAMS_UNDER_TEST:
-        if False == run_one(e):
+        for args in PROGRAM_ARGS:
+            if False == run_one(e, args):
+                all_ok = False
+        if False == run_raw_trace(e):
             all_ok = False
     return all_ok
 
@@ -0,0 +1,41 @@
+// Copyright (c) 2020 Leedehai. All rights reserved.
+// Use of this source code is governed under the LICENSE.txt file.
+// -----
+// Writes the symbol index files of object files with
+// sblz::posix::WriteSymbolIndexFile(), to be loaded by the processes running
+// them with sblz::posix::LoadSymbolIndexFiles(). With the option --demangle,
+// the demangled names are stored too.
+//
+// Usage:
+//   sblz_symbol_index [--demangle] DIRECTORY OBJECT_FILE...
+
+#include <cstring>
+#include <iostream>
+
+#include "sblz/sblz.h"
+
+int main(int argc, char* argv[]) {
+  bool demangle = false;
+  if (argc > 1 && !std::strcmp(argv[1], "--demangle")) {
+    demangle = true;
+    --argc;
+    ++argv;
+  }
+  if (argc < 3) {
+    std::cerr << "[Error] expect the directory to write to and at least 1 "
+                 "object file, optionally preceded by --demangle."
+              << std::endl;
+    return 1;
+  }
+  const char* directory = argv[1];
+  int status = 0;
+  for (int i = 2; i < argc; ++i) {
+    if (!sblz::posix::WriteSymbolIndexFile(argv[i], directory, demangle)) {
+      std::cerr << "[Error] cannot index " << argv[i]
+                << ": no build ID, or cannot write to " << directory
+                << std::endl;
+      status = 1;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2020 Leedehai. All rights reserved.
+// Use of this source code is governed under the LICENSE.txt file.
+// -----
+// Symbolizes the raw traces recorded with sblz::posix::RecordRawTrace(),
+// e.g. by crash handlers appending them to one file, against the original
+// object files, which are matched to the modules in the traces by build ID.
+// Each object file is read once for the addresses of all the traces in it.
+// The traces are printed in order, separated by an empty line, one address
+// per line as "[NN] 0x<address> <symbol>" like example_symbolize does. An
+// address whose object file is not given is printed as the build ID of its
+// module and its offset, and one not in a module as "(blank)". With the
+// option --demangle, the names are demangled.
+//
+// Usage:
+//   sblz_symbolize_trace [--demangle] TRACE_FILE OBJECT_FILE...
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "sblz/sblz.h"
+
+// Size of the buffer of a symbol, including '\0'.
+static const size_t kSymbolSize = 1024;
+
+int main(int argc, char* argv[]) {
+  bool demangle = false;
+  if (argc > 1 && !std::strcmp(argv[1], "--demangle")) {
+    demangle = true;
+    --argc;
+    ++argv;
+  }
+  if (argc < 3) {
+    std::cerr << "[Error] expect the trace file and at least 1 object file, "
+                 "optionally preceded by --demangle."
+              << std::endl;
+    return 1;
+  }
+  std::ifstream trace_file(argv[1], std::ios::binary);
+  if (!trace_file) {
+    std::cerr << "[Error] cannot open " << argv[1] << std::endl;
+    return 1;
+  }
+  const std::vector<char> data((std::istreambuf_iterator<char>(trace_file)),
+                               std::istreambuf_iterator<char>());
+
+  // Decode the traces, each in two passes: one to get the number of frames.
+  std::vector<std::vector<sblz::posix::RawTraceFrame>> traces;
+  for (size_t position = 0; position < data.size();) {
+    size_t num_frames = 0;
+    if (!sblz::posix::DecodeRawTrace(data.data() + position,
+                                     data.size() - position, NULL, 0,
+                                     &num_frames)) {
+      std::cerr << "[Error] malformed trace at byte " << position << " of "
+                << argv[1] << std::endl;
+      return 1;
+    }
+    std::vector<sblz::posix::RawTraceFrame> frames(num_frames);
+    position += sblz::posix::DecodeRawTrace(
+        data.data() + position, data.size() - position, frames.data(),
+        frames.size(), &num_frames);
+    traces.push_back(frames);
+  }
+
+  // Symbolize the frames of all the traces in each object file together.
+  std::vector<std::vector<std::string>> symbols;
+  for (const auto& frames : traces) {
+    symbols.emplace_back(frames.size());
+  }
+  int status = 0;
+  for (int i = 2; i < argc; ++i) {
+    uint8_t build_id[sblz::posix::kMaxBuildIdSize];
+    const int build_id_size = sblz::posix::GetBuildId(argv[i], build_id);
+    if (build_id_size < 0) {
+      std::cerr << "[Error] no build ID in " << argv[i] << std::endl;
+      status = 1;
+      continue;
+    }
+    std::vector<uint64_t> offsets;
+    std::vector<std::string*> outputs;
+    for (size_t t = 0; t < traces.size(); ++t) {
+      for (size_t f = 0; f < traces[t].size(); ++f) {
+        const sblz::posix::RawTraceFrame& frame = traces[t][f];
+        if (frame.build_id_size == static_cast<size_t>(build_id_size) &&
+            !std::memcmp(frame.build_id, build_id, build_id_size)) {
+          offsets.push_back(frame.offset);
+          outputs.push_back(&symbols[t][f]);
+        }
+      }
+    }
+    std::vector<char> buffers(offsets.size() * kSymbolSize);
+    sblz::posix::SymbolizeOffsets(argv[i], offsets.data(), offsets.size(),
+                                  buffers.data(), kSymbolSize, demangle);
+    for (size_t j = 0; j < offsets.size(); ++j) {
+      *outputs[j] = buffers.data() + j * kSymbolSize;
+    }
+  }
+
+  for (size_t t = 0; t < traces.size(); ++t) {
+    if (t > 0) {
+      std::cout << '\n';
+    }
+    const size_t num_frames = traces[t].size();
+    for (size_t f = 0; f < num_frames; ++f) {
+      const sblz::posix::RawTraceFrame& frame = traces[t][f];
+      std::string& symbol = symbols[t][f];
+      if (symbol.empty() && frame.build_id != NULL) {
+        std::ostringstream stream;
+        for (size_t k = 0; k < frame.build_id_size; ++k) {
+          stream << std::hex << std::setfill('0') << std::setw(2)
+                 << static_cast<int>(frame.build_id[k]);
+        }
+        stream << "+0x" << std::hex << frame.offset;
+        symbol = stream.str();
+      } else if (symbol.empty()) {
+        symbol = "(blank)";
+      }
+      std::cout << "[" << std::dec << std::setfill('0') << std::setw(2)
+                << (num_frames - f - 1) << "] 0x" << std::hex
+                << std::setw(16) << (frame.load_bias + frame.offset) << " "
+                << symbol << std::endl;
+    }
+  }
+  return status;
+}